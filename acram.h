@@ -0,0 +1,122 @@
+#ifndef ACRAM_H
+#define ACRAM_H
+
+#include <stddef.h>
+/**
+ * @file acram.h
+ * @brief C interface of libacram
+ * @details Functions return @p ACRAM_OK on success or another result code,
+ * a description of the last failure of the calling thread is given by
+ * @p acram_error. Nothing is printed. Expressions are opaque handles
+ * that must be released with @p acram_free. Different expressions may
+ * be used from different threads at once.
+ *
+ * @code
+ * acram_expr* f = NULL;
+ * acram_expr* df = NULL;
+ * const char* tex = NULL;
+ * double value = 0.0;
+ * double a = 2.0;
+ * if (acram_parse("f(x) = a*sin(x)", &f) == ACRAM_OK &&
+ *     acram_derivative(f, &df) == ACRAM_OK &&
+ *     acram_simplify(df) == ACRAM_OK &&
+ *     acram_evaluate(df, 0.5, &a, 1, &value) == ACRAM_OK &&
+ *     acram_render(df, &tex) == ACRAM_OK)
+ *     printf("%s = %g\n", tex, value);
+ * acram_free(df);
+ * acram_free(f);
+ * @endcode
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Result codes of libacram functions
+enum acram_results {
+    ACRAM_OK = 0,
+    /// The definition can't be parsed
+    ACRAM_ERR_SYNTAX,
+    /// The expression is explicitly incorrect, like division by zero
+    ACRAM_ERR_SEMANTICS,
+    /// A null pointer or a wrong number of parameter values was given
+    ACRAM_ERR_ARGUMENT,
+    /// Memory could not be allocated
+    ACRAM_ERR_MEMORY
+};
+
+/// Function of one or several variables
+typedef struct acram_expr acram_expr;
+
+/**
+ * @brief Parse a function definition like "f(x) = a*sin(x)"
+ * @param definition null-terminated definition, variables other than the first one
+ * as in "f(x, y) = x*sin(y)" are also the first parameters
+ * @param expr receives the new expression
+ */
+int acram_parse(const char* definition, acram_expr** expr);
+
+/**
+ * @brief Get derivative of an expression
+ * @param expr function to differentiate, it is not changed
+ * @param derivative receives the new expression
+ */
+int acram_derivative(acram_expr* expr, acram_expr** derivative);
+
+/**
+ * @brief Get partial derivative of an expression
+ * @param expr function to differentiate, it is not changed
+ * @param variable name of any variable of the function
+ * @param derivative receives the new expression, with the same variables and parameters
+ */
+int acram_partial(acram_expr* expr, const char* variable, acram_expr** derivative);
+
+/// Simplify an expression in place
+int acram_simplify(acram_expr* expr);
+
+/**
+ * @brief Substitute a number for a parameter
+ * @param expr expression to change in place
+ * @param name name of the parameter, it is ignored if the expression does not use it
+ * @param value the number, subexpressions that become numeric are calculated
+ */
+int acram_bind(acram_expr* expr, const char* name, double value);
+
+/**
+ * @brief Calculate value of an expression
+ * @param expr expression to evaluate
+ * @param x value of the variable
+ * @param params values of parameters in order of @p acram_parameter
+ * @param count number of values, must be equal to @p acram_parameters_count
+ * @param result receives the value
+ */
+int acram_evaluate(const acram_expr* expr, double x, const double* params, size_t count, double* result);
+
+/**
+ * @brief Get LaTeX representation of an expression
+ * @param expr expression to render
+ * @param tex receives a null-terminated string owned by @p expr,
+ * it stays valid until the next call for the same expression
+ */
+int acram_render(acram_expr* expr, const char** tex);
+
+/// Get name of the function, "f'" for the derivative of "f"
+const char* acram_name(const acram_expr* expr);
+
+/// Get number of parameters of the function
+size_t acram_parameters_count(const acram_expr* expr);
+
+/// Get name of a parameter, NULL if @p index is out of range
+const char* acram_parameter(const acram_expr* expr, size_t index);
+
+/// Release an expression, NULL is ignored
+void acram_free(acram_expr* expr);
+
+/// Get description of the last failure in the calling thread
+const char* acram_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ACRAM_H
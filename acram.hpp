@@ -0,0 +1,43 @@
+#ifndef ACRAM_HPP
+#define ACRAM_HPP
+
+#include "parser.hpp"
+#include "expr_tree.hpp"
+#include "flat_expr.hpp"
+#include "egraph.hpp"
+#include "taylor.hpp"
+#include "partials.hpp"
+#include "csource.hpp"
+#include "jit.hpp"
+/**
+ * @file acram.hpp
+ * @brief C++ interface of libacram
+ * @details A definition is parsed by @p expr_parser, which reports errors
+ * by @p status and @p strerror. The resulting @p expr_tree is a movable handle
+ * that can be checked, differentiated, simplified, evaluated and rendered to LaTeX;
+ * @p expr_egraph simplifies it further by equality saturation,
+ * @p taylor_series calculates derivatives of any order at a point,
+ * @p expr_partials calculates the Jacobian and the Hessian of functions
+ * of several variables like "f(x, y) = x*sin(y)",
+ * @p flat_expr is a compact copy for repeated evaluation, @p jit_function
+ * compiles it to native code and @p c_emitter turns expressions into
+ * C source code. Nothing is printed.
+ *
+ * @code
+ * std::string definition = "f(x) = a*sin(x)";
+ * expr_parser parser(definition);
+ * expr_tree function = parser.read();
+ * if (parser.status() != OK)
+ *     return parser.strerror();
+ * function.checkSemantics();
+ * if (function.status() != T_OK)
+ *     return function.strerror();
+ * expr_tree derivative = function.derivative();
+ * derivative.simplify();
+ * double a = 2.0;
+ * double value = derivative.evaluate(0.5, &a);
+ * std::string tex = derivative.toTex();
+ * @endcode
+ */
+
+#endif // ACRAM_HPP
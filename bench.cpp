@@ -0,0 +1,621 @@
+#include "common.hpp"
+#include "parser.hpp"
+#include "generator.hpp"
+#include "flat_expr.hpp"
+#include "egraph.hpp"
+#include "taylor.hpp"
+#include "partials.hpp"
+#include "jit.hpp"
+#include <memory>
+#include <new>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+/**
+ * @file bench.cpp
+ * @brief benchmarks of processing stages
+ * @details Every stage is run on the examples, on families of inputs
+ * that scale in depth, width and number of parameters and on random functions
+ * of growing size. Results are printed as JSON objects, one per line.
+ * Stages prefixed with "flat-" work on @p flat_expr and are compared
+ * with the same stages on the pointer tree. Stages prefixed with "jit-"
+ * compile the derivative to native code and compare it with the interpreters:
+ * jit-evaluate sweeps the variable with fixed parameters, so subexpressions
+ * of parameters alone are calculated once, jit-set-evaluate sets parameters
+ * for every point. jit-optimized-evaluate does the same as jit-evaluate
+ * after flat-optimize has rewritten the derivative for cheaper evaluation.
+ * saturate builds an e-graph of the simplified derivative, saturates it
+ * with the default limits and extracts the smallest expression.
+ * taylor calculates Taylor coefficients of the function up to order 8.
+ * partials calculates the Jacobian and the Hessian of the function by all of its
+ * variables, which the "vars-" family of inputs has many of.
+ *
+ * With --counters hardware cache misses are counted too (Linux only,
+ * perf events must be permitted).
+ *
+ * With --check nothing is measured: derivatives of generated functions are
+ * evaluated by the JIT, by @p flat_expr before and after optimize,
+ * by flat_expr::derivative and after e-graph extraction, and every result
+ * is compared with @p Evaluate on the simplified derivative tree.
+ * The exit status is 1 if any of them disagree.
+ *
+ * Usage: acram_bench [--min-time=ms] [--examples=dir] [--filter=substring] [--counters] [--check[=count]]
+ */
+
+// Allocation counters, updated by the replaced global operator new
+static std::size_t alloc_count = 0;
+static std::size_t alloc_bytes = 0;
+
+void* operator new(std::size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    void* ptr = std::malloc(size ? size : 1);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+// GCC does not know that operator new above is backed by malloc
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+// Descriptor of the hardware counter of cache misses, -1 if it is not used
+static int cache_fd = -1;
+
+/// Start counting cache misses of the process, return false if the counter is unavailable
+bool OpenCacheCounter()
+{
+#ifdef __linux__
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cache_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    return cache_fd >= 0;
+}
+
+/// Get number of cache misses counted so far
+std::uint64_t CacheMisses()
+{
+    std::uint64_t count = 0;
+#ifdef __linux__
+    if (cache_fd >= 0 && read(cache_fd, &count, sizeof(count)) != (ssize_t)sizeof(count))
+        count = 0;
+#endif
+    return count;
+}
+
+// Results of evaluation stages are stored here to keep them from being optimized out
+static volatile double sink = 0.0;
+
+/// Accumulates time and allocations of measured regions
+class bench_timer
+{
+    std::chrono::steady_clock::time_point start_;
+    std::size_t start_count_;
+    std::size_t start_bytes_;
+    std::uint64_t start_misses_;
+
+public:
+    std::chrono::nanoseconds elapsed;
+    std::size_t allocs;
+    std::size_t bytes;
+    std::uint64_t misses;
+
+public:
+    bench_timer() :
+        start_(),
+        start_count_(0),
+        start_bytes_(0),
+        start_misses_(0),
+        elapsed(0),
+        allocs(0),
+        bytes(0),
+        misses(0)
+    {}
+
+    void start()
+    {
+        // The counter is read outside of the measured time
+        start_misses_ = CacheMisses();
+        start_count_ = alloc_count;
+        start_bytes_ = alloc_bytes;
+        start_ = std::chrono::steady_clock::now();
+    }
+
+    void stop()
+    {
+        elapsed += std::chrono::steady_clock::now() - start_;
+        allocs += alloc_count - start_count_;
+        bytes += alloc_bytes - start_bytes_;
+        misses += CacheMisses() - start_misses_;
+    }
+};
+
+/// Input of a benchmark
+struct bench_input
+{
+    std::string name;
+    std::string definition;
+};
+
+/// Settings of the benchmark run
+struct bench_settings
+{
+    std::chrono::nanoseconds min_time;
+    fs::path examples;
+    std::string filter;
+};
+
+// Number of objects kept alive at once by stages that produce trees
+const std::size_t BATCH = 256;
+
+// Highest order of Taylor coefficients calculated by the taylor stage
+const std::size_t TAYLOR_ORDER = 8;
+
+/// Run stage with increasing number of iterations until it takes long enough and print the result
+template <typename Stage>
+void Measure(const char* stage, const bench_input& input, std::size_t nodes, const bench_settings& settings, Stage run)
+{
+    std::string name = std::string(stage) + '/' + input.name;
+    if (name.find(settings.filter) == std::string::npos)
+        return;
+    std::size_t iterations = 1;
+    bench_timer timer;
+    while (true) {
+        timer = bench_timer();
+        run(iterations, timer);
+        if (timer.elapsed >= settings.min_time || iterations >= (1UL << 30))
+            break;
+        // Aim a bit above the minimal time, but grow at most tenfold per step
+        double per_op = std::max<double>(1.0, (double)timer.elapsed.count() / iterations);
+        double wanted = 1.2 * settings.min_time.count() / per_op;
+        iterations = (std::size_t)std::min(std::max(wanted, iterations * 2.0), iterations * 10.0);
+    }
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    double ns_per_op = (double)timer.elapsed.count() / iterations;
+    std::string misses;
+    if (cache_fd >= 0)
+        misses = ", \"cache_misses_per_op\": " + std::to_string((double)timer.misses / iterations);
+    std::printf(
+        "{\"stage\": \"%s\", \"input\": \"%s\", \"nodes\": %zu, \"iterations\": %zu, "
+        "\"ns_per_op\": %.1f, \"nodes_per_sec\": %.0f, \"allocs_per_op\": %.2f, "
+        "\"bytes_per_op\": %.1f, \"peak_rss_kb\": %ld%s}\n",
+        stage, input.name.c_str(), nodes, iterations,
+        ns_per_op, ns_per_op > 0 ? nodes * 1e9 / ns_per_op : 0.0,
+        (double)timer.allocs / iterations, (double)timer.bytes / iterations,
+        usage.ru_maxrss, misses.c_str());
+    std::fflush(stdout);
+}
+
+/// Benchmark every stage on one input
+void RunStages(const bench_input& input, const bench_settings& settings)
+{
+    expr_parser parser(input.definition);
+    expr_tree function = parser.read();
+    if (parser.status() != OK) {
+        std::fprintf(stderr, "acram_bench: %s: %s\n", input.name.c_str(), parser.strerror().c_str());
+        return;
+    }
+    expr_tree derivative = function.derivative();
+    derivative.simplify();
+
+    Measure("parse", input, function.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        std::unique_ptr<expr_tree> trees[BATCH];
+        for (std::size_t i = 0; i < iterations; i++) {
+            timer.start();
+            expr_parser batch_parser(input.definition);
+            trees[i % BATCH].reset(new expr_tree(batch_parser.read()));
+            timer.stop();
+            if (i % BATCH == BATCH - 1)
+                for (std::size_t j = 0; j < BATCH; j++)
+                    trees[j].reset();
+        }
+    });
+    Measure("derivative", input, function.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        std::unique_ptr<expr_tree> trees[BATCH];
+        for (std::size_t i = 0; i < iterations; i++) {
+            timer.start();
+            trees[i % BATCH].reset(new expr_tree(function.derivative()));
+            timer.stop();
+            if (i % BATCH == BATCH - 1)
+                for (std::size_t j = 0; j < BATCH; j++)
+                    trees[j].reset();
+        }
+    });
+    Measure("partials", input, function.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        for (std::size_t i = 0; i < iterations; i++) {
+            timer.start();
+            expr_partials partials(function);
+            timer.stop();
+        }
+    });
+    std::size_t raw_size = 0;
+    {
+        expr_tree raw = function.derivative();
+        raw_size = raw.size();
+    }
+    Measure("simplify", input, raw_size, settings, [&](std::size_t iterations, bench_timer& timer) {
+        for (std::size_t i = 0; i < iterations; i++) {
+            expr_tree raw = function.derivative();
+            timer.start();
+            raw.simplify();
+            timer.stop();
+        }
+    });
+    Measure("saturate", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        for (std::size_t i = 0; i < iterations; i++) {
+            timer.start();
+            expr_egraph graph;
+            std::uint32_t root = graph.add(derivative.root());
+            graph.saturate(saturation_limits());
+            delete graph.extract(root, EXTRACT_SIZE);
+            timer.stop();
+        }
+    });
+    Measure("tex", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        for (std::size_t i = 0; i < iterations; i++) {
+            timer.start();
+            std::string tex = derivative.toTex();
+            timer.stop();
+        }
+    });
+    Measure("copy", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        expr_node* copies[BATCH] = {};
+        for (std::size_t i = 0; i < iterations; i++) {
+            timer.start();
+            copies[i % BATCH] = Copy(derivative.root());
+            timer.stop();
+            if (i % BATCH == BATCH - 1 || i == iterations - 1)
+                for (std::size_t j = 0; j <= i % BATCH; j++)
+                    delete copies[j];
+        }
+    });
+    Measure("teardown", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        expr_node* copies[BATCH] = {};
+        for (std::size_t i = 0; i < iterations; i += BATCH) {
+            std::size_t count = std::min(BATCH, iterations - i);
+            for (std::size_t j = 0; j < count; j++)
+                copies[j] = Copy(derivative.root());
+            timer.start();
+            for (std::size_t j = 0; j < count; j++)
+                delete copies[j];
+            timer.stop();
+        }
+    });
+
+    tld::vector<double, 0> params;
+    params.resize(SymbolCount());
+    for (std::size_t i = 0; i < params.size(); i++)
+        params[i] = 0.5 + 0.01 * (double)i;
+    flat_expr flat(function.root());
+    flat_expr flat_derived(derivative.root());
+    Measure("flatten", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        for (std::size_t i = 0; i < iterations; i++) {
+            timer.start();
+            flat_expr built(derivative.root());
+            timer.stop();
+        }
+    });
+    Measure("evaluate", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        double sum = 0.0;
+        timer.start();
+        for (std::size_t i = 0; i < iterations; i++)
+            sum += Evaluate(derivative.root(), 0.25 + 1e-9 * (double)i, params.data());
+        timer.stop();
+        sink = sum;
+    });
+    Measure("taylor", input, function.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        taylor_series series;
+        double coefficients[TAYLOR_ORDER + 1];
+        double sum = 0.0;
+        timer.start();
+        for (std::size_t i = 0; i < iterations; i++) {
+            series.expand(function.root(), 0.25 + 1e-9 * (double)i, params.data(), TAYLOR_ORDER, coefficients);
+            sum += coefficients[TAYLOR_ORDER];
+        }
+        timer.stop();
+        sink = sum;
+    });
+    Measure("flat-evaluate", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        tld::vector<double, 0> results;
+        double sum = 0.0;
+        timer.start();
+        for (std::size_t i = 0; i < iterations; i++)
+            sum += flat_derived.evaluate(0.25 + 1e-9 * (double)i, params.data(), results);
+        timer.stop();
+        sink = sum;
+    });
+    Measure("jit-compile", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        for (std::size_t i = 0; i < iterations; i++) {
+            timer.start();
+            jit_function compiled(flat_derived);
+            timer.stop();
+        }
+    });
+    jit_function compiled(flat_derived);
+    compiled.setParameters(params.data());
+    Measure("jit-evaluate", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        double sum = 0.0;
+        timer.start();
+        for (std::size_t i = 0; i < iterations; i++)
+            sum += compiled.evaluate(0.25 + 1e-9 * (double)i);
+        timer.stop();
+        sink = sum;
+    });
+    Measure("jit-set-evaluate", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        double sum = 0.0;
+        timer.start();
+        for (std::size_t i = 0; i < iterations; i++) {
+            compiled.setParameters(params.data());
+            sum += compiled.evaluate(0.25 + 1e-9 * (double)i);
+        }
+        timer.stop();
+        sink = sum;
+    });
+    Measure("flat-optimize", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        for (std::size_t i = 0; i < iterations; i++) {
+            flat_expr optimized(flat_derived);
+            timer.start();
+            optimized.optimize();
+            timer.stop();
+        }
+    });
+    flat_expr flat_optimized(flat_derived);
+    flat_optimized.optimize();
+    jit_function compiled_optimized(flat_optimized);
+    compiled_optimized.setParameters(params.data());
+    Measure("jit-optimized-evaluate", input, derivative.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        double sum = 0.0;
+        timer.start();
+        for (std::size_t i = 0; i < iterations; i++)
+            sum += compiled_optimized.evaluate(0.25 + 1e-9 * (double)i);
+        timer.stop();
+        sink = sum;
+    });
+    Measure("flat-derivative", input, function.size(), settings, [&](std::size_t iterations, bench_timer& timer) {
+        flat_expr derivs[BATCH];
+        for (std::size_t i = 0; i < iterations; i++) {
+            timer.start();
+            derivs[i % BATCH] = flat.derivative();
+            timer.stop();
+            if (i % BATCH == BATCH - 1)
+                for (std::size_t j = 0; j < BATCH; j++)
+                    derivs[j] = flat_expr();
+        }
+    });
+    Measure("flat-simplify", input, raw_size, settings, [&](std::size_t iterations, bench_timer& timer) {
+        for (std::size_t i = 0; i < iterations; i++) {
+            flat_expr raw = flat.derivative();
+            timer.start();
+            raw.simplify();
+            timer.stop();
+        }
+    });
+}
+
+/// Nested compositions: e(k) = g(e(k - 1))*x + k, with g cycling through functions
+std::string DepthFamily(unsigned depth)
+{
+    static const char* funcs[] = {"sin", "exp", "sqrt", "cos", "arctg", "ln"};
+    std::string expr = "x";
+    for (unsigned i = 1; i <= depth; i++)
+        expr = std::string(funcs[i % 6]) + '(' + expr + ")*x + " + std::to_string(i);
+    return "f(x) = " + expr;
+}
+
+/// Polynomials: 1*x^1 + 2*x^2 + ... + width*x^width
+std::string WidthFamily(unsigned width)
+{
+    std::string expr;
+    for (unsigned i = 1; i <= width; i++)
+        expr += (i > 1 ? " + " : "") + std::to_string(i) + "*x^" + std::to_string(i);
+    return "f(x) = " + expr;
+}
+
+/// Sums of harmonics with their own amplitudes and frequencies: a1*sin(b1*x) + ...
+std::string ParamsFamily(unsigned count)
+{
+    std::string expr;
+    for (unsigned i = 1; i <= count; i++) {
+        std::string index = std::to_string(i);
+        expr += (i > 1 ? " + " : "") + ("a" + index) + "*sin(b" + index + "*x)";
+    }
+    return "f(x) = " + expr;
+}
+
+/// Chains of variables coupled in pairs: sin(x1*x2) + sin(x2*x3) + ... + exp(xn)
+std::string VarsFamily(unsigned count)
+{
+    std::string vars = "x1", expr;
+    for (unsigned i = 2; i <= count; i++) {
+        std::string prev = "x" + std::to_string(i - 1), cur = "x" + std::to_string(i);
+        vars += ", " + cur;
+        expr += "sin(" + prev + "*" + cur + ") + ";
+    }
+    return "f(" + vars + ") = " + expr + "exp(x" + std::to_string(count) + ")";
+}
+
+// Relative tolerance of the check, rewritten expressions round differently
+const double CHECK_TOLERANCE = 1e-6;
+
+/// Check whether values agree within the tolerance
+bool Agree(double expected, double actual)
+{
+    return std::fabs(expected - actual) <= CHECK_TOLERANCE * (1.0 + std::fabs(expected));
+}
+
+/// Compare a result with the reference and print it if they disagree
+bool CheckValue(const char* stage, const char* name, double x, double expected, double actual)
+{
+    if (Agree(expected, actual))
+        return true;
+    std::fprintf(stderr, "acram_bench: check %s/%s at x = %g: expected %.17g, got %.17g\n",
+        stage, name, x, expected, actual);
+    return false;
+}
+
+/**
+ * Compare derivatives of one function calculated in every way with @p Evaluate
+ * @return number of points checked or -1 if any of them disagree
+ */
+long CheckFunction(expr_tree& function, const char* name, tld::vector<double, 0>& params)
+{
+    expr_tree derivative = function.derivative();
+    derivative.simplify();
+    params.resize(SymbolCount());
+    for (std::size_t i = 0; i < params.size(); i++)
+        params[i] = 0.5 + 0.01 * (double)i;
+
+    flat_expr flat_derived(derivative.root());
+    flat_expr flat_optimized(flat_derived);
+    flat_optimized.optimize();
+    flat_expr flat_derivative = flat_expr(function.root()).derivative();
+    flat_derivative.simplify();
+    jit_function compiled(flat_derived);
+    compiled.setParameters(params.data());
+    jit_function compiled_optimized(flat_optimized);
+    compiled_optimized.setParameters(params.data());
+    expr_egraph graph;
+    std::uint32_t root = graph.add(derivative.root());
+    graph.saturate(saturation_limits());
+    std::unique_ptr<expr_node> extracted(graph.extract(root, EXTRACT_SIZE));
+
+    tld::vector<double, 0> results;
+    long points = 0;
+    bool agree = true;
+    for (double x = -2.3; x < 2.5; x += 0.37) {
+        double expected = Evaluate(derivative.root(), x, params.data());
+        // Rewrites may remove points where the reference is undefined, like x/x,
+        // and where it is so ill-conditioned that rounding decides the result
+        double nearby = Evaluate(derivative.root(), x * (1.0 + 1e-13), params.data());
+        if (!std::isfinite(expected) || !Agree(expected, nearby))
+            continue;
+        agree &= CheckValue("flat-evaluate", name, x, expected, flat_derived.evaluate(x, params.data(), results));
+        agree &= CheckValue("flat-optimize", name, x, expected, flat_optimized.evaluate(x, params.data(), results));
+        agree &= CheckValue("flat-derivative", name, x, expected, flat_derivative.evaluate(x, params.data(), results));
+        agree &= CheckValue("jit-evaluate", name, x, expected, compiled.evaluate(x));
+        agree &= CheckValue("jit-optimized-evaluate", name, x, expected, compiled_optimized.evaluate(x));
+        agree &= CheckValue("saturate", name, x, expected, Evaluate(extracted.get(), x, params.data()));
+        points++;
+    }
+    return agree ? points : -1;
+}
+
+/**
+ * Check derivatives of @p count generated functions of every size
+ * @return true if all of them agree
+ * @details Small functions are checked too, because most large ones
+ * are undefined everywhere, like arccos(16) + ...
+ */
+bool CheckCorpus(std::size_t count)
+{
+    std::size_t checked = 0, points = 0, mismatches = 0;
+    tld::vector<double, 0> params;
+    generator_options gen_opts;
+    for (std::size_t size : {16, 32, 64}) {
+        gen_opts.size = size;
+        expr_generator generator(gen_opts);
+        for (std::size_t index = 0; index < count; index++) {
+            std::string definition = generator.generate(index);
+            expr_parser parser(definition);
+            expr_tree function = parser.read();
+            if (parser.status() != OK)
+                continue;
+            std::string name = "random-" + std::to_string(size) + "/" + std::to_string(index);
+            long result = CheckFunction(function, name.c_str(), params);
+            if (result < 0) {
+                std::fprintf(stderr, "acram_bench: check %s: %s\n", name.c_str(), definition.c_str());
+                mismatches++;
+            } else {
+                points += (std::size_t)result;
+            }
+            checked++;
+        }
+    }
+    std::printf("{\"stage\": \"check\", \"functions\": %zu, \"points\": %zu, \"mismatches\": %zu}\n",
+        checked, points, mismatches);
+    return mismatches == 0 && points > 0;
+}
+
+int main(int argc, char* argv[])
+{
+    bench_settings settings = {std::chrono::milliseconds(200), fs::path(ACRAM_EXAMPLES_DIR), std::string()};
+    std::size_t check = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 11, "--min-time=") == 0) {
+            settings.min_time = std::chrono::milliseconds(std::atol(arg.c_str() + 11));
+        } else if (arg.compare(0, 11, "--examples=") == 0) {
+            settings.examples = arg.substr(11);
+        } else if (arg.compare(0, 9, "--filter=") == 0) {
+            settings.filter = arg.substr(9);
+        } else if (arg == "--counters") {
+            if (!OpenCacheCounter())
+                std::fprintf(stderr, "acram_bench: hardware counters are unavailable\n");
+        } else if (arg == "--check") {
+            check = 300;
+        } else if (arg.compare(0, 8, "--check=") == 0) {
+            check = (std::size_t)std::atol(arg.c_str() + 8);
+        } else {
+            std::fprintf(stderr, "usage: acram_bench [--min-time=ms] [--examples=dir] [--filter=substring] [--counters] [--check[=count]]\n");
+            return 1;
+        }
+    }
+    if (check > 0)
+        return CheckCorpus(check) ? 0 : 1;
+
+    tld::vector<bench_input> inputs;
+    static const char* examples[] = {"f.txt", "g.txt", "h.txt", "s.txt"};
+    for (const char* example : examples) {
+        std::ifstream input_fs(settings.examples / example);
+        bench_input input;
+        input.name = example;
+        if (input_fs.is_open() && std::getline(input_fs, input.definition))
+            inputs.push_back(input);
+        else
+            std::fprintf(stderr, "acram_bench: can't read example %s\n", example);
+    }
+    for (unsigned depth : {4, 8, 16, 32})
+        inputs.push_back({"depth-" + std::to_string(depth), DepthFamily(depth)});
+    for (unsigned width : {16, 64, 256, 1024})
+        inputs.push_back({"width-" + std::to_string(width), WidthFamily(width)});
+    for (unsigned count : {4, 16, 64})
+        inputs.push_back({"params-" + std::to_string(count), ParamsFamily(count)});
+    for (unsigned count : {4, 16, 64})
+        inputs.push_back({"vars-" + std::to_string(count), VarsFamily(count)});
+    generator_options gen_opts;
+    for (std::size_t size : {64, 256, 1024, 4096}) {
+        gen_opts.size = size;
+        gen_opts.parameters = (unsigned)size / 32;
+        expr_generator generator(gen_opts);
+        inputs.push_back({"random-" + std::to_string(size), generator.generate(0)});
+    }
+
+    for (std::size_t i = 0; i < inputs.size(); i++)
+        RunStages(inputs[i], settings);
+    return 0;
+}
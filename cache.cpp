@@ -0,0 +1,269 @@
+#include "cache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <unistd.h>
+
+// First line of every entry file, bumped when the format changes
+static const char ENTRY_MAGIC[] = "acram-cache 1";
+
+std::uint64_t Fnv1a(const std::string& data, std::uint64_t hash)
+{
+    for (unsigned char byte : data) {
+        hash ^= byte;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string HexDigest(std::uint64_t hash)
+{
+    char buf[17] = {};
+    std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)hash);
+    return std::string(buf);
+}
+
+// Get name of a temporary file next to another one, unique among processes and their threads
+static fs::path TemporaryPath(const fs::path& path)
+{
+    static std::atomic<unsigned long> counter(0);
+    fs::path tmp_path = path;
+    tmp_path += ".tmp" + std::to_string(getpid()) + '-' + std::to_string(counter.fetch_add(1));
+    return tmp_path;
+}
+
+// Create cache directory if needed. Returns false if it can't be used
+static bool PrepareDirectory(const fs::path& dir)
+{
+    std::error_code err;
+    fs::create_directories(dir, err);
+    if (err || !fs::is_directory(dir, err)) {
+        std::cout << "Acram: can't use cache directory " << dir << ", caching disabled" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Remove least recently modified files with the extension until their total size fits the limit
+static void TrimDirectory(const fs::path& dir, const fs::path& extension, std::uintmax_t limit)
+{
+    struct entry_info {
+        fs::file_time_type atime;
+        std::uintmax_t size;
+        fs::path path;
+    };
+    tld::vector<entry_info> entries;
+    std::uintmax_t total_size = 0;
+    std::error_code err;
+    for (const auto& dir_entry : fs::directory_iterator(dir, err)) {
+        if (dir_entry.path().extension() != extension)
+            continue;
+        entry_info info = {dir_entry.last_write_time(err), dir_entry.file_size(err), dir_entry.path()};
+        if (err)
+            continue;
+        total_size += info.size;
+        entries.push_back(info);
+    }
+    if (total_size <= limit)
+        return;
+    std::sort(entries.data(), entries.data() + entries.size(),
+        [](const entry_info& lhs, const entry_info& rhs) { return lhs.atime < rhs.atime; });
+    for (std::size_t i = 0; i < entries.size() && total_size > limit; i++) {
+        if (fs::remove(entries[i].path, err))
+            total_size -= entries[i].size;
+    }
+}
+
+derivative_cache::derivative_cache(const fs::path& dir, std::uintmax_t limit) :
+    dir_(dir),
+    limit_(limit),
+    enabled_(!dir.empty()),
+    hits_(0),
+    misses_(0),
+    saved_(0)
+{
+    if (enabled_)
+        enabled_ = PrepareDirectory(dir_);
+}
+
+bool derivative_cache::enabled() const
+{
+    return enabled_;
+}
+
+fs::path derivative_cache::entryPath(const std::string& input, const std::string& options_key) const
+{
+    std::uint64_t hash = Fnv1a(input);
+    hash = Fnv1a(std::string(1, '\0') + options_key, hash);
+    return dir_ / (HexDigest(hash) + ".entry");
+}
+
+bool derivative_cache::lookup(const std::string& func_str, const std::string& options_key, std::string& tex)
+{
+    if (!enabled_)
+        return false;
+    auto start = std::chrono::steady_clock::now();
+    fs::path path = entryPath(func_str, options_key);
+    std::ifstream entry_fs(path, std::ios::binary);
+    if (!entry_fs.is_open()) {
+        misses_++;
+        return false;
+    }
+
+    // Input and options are stored in the entry to rule out hash collisions
+    std::string magic, line, tree;
+    long long cost = 0;
+    std::size_t tex_size = 0;
+    std::getline(entry_fs, magic);
+    std::getline(entry_fs, line);
+    bool valid = (magic == ENTRY_MAGIC) && (line == "input " + func_str);
+    std::getline(entry_fs, line);
+    valid = valid && (line == "options " + options_key);
+    valid = valid && (entry_fs >> line >> cost) && (line == "cost");
+    entry_fs.ignore(1);
+    std::getline(entry_fs, tree);
+    valid = valid && (entry_fs >> line >> tex_size) && (line == "tex");
+    entry_fs.ignore(1);
+    if (valid) {
+        tex.resize(tex_size);
+        entry_fs.read(tex.data(), tex_size);
+        valid = (entry_fs.gcount() == (std::streamsize)tex_size);
+    }
+    if (!valid) {
+        misses_++;
+        return false;
+    }
+
+    // Mark entry as recently used
+    std::error_code err;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), err);
+    hits_++;
+    saved_ += std::chrono::nanoseconds(cost) - (std::chrono::steady_clock::now() - start);
+    return true;
+}
+
+void derivative_cache::store(
+    const std::string& func_str,
+    const std::string& options_key,
+    const std::string& tree,
+    const std::string& tex,
+    std::chrono::nanoseconds cost
+    )
+{
+    if (!enabled_)
+        return;
+    fs::path path = entryPath(func_str, options_key);
+    // Write to a temporary file first so that readers never see a partial entry
+    fs::path tmp_path = TemporaryPath(path);
+    {
+        std::ofstream entry_fs(tmp_path, std::ios::binary);
+        if (!entry_fs.is_open())
+            return;
+        entry_fs << ENTRY_MAGIC << '\n'
+            << "input " << func_str << '\n'
+            << "options " << options_key << '\n'
+            << "cost " << (long long)cost.count() << '\n'
+            << "tree " << tree << '\n'
+            << "tex " << tex.size() << '\n'
+            << tex;
+        if (!entry_fs.good()) {
+            entry_fs.close();
+            std::error_code err;
+            fs::remove(tmp_path, err);
+            return;
+        }
+    }
+    std::error_code err;
+    fs::rename(tmp_path, path, err);
+    if (err)
+        fs::remove(tmp_path, err);
+}
+
+void derivative_cache::trim()
+{
+    if (enabled_)
+        TrimDirectory(dir_, ".entry", limit_);
+}
+
+std::string derivative_cache::report() const
+{
+    std::size_t total = hits_ + misses_;
+    if (!enabled_ || total == 0)
+        return std::string();
+    char buf[128] = {};
+    std::snprintf(buf, sizeof(buf), "%zu hits, %zu misses (%.1f%% hit rate), saved %.3f ms",
+        hits_, misses_, 100.0 * hits_ / total,
+        std::chrono::duration<double, std::milli>(saved_).count());
+    return std::string(buf);
+}
+
+pdf_cache::pdf_cache(const fs::path& dir, std::uintmax_t limit) :
+    dir_(dir),
+    limit_(limit),
+    enabled_(!dir.empty())
+{
+    if (enabled_)
+        enabled_ = PrepareDirectory(dir_);
+}
+
+bool pdf_cache::enabled() const
+{
+    return enabled_;
+}
+
+fs::path pdf_cache::entryPath(const std::string& code) const
+{
+    // Stored files are served without the source to compare with, so the name holds
+    // a fingerprint that rules out collisions: a second hash with a different initial value
+    // and the size of the source. A single rename keeps it and the PDF consistent
+    std::string size = std::to_string(code.size());
+    std::uint64_t check = Fnv1a(code, Fnv1a(size));
+    return dir_ / (HexDigest(Fnv1a(code)) + HexDigest(check) + '-' + size + ".pdf");
+}
+
+bool pdf_cache::contains(const std::string& code) const
+{
+    std::error_code err;
+    return enabled_ && fs::is_regular_file(entryPath(code), err);
+}
+
+bool pdf_cache::fetch(const std::string& code, const fs::path& pdf_path)
+{
+    if (!enabled_)
+        return false;
+    fs::path path = entryPath(code);
+    std::error_code err;
+    if (!fs::is_regular_file(path, err))
+        return false;
+    // The old output is removed first: it may be a link to another cached file
+    fs::remove(pdf_path, err);
+    fs::create_hard_link(path, pdf_path, err);
+    if (err) {
+        fs::copy_file(path, pdf_path, fs::copy_options::overwrite_existing, err);
+        if (err)
+            return false;
+    }
+    fs::last_write_time(path, fs::file_time_type::clock::now(), err);
+    return true;
+}
+
+void pdf_cache::store(const std::string& code, const fs::path& pdf_path)
+{
+    if (!enabled_)
+        return;
+    // A copy is made rather than a link: pdflatex rewrites its output in place
+    fs::path path = entryPath(code);
+    fs::path tmp_path = TemporaryPath(path);
+    std::error_code err;
+    fs::copy_file(pdf_path, tmp_path, fs::copy_options::overwrite_existing, err);
+    if (!err)
+        fs::rename(tmp_path, path, err);
+    if (err)
+        fs::remove(tmp_path, err);
+}
+
+void pdf_cache::trim()
+{
+    if (enabled_)
+        TrimDirectory(dir_, ".pdf", limit_);
+}
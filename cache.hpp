@@ -0,0 +1,168 @@
+#ifndef ACRAM_CACHE_HPP
+#define ACRAM_CACHE_HPP
+
+#include "common.hpp"
+#include <cstdint>
+/**
+ * @file cache.hpp
+ * @brief persistent on-disk caches of the program's results
+ */
+
+/// Initial value of the 64-bit FNV-1a hash
+const std::uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+
+/**
+ * @brief Calculate 64-bit FNV-1a hash of a byte string
+ * @param data bytes to hash
+ * @param hash initial value, pass a previous result to hash several strings as one
+ */
+std::uint64_t Fnv1a(const std::string& data, std::uint64_t hash = FNV_OFFSET_BASIS);
+
+/// Get 16-digit hexadecimal representation of a hash
+std::string HexDigest(std::uint64_t hash);
+
+/**
+ * @brief Content-addressed cache of processed functions
+ * @details Each entry is a file named after the hash of the function definition,
+ * exactly as it was given since whitespace matters to the parser, and of the options
+ * it was processed with. An entry holds
+ * the serialized simplified derivative and the TeX code produced for the function.
+ * Modification time of a file is used as the time of last access,
+ * least recently used entries are removed when the cache grows too large.
+ * A cache constructed with an empty directory is disabled and does nothing.
+ */
+class derivative_cache
+{
+    // Directory where entries are stored
+    fs::path dir_;
+    // Maximal total size of entries in bytes
+    std::uintmax_t limit_;
+    bool enabled_;
+
+    // Statistics of the current run
+    std::size_t hits_;
+    std::size_t misses_;
+    // Processing time of hit entries minus time spent reading them
+    std::chrono::nanoseconds saved_;
+
+public:
+    derivative_cache() = delete;
+
+    /**
+     * @brief Open cache in a directory, creating it if needed
+     * @param dir cache directory, empty path disables the cache
+     * @param limit maximal total size of entries in bytes
+     */
+    derivative_cache(const fs::path& dir, std::uintmax_t limit);
+
+    derivative_cache(const derivative_cache& that) = delete;
+    derivative_cache(derivative_cache&& that) = delete;
+    derivative_cache& operator =(const derivative_cache& that) = delete;
+    derivative_cache& operator =(derivative_cache&& that) = delete;
+
+    ~derivative_cache() = default;
+
+    /// Tell whether the cache is used
+    bool enabled() const;
+
+    /**
+     * @brief Search for the result of processing a function
+     * @param func_str function definition as it was entered
+     * @param options_key string identifying output options, see @p OptionsKey
+     * @param tex where to place the cached TeX code
+     * @return true on hit, false if there is no entry
+     */
+    bool lookup(const std::string& func_str, const std::string& options_key, std::string& tex);
+
+    /**
+     * @brief Save the result of processing a function
+     * @param func_str function definition as it was entered
+     * @param options_key string identifying output options, see @p OptionsKey
+     * @param tree serialized simplified derivative
+     * @param tex TeX code produced for the function
+     * @param cost time it took to produce the result
+     * @details Errors are ignored: the cache is an optimization only
+     */
+    void store(
+        const std::string& func_str,
+        const std::string& options_key,
+        const std::string& tree,
+        const std::string& tex,
+        std::chrono::nanoseconds cost
+        );
+
+    /// Remove least recently used entries until the cache fits its size limit
+    void trim();
+
+    /// Get a line with hit rate and saved time for the current run
+    std::string report() const;
+
+private:
+    // Get path of an entry file
+    fs::path entryPath(const std::string& input, const std::string& options_key) const;
+};
+
+/**
+ * @brief Content-addressed cache of compiled documents
+ * @details PDF files are stored under the hash of LaTeX source they were compiled from.
+ * On a hit the file is hard-linked (or copied if linking is impossible)
+ * to the requested output path, so pdflatex need not be started at all.
+ * A cache constructed with an empty directory is disabled and does nothing.
+ */
+class pdf_cache
+{
+    // Directory where PDF files are stored
+    fs::path dir_;
+    // Maximal total size of stored files in bytes
+    std::uintmax_t limit_;
+    bool enabled_;
+
+public:
+    pdf_cache() = delete;
+
+    /**
+     * @brief Open cache in a directory, creating it if needed
+     * @param dir cache directory, empty path disables the cache
+     * @param limit maximal total size of stored files in bytes
+     */
+    pdf_cache(const fs::path& dir, std::uintmax_t limit);
+
+    pdf_cache(const pdf_cache& that) = delete;
+    pdf_cache(pdf_cache&& that) = delete;
+    pdf_cache& operator =(const pdf_cache& that) = delete;
+    pdf_cache& operator =(pdf_cache&& that) = delete;
+
+    ~pdf_cache() = default;
+
+    /// Tell whether the cache is used
+    bool enabled() const;
+
+    /// Tell whether PDF compiled from the source is in the cache
+    bool contains(const std::string& code) const;
+
+    /**
+     * @brief Place PDF compiled from the source at the output path
+     * @param code LaTeX source code of the document
+     * @param pdf_path path of the PDF file to create
+     * @return true on hit, false if there is no such document in the cache
+     * @details Existing file at @p pdf_path is replaced
+     */
+    bool fetch(const std::string& code, const fs::path& pdf_path);
+
+    /**
+     * @brief Save a copy of PDF compiled from the source
+     * @param code LaTeX source code of the document
+     * @param pdf_path path of the compiled PDF file
+     * @details Errors are ignored: the cache is an optimization only
+     */
+    void store(const std::string& code, const fs::path& pdf_path);
+
+    /// Remove least recently used files until the cache fits its size limit
+    void trim();
+
+private:
+    // Get path of the stored file, named by a fingerprint of the source
+    fs::path entryPath(const std::string& code) const;
+};
+
+#endif // ACRAM_CACHE_HPP
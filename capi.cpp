@@ -0,0 +1,155 @@
+#include "acram.h"
+#include "acram.hpp"
+#include <new>
+
+/// Handle of an expression given to C code
+struct acram_expr
+{
+    expr_tree tree;
+    // Output of the last acram_render call
+    std::string tex;
+};
+
+// Description of the last failure of the thread
+static thread_local std::string last_error;
+
+// Remember description of a failure and return its code
+static int Fail(int result, const std::string& message)
+{
+    last_error = message;
+    return result;
+}
+
+int acram_parse(const char* definition, acram_expr** expr)
+{
+    if (definition == nullptr || expr == nullptr)
+        return Fail(ACRAM_ERR_ARGUMENT, "null pointer given");
+    *expr = nullptr;
+    try {
+        // The parser refers to the string while it works
+        std::string str(definition);
+        expr_parser parser(str);
+        expr_tree tree = parser.read();
+        if (parser.status() != OK)
+            return Fail(ACRAM_ERR_SYNTAX, parser.strerror());
+        tree.checkSemantics();
+        if (tree.status() != T_OK)
+            return Fail(ACRAM_ERR_SEMANTICS, tree.strerror());
+        *expr = new acram_expr{std::move(tree), std::string()};
+    } catch (const std::bad_alloc&) {
+        return Fail(ACRAM_ERR_MEMORY, "out of memory");
+    }
+    return ACRAM_OK;
+}
+
+int acram_derivative(acram_expr* expr, acram_expr** derivative)
+{
+    if (expr == nullptr || derivative == nullptr)
+        return Fail(ACRAM_ERR_ARGUMENT, "null pointer given");
+    *derivative = nullptr;
+    try {
+        *derivative = new acram_expr{expr->tree.derivative(), std::string()};
+    } catch (const std::bad_alloc&) {
+        return Fail(ACRAM_ERR_MEMORY, "out of memory");
+    }
+    return ACRAM_OK;
+}
+
+int acram_partial(acram_expr* expr, const char* variable, acram_expr** derivative)
+{
+    if (expr == nullptr || variable == nullptr || derivative == nullptr)
+        return Fail(ACRAM_ERR_ARGUMENT, "null pointer given");
+    *derivative = nullptr;
+    try {
+        std::uint32_t id = FindSymbol(variable);
+        if (id == NO_SYMBOL || VecFind(expr->tree.variables(), id) == std::string::npos)
+            return Fail(ACRAM_ERR_ARGUMENT, "no variable named " + std::string(variable));
+        *derivative = new acram_expr{expr->tree.derivative(id), std::string()};
+    } catch (const std::bad_alloc&) {
+        return Fail(ACRAM_ERR_MEMORY, "out of memory");
+    }
+    return ACRAM_OK;
+}
+
+int acram_simplify(acram_expr* expr)
+{
+    if (expr == nullptr)
+        return Fail(ACRAM_ERR_ARGUMENT, "null pointer given");
+    expr->tree.simplify();
+    return ACRAM_OK;
+}
+
+int acram_bind(acram_expr* expr, const char* name, double value)
+{
+    if (expr == nullptr || name == nullptr)
+        return Fail(ACRAM_ERR_ARGUMENT, "null pointer given");
+    // A name that was never met can't be a parameter of the expression
+    std::uint32_t id = FindSymbol(name);
+    if (id == NO_SYMBOL)
+        return ACRAM_OK;
+    try {
+        std::unordered_map<std::uint32_t, double> values;
+        values[id] = value;
+        expr->tree.bind(values);
+    } catch (const std::bad_alloc&) {
+        return Fail(ACRAM_ERR_MEMORY, "out of memory");
+    }
+    return ACRAM_OK;
+}
+
+int acram_evaluate(const acram_expr* expr, double x, const double* params, size_t count, double* result)
+{
+    if (expr == nullptr || result == nullptr || (count > 0 && params == nullptr))
+        return Fail(ACRAM_ERR_ARGUMENT, "null pointer given");
+    if (count != expr->tree.parameters().size())
+        return Fail(ACRAM_ERR_ARGUMENT, "expected " + std::to_string(expr->tree.parameters().size()) +
+            " parameter values, got " + std::to_string(count));
+    try {
+        *result = expr->tree.evaluate(x, params);
+    } catch (const std::bad_alloc&) {
+        return Fail(ACRAM_ERR_MEMORY, "out of memory");
+    }
+    return ACRAM_OK;
+}
+
+int acram_render(acram_expr* expr, const char** tex)
+{
+    if (expr == nullptr || tex == nullptr)
+        return Fail(ACRAM_ERR_ARGUMENT, "null pointer given");
+    try {
+        expr->tex = expr->tree.toTex();
+    } catch (const std::bad_alloc&) {
+        return Fail(ACRAM_ERR_MEMORY, "out of memory");
+    }
+    *tex = expr->tex.c_str();
+    return ACRAM_OK;
+}
+
+const char* acram_name(const acram_expr* expr)
+{
+    if (expr == nullptr)
+        return nullptr;
+    return expr->tree.getName().c_str();
+}
+
+size_t acram_parameters_count(const acram_expr* expr)
+{
+    return expr == nullptr ? 0 : expr->tree.parameters().size();
+}
+
+const char* acram_parameter(const acram_expr* expr, size_t index)
+{
+    if (expr == nullptr || index >= expr->tree.parameters().size())
+        return nullptr;
+    return SymbolName(expr->tree.parameters()[index]).c_str();
+}
+
+void acram_free(acram_expr* expr)
+{
+    delete expr;
+}
+
+const char* acram_error(void)
+{
+    return last_error.c_str();
+}
@@ -1,4 +1,10 @@
 #include "common.hpp"
+#include "stats.hpp"
+#include "symbols.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
 
 expr_value::expr_value() :
     integer(0)
@@ -20,7 +26,9 @@ expr_node::expr_node(
     parent(nullptr),
     left(nullptr),
     right(nullptr)
-{}
+{
+    STATS_NODE_CREATED();
+}
 
 expr_node::expr_node(
     char _type,
@@ -34,36 +42,19 @@ expr_node::expr_node(
     parent(_parent),
     left(_left),
     right(_right)
-{}
+{
+    STATS_NODE_CREATED();
+}
 
 expr_node::~expr_node()
 {
+    STATS_NODE_DELETED();
     if (left != nullptr)
         delete left;
     if (right != nullptr)
         delete right;
 }
 
-tld::vector<fs::path> FillPathv(int names_count, char* names[])
-{
-    tld::vector<fs::path> pathv;
-    for (int i = 0; i < names_count; i++) {
-        fs::path current_path(names[i]);
-        if (!fs::exists(current_path)) {
-            std::cout << "File " << current_path <<
-                " does not exist and would not be differentiated" << std::endl;
-            continue;
-        }
-        if (!fs::is_regular_file(current_path)) {
-            std::cout << "File " << current_path <<
-            " is not a regular file, I won't touch it" << std::endl;;
-            continue;
-        }
-        pathv.push_back(current_path);
-    }
-    return pathv;
-}
-
 void Link(expr_node* _parent, expr_node* _left, expr_node* _right)
 {
     if (_parent != nullptr) {
@@ -92,6 +83,66 @@ expr_node* Copy(const expr_node* src)
     return dst;
 }
 
+std::size_t TreeSize(const expr_node* node)
+{
+    if (node == nullptr)
+        return 0;
+    return TreeSize(node->left) + TreeSize(node->right) + 1;
+}
+
+bool IsEqual(const expr_node* lhs, const expr_node* rhs)
+{
+    if (lhs == rhs)
+        return true;
+    if (lhs == nullptr || rhs == nullptr)
+        return false;
+    if (lhs->type != rhs->type)
+        return false;
+    if (lhs->type == FRAC) {
+        if (std::memcmp(&lhs->value.frac, &rhs->value.frac, sizeof(double)) != 0)
+            return false;
+    } else if (lhs->value.integer != rhs->value.integer) {
+        return false;
+    }
+    return IsEqual(lhs->left, rhs->left) && IsEqual(lhs->right, rhs->right);
+}
+
+std::size_t NodeHash(const expr_node* node, std::size_t left_hash, std::size_t right_hash)
+{
+    std::size_t hash = (std::size_t)node->type * 0x9E3779B97F4A7C15ULL;
+    if (node->type == FRAC)
+        hash ^= std::hash<double>()(node->value.frac);
+    else
+        hash ^= std::hash<long>()(node->value.integer) + 0x632BE59BD9B4E019ULL;
+    hash = (hash ^ (left_hash + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2))) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (right_hash + 0x94D049BB133111EBULL + (hash << 6) + (hash >> 2))) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 31);
+}
+
+std::string Serialize(const expr_node* node)
+{
+    if (node == nullptr)
+        return "_";
+    switch (node->type) {
+    case INT:
+        return "i" + std::to_string(node->value.integer);
+    case FRAC: {
+        char buf[32] = {};
+        std::snprintf(buf, sizeof(buf), "f%a", node->value.frac);
+        return std::string(buf);
+    }
+    case VAR:
+        return "v";
+    case PAR:
+        return "p" + SymbolName((std::uint32_t)node->value.integer);
+    case OP:
+        return "(" + std::to_string(node->value.integer) + ' ' +
+            Serialize(node->left) + ' ' + Serialize(node->right) + ')';
+    default:
+        return "?";
+    }
+}
+
 size_t Extract(const std::string& where_from, std::string& where_to, size_t pos, const char delim)
 {
     size_t end = where_from.find_first_of(delim, pos);
@@ -204,6 +255,9 @@ bool NeedParentheses(const expr_node& node)
         return false;
     } else if (!IsOnLeft(&node) && node.parent->value.integer == PWR) {
         return false;
+    } else if (node.type == INT && node.value.integer < 0) {
+        // Negative numbers are written with a minus sign, which only a left operand can start with
+        return !IsOnLeft(&node) || node.parent->value.integer == PWR;
     }   else if (node.value.integer == PWR && node.parent->value.integer == PWR && IsOnLeft(&node)) {
         // Power of power always require parentheses
         return true;
@@ -293,6 +347,66 @@ bool IsNegative(const expr_node* node)
     return false;
 }
 
+double Calculate(int op, double left, double right)
+{
+    switch (op) {
+    case ADD:
+        return left + right;
+    case SUB:
+        return left - right;
+    case MUL:
+        return left * right;
+    case DIV:
+        return left / right;
+    case PWR:
+        return std::pow(left, right);
+    case EXP:
+        return std::exp(right);
+    case LOG:
+        return std::log(right);
+    case SQRT:
+        return std::sqrt(right);
+    case SIN:
+        return std::sin(right);
+    case COS:
+        return std::cos(right);
+    case TAN:
+        return std::tan(right);
+    case COT:
+        return 1.0 / std::tan(right);
+    case ASIN:
+        return std::asin(right);
+    case ACOS:
+        return std::acos(right);
+    case ATAN:
+        return std::atan(right);
+    case ACOT:
+        // Continuous branch with values in (0, pi)
+        return std::acos(0.0) - std::atan(right);
+    default:
+        return 0.0;
+    }
+}
+
+double Evaluate(const expr_node* node, double x, const double* params)
+{
+    if (node == nullptr)
+        return 0.0;
+    switch (node->type) {
+    case INT:
+        return (double)node->value.integer;
+    case FRAC:
+        return node->value.frac;
+    case VAR:
+        return x;
+    case PAR:
+        return params[node->value.integer];
+    case OP:
+        return Calculate(node->value.integer, Evaluate(node->left, x, params), Evaluate(node->right, x, params));
+    default:
+        return 0.0;
+    }
+}
 
 static const char* splashes[] = {
     "Утрём нос Стивену Вольфраму!\n",
@@ -306,8 +420,13 @@ static const char* splashes[] = {
 
 std::string Splash()
 {
-    std::default_random_engine randomizer;
     unsigned seed = (unsigned) std::chrono::system_clock::now().time_since_epoch().count();
+    return Splash(seed);
+}
+
+std::string Splash(unsigned seed)
+{
+    std::default_random_engine randomizer;
     randomizer.seed(seed);
     unsigned index = randomizer() % (sizeof(splashes) / sizeof(const char*));
     return std::string(splashes[index]);
@@ -23,7 +23,9 @@ enum error_codes {
     ERR_INVALID_OPERAND,
     ERR_NO_EXPR,
     ERR_GARBAGE,
-    ERR_NO_EQUAL_SIGN
+    ERR_NO_EQUAL_SIGN,
+    ERR_BAD_OPTION,
+    ERR_BAD_VARIABLE
 };
 
 /// Types of expression tree nodes
@@ -122,12 +124,32 @@ public:
  */
 expr_node* Copy(const expr_node* src);
 
+/// Get number of nodes in a subtree
+std::size_t TreeSize(const expr_node* node);
+
+/**
+ * @brief Tell whether two subtrees are structurally identical
+ * @details Nodes are compared by type and value, parents are not compared
+ */
+bool IsEqual(const expr_node* lhs, const expr_node* rhs);
+
+/**
+ * @brief Get hash of a node combined with hashes of its subtrees
+ * @param node node to hash, its subtrees are not visited
+ * @param left_hash hash of the left subtree (zero if there is none)
+ * @param right_hash hash of the right subtree (zero if there is none)
+ * @details Structurally identical subtrees always have equal hashes
+ */
+std::size_t NodeHash(const expr_node* node, std::size_t left_hash, std::size_t right_hash);
+
 /**
- * @brief Generate a @p std::filesystem::path vector from command line argument vector
- * @param names_count number of strings to read from @p names
- * @param names argument array starting from the first name to convert
+ * @brief Get a compact textual representation of a subtree
+ * @param node root of the subtree
+ * @details Nodes are written in prefix form: "(op left right)" for operators
+ * ("_" stands for a missing operand), "i<n>" for integers, "f<n>" for fractions,
+ * "v" for the variable and "p<name>" for parameters
  */
-tld::vector<fs::path> FillPathv(int names_count, char* names[]);
+std::string Serialize(const expr_node* node);
 
 /**
  * @brief Extract a substring up to a delimeter
@@ -195,9 +217,29 @@ bool IsCalculable(const expr_node* node);
  */
 bool IsNegative(const expr_node* node);
 
+/**
+ * @brief Apply an operation to numbers
+ * @param op operation code defined in operations::
+ * @param left value of the left operand, zero if there is none
+ * @param right value of the right operand
+ * @details Unary minus is subtraction from zero, functions take @p right
+ */
+double Calculate(int op, double left, double right);
+
+/**
+ * @brief Calculate value of a subtree
+ * @param node root of the subtree
+ * @param x value of the variable
+ * @param params values of parameters indexed by symbol ids, see @p InternSymbol
+ */
+double Evaluate(const expr_node* node, double x, const double* params);
+
 /// Get randomly chosen phrase
 std::string Splash();
 
+/// Get phrase chosen by a seed, so that the same seed always gives the same phrase
+std::string Splash(unsigned seed);
+
 /** 
  * Find next non-space character in string
  * @param str string to search
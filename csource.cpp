@@ -0,0 +1,238 @@
+#include "csource.hpp"
+#include <cctype>
+#include <cstdio>
+
+// Get C literal of an integer, always of type double
+static std::string Literal(long value)
+{
+    std::string literal = std::to_string(value) + ".0";
+    return value < 0 ? "(" + literal + ")" : literal;
+}
+
+// Get C literal of a fraction that gives back exactly the same value
+static std::string Literal(double value)
+{
+    char buf[32] = {};
+    std::snprintf(buf, sizeof(buf), "%.17g", value);
+    std::string literal(buf);
+    if (literal.find_first_of(".e") == std::string::npos)
+        literal += ".0";
+    return value < 0 ? "(" + literal + ")" : literal;
+}
+
+// Tell whether node is an integer exponent small enough to be expanded, and get it
+static bool SmallExponent(const expr_node* node, long& exponent)
+{
+    if (node->type == INT)
+        exponent = node->value.integer;
+    else if (node->type == OP && node->value.integer == SUB && node->left == nullptr && node->right->type == INT)
+        exponent = -node->right->value.integer;
+    else
+        return false;
+    return exponent >= -c_emitter::SMALL_POWER && exponent <= c_emitter::SMALL_POWER;
+}
+
+std::string CName(const std::string& name)
+{
+    std::string result;
+    for (char chr : name) {
+        if (chr == '\'')
+            result += "_d";
+        else if (std::isalnum((unsigned char)chr) || chr == '_')
+            result += chr;
+        else
+            result += '_';
+    }
+    if (result.empty() || std::isdigit((unsigned char)result[0]))
+        result = "_" + result;
+    return result;
+}
+
+void c_emitter::add(const expr_tree& tree, const std::string& name)
+{
+    body out;
+    std::string result = operand(tree.root(), out);
+    std::string unused;
+    std::string args = arguments(tree.variable(), tree.parameters(), out, unused);
+    functions_ += "static inline double " + (name.empty() ? uniqueName(tree.getName()) : name) +
+        "(" + args + ")\n{\n" +
+        unused + out.code + "    return " + result + ";\n}\n\n";
+}
+
+void c_emitter::addGroup(const tld::vector<const expr_tree*>& trees, const std::string& name)
+{
+    if (trees.empty())
+        return;
+    body out;
+    tld::vector<std::uint32_t> parameters;
+    tld::vector<unsigned char, 0> listed;
+    std::string results;
+    for (std::size_t i = 0; i < trees.size(); i++) {
+        const tld::vector<std::uint32_t>& tree_parameters = trees[i]->parameters();
+        for (std::size_t j = 0; j < tree_parameters.size(); j++) {
+            std::uint32_t id = tree_parameters[j];
+            if (id >= listed.size())
+                listed.resize(id + 1);
+            if (!listed[id]) {
+                listed[id] = 1;
+                parameters.push_back(id);
+            }
+        }
+        results += "    out[" + std::to_string(i) + "] = " + operand(trees[i]->root(), out) + ";\n";
+    }
+    std::string unused;
+    std::string args = arguments(trees[0]->variable(), parameters, out, unused);
+    functions_ += "static inline void " + name + "(" + args + ", double* out)\n{\n" +
+        unused + out.code + results + "}\n\n";
+}
+
+std::string c_emitter::uniqueName(const std::string& name)
+{
+    std::string base = "fn_" + CName(name);
+    std::string unique = base;
+    // Suffixed names may have been given too, for a function named "f_2" for example
+    for (std::size_t count = 2; !names_.insert(unique).second; count++)
+        unique = base + "_" + std::to_string(count);
+    return unique;
+}
+
+bool c_emitter::empty() const
+{
+    return functions_.empty();
+}
+
+std::string c_emitter::source() const
+{
+    return "/* Generated by Acram Alpha */\n#include <math.h>\n\n" + functions_;
+}
+
+std::string c_emitter::arguments(std::uint32_t variable, const tld::vector<std::uint32_t>& parameters, const body& out, std::string& unused) const
+{
+    std::string args = "double v_" + CName(SymbolName(variable));
+    // Derivatives may not depend on the variable
+    if (variable >= out.used.size() || !out.used[variable])
+        unused += "    (void)v_" + CName(SymbolName(variable)) + ";\n";
+    for (std::size_t i = 0; i < parameters.size(); i++) {
+        std::string arg = "p_" + CName(SymbolName(parameters[i]));
+        args += ", double " + arg;
+        // Simplification may remove all occurences of a parameter
+        if (parameters[i] >= out.used.size() || !out.used[parameters[i]])
+            unused += "    (void)" + arg + ";\n";
+    }
+    return args;
+}
+
+std::string c_emitter::operand(const expr_node* node, body& out)
+{
+    switch (node->type) {
+    case INT:
+        return Literal(node->value.integer);
+    case FRAC:
+        return Literal(node->value.frac);
+    case VAR:
+    case PAR: {
+        std::uint32_t id = (std::uint32_t)node->value.integer;
+        if (id >= out.used.size())
+            out.used.resize(id + 1);
+        out.used[id] = 1;
+        return (node->type == VAR ? "v_" : "p_") + CName(SymbolName(id));
+    }
+    case OP: {
+        long exponent = 0;
+        if (node->value.integer == PWR && SmallExponent(node->right, exponent))
+            return power(operand(node->left, out), exponent, out);
+        std::string left = node->left ? operand(node->left, out) : std::string();
+        std::string right = operand(node->right, out);
+        return compute(node->value.integer, left, right, out);
+    }
+    default:
+        return "0.0";
+    }
+}
+
+std::string c_emitter::power(const std::string& base, long exponent, body& out)
+{
+    if (exponent == 0)
+        return "1.0";
+    if (exponent < 0)
+        return compute(DIV, "1.0", power(base, -exponent, out), out);
+    if (exponent == 1)
+        return base;
+    // Square-and-multiply
+    std::string half = power(base, exponent / 2, out);
+    std::string square = compute(MUL, half, half, out);
+    return exponent % 2 ? compute(MUL, square, base, out) : square;
+}
+
+std::string c_emitter::compute(int op, const std::string& left, const std::string& right, body& out)
+{
+    std::string lhs = left;
+    std::string rhs = right;
+    // Operands of commutative operations are ordered, so that a*b and b*a are computed once
+    if ((op == ADD || op == MUL) && rhs < lhs)
+        std::swap(lhs, rhs);
+    std::string key = std::to_string(op) + '(' + lhs + ',' + rhs + ')';
+    auto found = out.values.find(key);
+    if (found != out.values.end())
+        return found->second;
+
+    std::string expr;
+    switch (op) {
+    case ADD:
+        expr = lhs + " + " + rhs;
+        break;
+    case SUB:
+        expr = lhs.empty() ? "-" + rhs : lhs + " - " + rhs;
+        break;
+    case MUL:
+        expr = lhs + " * " + rhs;
+        break;
+    case DIV:
+        expr = lhs + " / " + rhs;
+        break;
+    case PWR:
+        expr = "pow(" + lhs + ", " + rhs + ")";
+        break;
+    case EXP:
+        expr = "exp(" + rhs + ")";
+        break;
+    case LOG:
+        expr = "log(" + rhs + ")";
+        break;
+    case SQRT:
+        expr = "sqrt(" + rhs + ")";
+        break;
+    case SIN:
+        expr = "sin(" + rhs + ")";
+        break;
+    case COS:
+        expr = "cos(" + rhs + ")";
+        break;
+    case TAN:
+        expr = "tan(" + rhs + ")";
+        break;
+    case COT:
+        expr = "1.0 / tan(" + rhs + ")";
+        break;
+    case ASIN:
+        expr = "asin(" + rhs + ")";
+        break;
+    case ACOS:
+        expr = "acos(" + rhs + ")";
+        break;
+    case ATAN:
+        expr = "atan(" + rhs + ")";
+        break;
+    case ACOT:
+        // pi/2 - arctan, continuous with values in (0, pi)
+        expr = "1.5707963267948966 - atan(" + rhs + ")";
+        break;
+    default:
+        expr = "0.0";
+        break;
+    }
+    std::string name = "t" + std::to_string(out.temps++);
+    out.code += "    const double " + name + " = " + expr + ";\n";
+    out.values.emplace(key, name);
+    return name;
+}
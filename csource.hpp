@@ -0,0 +1,101 @@
+#ifndef ACRAM_CSOURCE_HPP
+#define ACRAM_CSOURCE_HPP
+
+#include "expr_tree.hpp"
+#include <unordered_map>
+#include <unordered_set>
+/**
+ * @file csource.hpp
+ * @brief generation of C source code that evaluates expressions
+ */
+
+/**
+ * @brief Emitter of self-contained C functions computing expressions
+ * @details Every expression becomes a @p static @p inline function that takes
+ * the variable and then parameters in order of @p expr_tree::parameters.
+ * Each operation is computed once into a temporary, so repeated subexpressions
+ * are shared, and integer powers up to @p SMALL_POWER are expanded into multiplications.
+ * The result is valid C99 and C++ and only depends on <math.h>.
+ *
+ * Names of functions are the names of expressions prefixed with "fn_", with every
+ * apostrophe replaced by "_d", so the derivative of "f" is "fn_f_d". The variable
+ * and parameters are prefixed with "v_" and "p_", so no name clashes with <math.h>.
+ */
+class c_emitter
+{
+public:
+    /// Largest absolute value of an integer exponent that is expanded into multiplications
+    static const long SMALL_POWER = 16;
+
+private:
+    // Emitted functions
+    std::string functions_;
+    // Names given by uniqueName
+    std::unordered_set<std::string> names_;
+
+    // Function body being emitted
+    struct body
+    {
+        std::string code;
+        // Operands of computed operations mapped to names of temporaries
+        std::unordered_map<std::string, std::string> values;
+        std::size_t temps = 0;
+        // Symbol ids of the variable and parameters that were used
+        tld::vector<unsigned char, 0> used;
+    };
+
+public:
+    c_emitter() = default;
+    ~c_emitter() = default;
+
+    /**
+     * @brief Emit a function computing the expression
+     * @param tree expression to compute
+     * @param name name of the function given by @p uniqueName,
+     * by default one is made of the name of the expression
+     */
+    void add(const expr_tree& tree, const std::string& name = std::string());
+
+    /**
+     * @brief Emit a function computing several expressions at once
+     * @param trees expressions of the same variable, such as a function and its derivatives
+     * @param name name of the function given by @p uniqueName
+     * @details The function stores values in the array given as its last argument,
+     * in order of @p trees. Subexpressions common to several expressions
+     * are computed once. Parameters are the union of parameters of all expressions
+     * in order of appearance.
+     */
+    void addGroup(const tld::vector<const expr_tree*>& trees, const std::string& name);
+
+    /**
+     * @brief Get a function name that has not been given yet
+     * @details Returns C identifier made of @p name with the "fn_" prefix,
+     * and with a numeric suffix if the identifier was given before
+     */
+    std::string uniqueName(const std::string& name);
+
+    /// Tell whether nothing has been emitted
+    bool empty() const;
+
+    /// Get source file with all emitted functions
+    std::string source() const;
+
+private:
+    // Get name of a temporary, literal or argument holding value of a subtree
+    std::string operand(const expr_node* node, body& out);
+
+    // Get name of a temporary holding result of an operation on operands
+    std::string compute(int op, const std::string& left, const std::string& right, body& out);
+
+    // Get name of a temporary holding an integer power of an operand
+    std::string power(const std::string& base, long exponent, body& out);
+
+    // Get declarations of arguments, the variable and then parameters,
+    // and statements that mark unused ones as such
+    std::string arguments(std::uint32_t variable, const tld::vector<std::uint32_t>& parameters, const body& out, std::string& unused) const;
+};
+
+/// Get C identifier made of the name of an expression
+std::string CName(const std::string& name);
+
+#endif // ACRAM_CSOURCE_HPP
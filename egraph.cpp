@@ -0,0 +1,698 @@
+#include "egraph.hpp"
+#include "flat_expr.hpp"
+#include <climits>
+#include <cstring>
+
+const long expr_egraph::NO_CONSTANT = LONG_MIN;
+
+saturation_limits::saturation_limits() :
+    max_nodes(10000),
+    max_passes(30),
+    time_ms(1000)
+{}
+
+bool egraph_key::operator ==(const egraph_key& that) const
+{
+    return type == that.type && left == that.left && right == that.right && bits == that.bits;
+}
+
+std::size_t egraph_key_hash::operator ()(const egraph_key& key) const
+{
+    std::uint64_t hash = key.bits * 0x9e3779b97f4a7c15ULL;
+    hash ^= ((std::uint64_t)key.left << 32 | key.right) + 0x632be59bd9b4e019ULL + (hash << 6) + (hash >> 2);
+    hash ^= (std::uint64_t)(unsigned char)key.type + (hash << 6) + (hash >> 2);
+    return (std::size_t)hash;
+}
+
+// Tell whether magnitude of a number is below the limit
+static bool IsSmall(long number, long limit)
+{
+    return number > -limit && number < limit;
+}
+
+// Calculate integer operation if the result is exact and small.
+// Returns false if it is not calculated
+static bool FoldIntegers(int op, bool unary, long lhs, long rhs, long& result)
+{
+    const long SUM_LIMIT = 1L << 61;
+    const long PRODUCT_LIMIT = 1L << 31;
+    switch (op) {
+    case ADD:
+        if (!IsSmall(lhs, SUM_LIMIT) || !IsSmall(rhs, SUM_LIMIT))
+            return false;
+        result = lhs + rhs;
+        return true;
+    case SUB:
+        if (!IsSmall(lhs, SUM_LIMIT) || !IsSmall(rhs, SUM_LIMIT))
+            return false;
+        result = unary ? -rhs : lhs - rhs;
+        return true;
+    case MUL:
+        if (!IsSmall(lhs, PRODUCT_LIMIT) || !IsSmall(rhs, PRODUCT_LIMIT))
+            return false;
+        result = lhs * rhs;
+        return true;
+    case DIV:
+        if (rhs == 0 || !IsSmall(lhs, SUM_LIMIT) || lhs % rhs != 0)
+            return false;
+        result = lhs / rhs;
+        return true;
+    case PWR:
+        // Zero to the power of zero is left for the semantic check
+        if (rhs < 0 || rhs > 62 || (lhs == 0 && rhs == 0))
+            return false;
+        result = 1;
+        for (long i = 0; i < rhs; i++) {
+            if (!IsSmall(result, PRODUCT_LIMIT) || !IsSmall(lhs, PRODUCT_LIMIT))
+                return false;
+            result *= lhs;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::size_t expr_egraph::size() const
+{
+    return types_.size();
+}
+
+std::size_t expr_egraph::classes() const
+{
+    std::size_t count = 0;
+    for (std::uint32_t i = 0; i < parent_.size(); i++)
+        if (parent_[i] == i)
+            count++;
+    return count;
+}
+
+std::uint32_t expr_egraph::find(std::uint32_t cls) const
+{
+    if (cls == NO_CLASS)
+        return NO_CLASS;
+    while (parent_[cls] != cls)
+        cls = parent_[cls];
+    return cls;
+}
+
+std::uint32_t expr_egraph::add(char type, const expr_value& value, std::uint32_t lhs, std::uint32_t rhs)
+{
+    egraph_key key;
+    key.type = type;
+    key.left = find(lhs);
+    key.right = find(rhs);
+    std::memcpy(&key.bits, &value, sizeof(key.bits));
+    auto found = memo_.find(key);
+    if (found != memo_.end())
+        return find(owner_[found->second]);
+    std::uint32_t node = (std::uint32_t)types_.size();
+    std::uint32_t cls = (std::uint32_t)parent_.size();
+    types_.push_back(type);
+    values_.push_back(value);
+    left_.push_back(key.left);
+    right_.push_back(key.right);
+    owner_.push_back(cls);
+    unique_.push_back(1);
+    parent_.push_back(cls);
+    members_.emplace_back().push_back(node);
+    constants_.push_back(type == INT ? value.integer : NO_CONSTANT);
+    memo_[key] = node;
+    return cls;
+}
+
+std::uint32_t expr_egraph::add(const expr_node* root)
+{
+    std::uint32_t lhs = root->left ? add(root->left) : NO_CLASS;
+    std::uint32_t rhs = root->right ? add(root->right) : NO_CLASS;
+    return add(root->type, root->value, lhs, rhs);
+}
+
+std::uint32_t expr_egraph::make(int op, std::uint32_t lhs, std::uint32_t rhs)
+{
+    return add(OP, expr_value((long)op), lhs, rhs);
+}
+
+std::uint32_t expr_egraph::number(long value)
+{
+    return add(INT, expr_value(value), NO_CLASS, NO_CLASS);
+}
+
+long expr_egraph::constant(std::uint32_t cls) const
+{
+    return cls == NO_CLASS ? NO_CONSTANT : constants_[find(cls)];
+}
+
+bool expr_egraph::isOp(std::uint32_t node, int op) const
+{
+    return types_[node] == OP && values_[node].integer == op && (op != SUB || left_[node] != NO_CLASS);
+}
+
+bool expr_egraph::isNegation(std::uint32_t node) const
+{
+    return types_[node] == OP && values_[node].integer == SUB && left_[node] == NO_CLASS;
+}
+
+std::uint32_t expr_egraph::leftOf(std::uint32_t node) const
+{
+    return find(left_[node]);
+}
+
+std::uint32_t expr_egraph::rightOf(std::uint32_t node) const
+{
+    return find(right_[node]);
+}
+
+void expr_egraph::equal(std::uint32_t lhs, std::uint32_t rhs)
+{
+    if (find(lhs) == find(rhs))
+        return;
+    pending_.push_back(lhs);
+    pending_.push_back(rhs);
+}
+
+bool expr_egraph::merge(std::uint32_t lhs, std::uint32_t rhs)
+{
+    lhs = find(lhs);
+    rhs = find(rhs);
+    if (lhs == rhs)
+        return false;
+    // The smaller class joins the larger one, which keeps the forest shallow
+    if (members_[lhs].size() < members_[rhs].size())
+        std::swap(lhs, rhs);
+    parent_[rhs] = lhs;
+    for (std::size_t i = 0; i < members_[rhs].size(); i++)
+        members_[lhs].push_back(members_[rhs][i]);
+    members_[rhs].clear();
+    if (constants_[lhs] == NO_CONSTANT)
+        constants_[lhs] = constants_[rhs];
+    return true;
+}
+
+void expr_egraph::rebuild()
+{
+    std::uint32_t count = (std::uint32_t)size();
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        memo_.clear();
+        for (std::uint32_t i = 0; i < count; i++) {
+            left_[i] = find(left_[i]);
+            right_[i] = find(right_[i]);
+            egraph_key key;
+            key.type = types_[i];
+            key.left = left_[i];
+            key.right = right_[i];
+            std::memcpy(&key.bits, &values_[i], sizeof(key.bits));
+            auto inserted = memo_.emplace(key, i);
+            unique_[i] = inserted.second;
+            if (!inserted.second && merge(owner_[inserted.first->second], owner_[i]))
+                merged = true;
+        }
+    }
+    for (std::uint32_t i = 0; i < parent_.size(); i++)
+        members_[i].clear();
+    for (std::uint32_t i = 0; i < count; i++)
+        if (unique_[i])
+            members_[find(owner_[i])].push_back(i);
+}
+
+int expr_egraph::saturate(const saturation_limits& limits)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto out_of_time = [&]() {
+        return limits.time_ms > 0 &&
+            std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(limits.time_ms);
+    };
+    max_nodes_ = limits.max_nodes;
+    rebuild();
+    for (unsigned pass = 0; ; pass++) {
+        if (full())
+            return STOPPED_NODES;
+        if (pass >= limits.max_passes)
+            return STOPPED_PASSES;
+        std::uint32_t count = (std::uint32_t)size();
+        for (std::uint32_t i = 0; i < count && !full(); i++) {
+            if (unique_[i])
+                rewrite(i);
+            if (i % 256 == 255 && out_of_time())
+                break;
+        }
+        bool merged = false;
+        for (std::size_t i = 0; i < pending_.size(); i += 2)
+            if (merge(pending_[i], pending_[i + 1]))
+                merged = true;
+        pending_.clear();
+        rebuild();
+        if (out_of_time())
+            return STOPPED_TIME;
+        if (!merged && size() == count)
+            return SATURATED;
+    }
+}
+
+void expr_egraph::rewrite(std::uint32_t node)
+{
+    if (types_[node] != OP)
+        return;
+    std::uint32_t cls = find(owner_[node]);
+    std::uint32_t lhs = leftOf(node);
+    std::uint32_t rhs = rightOf(node);
+    int op = (int)values_[node].integer;
+    long left_value = constant(lhs);
+    long right_value = constant(rhs);
+    long folded = 0;
+    if (right_value != NO_CONSTANT && (lhs == NO_CLASS || left_value != NO_CONSTANT) &&
+        FoldIntegers(op, lhs == NO_CLASS, left_value, right_value, folded))
+        equal(cls, number(folded));
+    switch (op) {
+    case ADD:
+        addRules(cls, lhs, rhs);
+        break;
+    case SUB:
+        if (lhs == NO_CLASS)
+            negRules(cls, rhs);
+        else
+            subRules(cls, lhs, rhs);
+        break;
+    case MUL:
+        mulRules(cls, lhs, rhs);
+        break;
+    case DIV:
+        divRules(cls, lhs, rhs);
+        break;
+    case PWR:
+        pwrRules(cls, lhs, rhs);
+        break;
+    default:
+        funcRules(cls, op, rhs);
+        break;
+    }
+}
+
+bool expr_egraph::full() const
+{
+    return size() >= max_nodes_;
+}
+
+bool expr_egraph::hasFunc(std::uint32_t cls, int func, std::uint32_t arg) const
+{
+    const tld::vector<std::uint32_t>& nodes = members_[cls];
+    for (std::size_t i = 0; i < nodes.size(); i++)
+        if (isOp(nodes[i], func) && rightOf(nodes[i]) == arg)
+            return true;
+    return false;
+}
+
+bool expr_egraph::hasSquareOf(std::uint32_t cls, int func, std::uint32_t arg) const
+{
+    const tld::vector<std::uint32_t>& nodes = members_[cls];
+    for (std::size_t i = 0; i < nodes.size(); i++)
+        if (isOp(nodes[i], PWR) && constant(rightOf(nodes[i])) == 2 && hasFunc(leftOf(nodes[i]), func, arg))
+            return true;
+    return false;
+}
+
+// Members are indexed rather than referenced in the rules:
+// new classes are added to members_ while they are examined
+
+void expr_egraph::addRules(std::uint32_t cls, std::uint32_t lhs, std::uint32_t rhs)
+{
+    equal(cls, make(ADD, rhs, lhs));
+    if (constant(lhs) == 0)
+        equal(cls, rhs);
+    if (constant(rhs) == 0)
+        equal(cls, lhs);
+    if (lhs == rhs)
+        equal(cls, make(MUL, number(2), lhs));
+    for (std::size_t i = 0; i < members_[rhs].size(); i++) {
+        std::uint32_t node = members_[rhs][i];
+        // a + (-b) = a - b
+        if (isNegation(node))
+            equal(cls, make(SUB, lhs, rightOf(node)));
+    }
+    for (std::size_t i = 0; i < members_[lhs].size(); i++) {
+        std::uint32_t node = members_[lhs][i];
+        std::uint32_t a = leftOf(node);
+        std::uint32_t b = rightOf(node);
+        if (isOp(node, ADD)) {
+            // (a + b) + c = a + (b + c)
+            equal(cls, make(ADD, a, make(ADD, b, rhs)));
+        } else if (isOp(node, SUB)) {
+            // (a - b) + b = a
+            if (b == rhs)
+                equal(cls, a);
+        } else if (isOp(node, MUL)) {
+            // a*b + a = a*(b + 1)
+            if (a == rhs)
+                equal(cls, make(MUL, a, make(ADD, b, number(1))));
+            // a*b + a*e = a*(b + e), a*b + d*b = (a + d)*b
+            for (std::size_t j = 0; j < members_[rhs].size() && !full(); j++) {
+                std::uint32_t other = members_[rhs][j];
+                if (!isOp(other, MUL))
+                    continue;
+                if (leftOf(other) == a)
+                    equal(cls, make(MUL, a, make(ADD, b, rightOf(other))));
+                if (rightOf(other) == b)
+                    equal(cls, make(MUL, make(ADD, a, leftOf(other)), b));
+            }
+        } else if (isOp(node, DIV)) {
+            // a/b + d/b = (a + d)/b
+            for (std::size_t j = 0; j < members_[rhs].size() && !full(); j++) {
+                std::uint32_t other = members_[rhs][j];
+                if (isOp(other, DIV) && rightOf(other) == b)
+                    equal(cls, make(DIV, make(ADD, a, leftOf(other)), b));
+            }
+        } else if (isOp(node, PWR) && constant(b) == 2) {
+            // sin(x)^2 + cos(x)^2 = 1
+            for (std::size_t j = 0; j < members_[a].size() && !full(); j++) {
+                std::uint32_t base = members_[a][j];
+                if (isOp(base, SIN) && hasSquareOf(rhs, COS, rightOf(base)))
+                    equal(cls, number(1));
+            }
+        }
+    }
+}
+
+void expr_egraph::subRules(std::uint32_t cls, std::uint32_t lhs, std::uint32_t rhs)
+{
+    equal(cls, make(ADD, lhs, make(SUB, NO_CLASS, rhs)));
+    if (lhs == rhs)
+        equal(cls, number(0));
+    if (constant(rhs) == 0)
+        equal(cls, lhs);
+    if (constant(lhs) == 0)
+        equal(cls, make(SUB, NO_CLASS, rhs));
+    for (std::size_t i = 0; i < members_[rhs].size(); i++) {
+        std::uint32_t node = members_[rhs][i];
+        // a - (-b) = a + b
+        if (isNegation(node))
+            equal(cls, make(ADD, lhs, rightOf(node)));
+        // 1 - sin(x)^2 = cos(x)^2
+        if (constant(lhs) == 1 && isOp(node, PWR) && constant(rightOf(node)) == 2) {
+            std::uint32_t base = leftOf(node);
+            for (std::size_t j = 0; j < members_[base].size() && !full(); j++) {
+                std::uint32_t sine = members_[base][j];
+                if (isOp(sine, SIN))
+                    equal(cls, make(PWR, make(COS, NO_CLASS, rightOf(sine)), number(2)));
+            }
+        }
+    }
+    for (std::size_t i = 0; i < members_[lhs].size(); i++) {
+        std::uint32_t node = members_[lhs][i];
+        std::uint32_t a = leftOf(node);
+        std::uint32_t b = rightOf(node);
+        if (isOp(node, ADD)) {
+            // (a + b) - b = a, (a + b) - a = b
+            if (b == rhs)
+                equal(cls, a);
+            if (a == rhs)
+                equal(cls, b);
+        } else if (isOp(node, SUB)) {
+            // (a - b) - c = a - (b + c)
+            equal(cls, make(SUB, a, make(ADD, b, rhs)));
+        } else if (isOp(node, MUL)) {
+            // a*b - a = a*(b - 1)
+            if (a == rhs)
+                equal(cls, make(MUL, a, make(SUB, b, number(1))));
+            // a*b - a*e = a*(b - e), a*b - d*b = (a - d)*b
+            for (std::size_t j = 0; j < members_[rhs].size() && !full(); j++) {
+                std::uint32_t other = members_[rhs][j];
+                if (!isOp(other, MUL))
+                    continue;
+                if (leftOf(other) == a)
+                    equal(cls, make(MUL, a, make(SUB, b, rightOf(other))));
+                if (rightOf(other) == b)
+                    equal(cls, make(MUL, make(SUB, a, leftOf(other)), b));
+            }
+        } else if (isOp(node, DIV)) {
+            // a/b - d/b = (a - d)/b
+            for (std::size_t j = 0; j < members_[rhs].size() && !full(); j++) {
+                std::uint32_t other = members_[rhs][j];
+                if (isOp(other, DIV) && rightOf(other) == b)
+                    equal(cls, make(DIV, make(SUB, a, leftOf(other)), b));
+            }
+        }
+    }
+}
+
+void expr_egraph::negRules(std::uint32_t cls, std::uint32_t arg)
+{
+    for (std::size_t i = 0; i < members_[arg].size(); i++) {
+        std::uint32_t node = members_[arg][i];
+        std::uint32_t a = leftOf(node);
+        std::uint32_t b = rightOf(node);
+        if (isNegation(node))
+            equal(cls, b);
+        else if (isOp(node, SUB))
+            equal(cls, make(SUB, b, a));
+        else if (isOp(node, MUL))
+            equal(cls, make(MUL, make(SUB, NO_CLASS, a), b));
+        else if (isOp(node, DIV))
+            equal(cls, make(DIV, make(SUB, NO_CLASS, a), b));
+    }
+}
+
+void expr_egraph::mulRules(std::uint32_t cls, std::uint32_t lhs, std::uint32_t rhs)
+{
+    equal(cls, make(MUL, rhs, lhs));
+    if (constant(lhs) == 0 || constant(rhs) == 0)
+        equal(cls, number(0));
+    if (constant(lhs) == 1)
+        equal(cls, rhs);
+    if (constant(rhs) == 1)
+        equal(cls, lhs);
+    if (constant(lhs) == -1)
+        equal(cls, make(SUB, NO_CLASS, rhs));
+    if (lhs == rhs)
+        equal(cls, make(PWR, lhs, number(2)));
+    for (std::size_t i = 0; i < members_[lhs].size(); i++) {
+        std::uint32_t node = members_[lhs][i];
+        std::uint32_t a = leftOf(node);
+        std::uint32_t b = rightOf(node);
+        if (isOp(node, MUL)) {
+            // (a*b)*c = a*(b*c)
+            equal(cls, make(MUL, a, make(MUL, b, rhs)));
+        } else if (isNegation(node)) {
+            // (-b)*c = -(b*c)
+            equal(cls, make(SUB, NO_CLASS, make(MUL, b, rhs)));
+        } else if (isOp(node, DIV)) {
+            // (a/b)*c = (a*c)/b, (a/b)*b = a
+            equal(cls, make(DIV, make(MUL, a, rhs), b));
+            if (b == rhs)
+                equal(cls, a);
+        } else if (isOp(node, PWR)) {
+            // a^b*a = a^(b + 1), a^b*a^e = a^(b + e)
+            if (a == rhs)
+                equal(cls, make(PWR, a, make(ADD, b, number(1))));
+            for (std::size_t j = 0; j < members_[rhs].size() && !full(); j++) {
+                std::uint32_t other = members_[rhs][j];
+                if (isOp(other, PWR) && leftOf(other) == a)
+                    equal(cls, make(PWR, a, make(ADD, b, rightOf(other))));
+            }
+        } else if (isOp(node, EXP)) {
+            // exp(b)*exp(e) = exp(b + e)
+            for (std::size_t j = 0; j < members_[rhs].size() && !full(); j++) {
+                std::uint32_t other = members_[rhs][j];
+                if (isOp(other, EXP))
+                    equal(cls, make(EXP, NO_CLASS, make(ADD, b, rightOf(other))));
+            }
+        } else if (isOp(node, TAN)) {
+            // tan(x)*cos(x) = sin(x)
+            if (hasFunc(rhs, COS, b))
+                equal(cls, make(SIN, NO_CLASS, b));
+        } else if (isOp(node, COT)) {
+            // cot(x)*sin(x) = cos(x)
+            if (hasFunc(rhs, SIN, b))
+                equal(cls, make(COS, NO_CLASS, b));
+        }
+    }
+}
+
+void expr_egraph::divRules(std::uint32_t cls, std::uint32_t lhs, std::uint32_t rhs)
+{
+    if (constant(rhs) == 1)
+        equal(cls, lhs);
+    if (constant(rhs) == -1)
+        equal(cls, make(SUB, NO_CLASS, lhs));
+    if (constant(lhs) == 0)
+        equal(cls, number(0));
+    if (lhs == rhs)
+        equal(cls, number(1));
+    for (std::size_t i = 0; i < members_[rhs].size(); i++) {
+        std::uint32_t node = members_[rhs][i];
+        std::uint32_t a = leftOf(node);
+        std::uint32_t b = rightOf(node);
+        if (isOp(node, DIV)) {
+            // c/(a/b) = (c*b)/a
+            equal(cls, make(DIV, make(MUL, lhs, b), a));
+        } else if (isNegation(node)) {
+            // c/(-b) = -(c/b)
+            equal(cls, make(SUB, NO_CLASS, make(DIV, lhs, b)));
+        } else if (isOp(node, PWR) && a == lhs) {
+            // a/a^b = a^(1 - b)
+            equal(cls, make(PWR, a, make(SUB, number(1), b)));
+        }
+    }
+    for (std::size_t i = 0; i < members_[lhs].size(); i++) {
+        std::uint32_t node = members_[lhs][i];
+        std::uint32_t a = leftOf(node);
+        std::uint32_t b = rightOf(node);
+        if (isOp(node, DIV)) {
+            // (a/b)/c = a/(b*c)
+            equal(cls, make(DIV, a, make(MUL, b, rhs)));
+        } else if (isOp(node, MUL)) {
+            // (a*b)/c = a*(b/c), (a*b)/a = b, (a*b)/b = a
+            equal(cls, make(MUL, a, make(DIV, b, rhs)));
+            if (a == rhs)
+                equal(cls, b);
+            if (b == rhs)
+                equal(cls, a);
+        } else if (isNegation(node)) {
+            // (-b)/c = -(b/c)
+            equal(cls, make(SUB, NO_CLASS, make(DIV, b, rhs)));
+        } else if (isOp(node, PWR)) {
+            // a^b/a = a^(b - 1), a^b/a^e = a^(b - e)
+            if (a == rhs)
+                equal(cls, make(PWR, a, make(SUB, b, number(1))));
+            for (std::size_t j = 0; j < members_[rhs].size() && !full(); j++) {
+                std::uint32_t other = members_[rhs][j];
+                if (isOp(other, PWR) && leftOf(other) == a)
+                    equal(cls, make(PWR, a, make(SUB, b, rightOf(other))));
+            }
+        } else if (isOp(node, SIN)) {
+            // sin(x)/cos(x) = tan(x)
+            if (hasFunc(rhs, COS, b))
+                equal(cls, make(TAN, NO_CLASS, b));
+        } else if (isOp(node, COS)) {
+            // cos(x)/sin(x) = cot(x)
+            if (hasFunc(rhs, SIN, b))
+                equal(cls, make(COT, NO_CLASS, b));
+        }
+    }
+}
+
+void expr_egraph::pwrRules(std::uint32_t cls, std::uint32_t lhs, std::uint32_t rhs)
+{
+    long exponent = constant(rhs);
+    if (exponent == 1)
+        equal(cls, lhs);
+    if (exponent == 0)
+        equal(cls, number(1));
+    if (constant(lhs) == 1)
+        equal(cls, number(1));
+    // Only integer exponents are moved, (x^2)^(1/2) is not x
+    if (exponent == NO_CONSTANT)
+        return;
+    // a^(-n) = 1/a^n
+    if (exponent < 0)
+        equal(cls, make(DIV, number(1), make(PWR, lhs, number(-exponent))));
+    for (std::size_t i = 0; i < members_[lhs].size(); i++) {
+        std::uint32_t node = members_[lhs][i];
+        std::uint32_t a = leftOf(node);
+        std::uint32_t b = rightOf(node);
+        if (isOp(node, PWR)) {
+            // (a^b)^n = a^(b*n)
+            equal(cls, make(PWR, a, make(MUL, b, rhs)));
+        } else if (isOp(node, SQRT) && exponent == 2) {
+            equal(cls, b);
+        } else if (isNegation(node)) {
+            // (-b)^n = b^n for even n and -(b^n) for odd n
+            if (exponent % 2 == 0)
+                equal(cls, make(PWR, b, rhs));
+            else
+                equal(cls, make(SUB, NO_CLASS, make(PWR, b, rhs)));
+        }
+    }
+}
+
+void expr_egraph::funcRules(std::uint32_t cls, int op, std::uint32_t arg)
+{
+    for (std::size_t i = 0; i < members_[arg].size(); i++) {
+        std::uint32_t node = members_[arg][i];
+        std::uint32_t b = rightOf(node);
+        if (op == EXP && isOp(node, LOG))
+            equal(cls, b);
+        if (op == LOG && isOp(node, EXP))
+            equal(cls, b);
+        if (!isNegation(node))
+            continue;
+        // Odd functions of -x
+        switch (op) {
+        case SIN: case TAN: case COT: case ASIN: case ATAN:
+            equal(cls, make(SUB, NO_CLASS, make(op, NO_CLASS, b)));
+            break;
+        case COS:
+            equal(cls, make(COS, NO_CLASS, b));
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+expr_node* expr_egraph::build(std::uint32_t cls, const tld::vector<std::uint32_t, 0>& best) const
+{
+    std::uint32_t node = best[find(cls)];
+    if (types_[node] == INT && values_[node].integer < 0) {
+        auto negation = new expr_node(OP, (long)SUB, nullptr, nullptr, new expr_node(INT, -values_[node].integer));
+        Link(negation, nullptr, negation->right);
+        return negation;
+    }
+    auto result = new expr_node(types_[node], values_[node]);
+    expr_node* lhs = left_[node] == NO_CLASS ? nullptr : build(left_[node], best);
+    expr_node* rhs = right_[node] == NO_CLASS ? nullptr : build(right_[node], best);
+    Link(result, lhs, rhs);
+    return result;
+}
+
+expr_node* expr_egraph::extract(std::uint32_t cls, int goal) const
+{
+    // Costs of the best tree of every class, the primary one by the goal and the tie breaker
+    const std::uint64_t NO_COST = ~0ULL;
+    std::size_t count = parent_.size();
+    tld::vector<std::uint64_t, 0> primary, secondary;
+    tld::vector<std::uint32_t, 0> best;
+    primary.resize(count);
+    secondary.resize(count);
+    best.resize(count);
+    for (std::size_t i = 0; i < count; i++)
+        primary[i] = secondary[i] = NO_COST;
+    // Costs only decrease, and a tree is always larger than its subtrees,
+    // so relaxation stops and the best nodes never form a cycle
+    bool improved = true;
+    while (improved) {
+        improved = false;
+        for (std::uint32_t i = 0; i < size(); i++) {
+            if (!unique_[i])
+                continue;
+            std::uint32_t lhs = leftOf(i);
+            std::uint32_t rhs = rightOf(i);
+            if ((lhs != NO_CLASS && primary[lhs] == NO_COST) || (rhs != NO_CLASS && primary[rhs] == NO_COST))
+                continue;
+            std::uint64_t nodes = 1, flops = 0;
+            if (types_[i] == OP)
+                flops = (std::uint64_t)OpCost((int)values_[i].integer);
+            else if (types_[i] == INT && values_[i].integer < 0)
+                nodes = 2;
+            std::uint64_t cost_1 = goal == EXTRACT_SIZE ? nodes : flops;
+            std::uint64_t cost_2 = goal == EXTRACT_SIZE ? flops : nodes;
+            if (lhs != NO_CLASS) {
+                cost_1 += primary[lhs];
+                cost_2 += secondary[lhs];
+            }
+            if (rhs != NO_CLASS) {
+                cost_1 += primary[rhs];
+                cost_2 += secondary[rhs];
+            }
+            std::uint32_t owner = find(owner_[i]);
+            if (cost_1 < primary[owner] || (cost_1 == primary[owner] && cost_2 < secondary[owner])) {
+                primary[owner] = cost_1;
+                secondary[owner] = cost_2;
+                best[owner] = i;
+                improved = true;
+            }
+        }
+    }
+    return build(cls, best);
+}
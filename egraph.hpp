@@ -0,0 +1,196 @@
+#ifndef ACRAM_EGRAPH_HPP
+#define ACRAM_EGRAPH_HPP
+
+#include "common.hpp"
+#include <cstdint>
+#include <unordered_map>
+/**
+ * @file egraph.hpp
+ * @brief simplification by equality saturation
+ */
+
+/// Limits of @p expr_egraph::saturate
+struct saturation_limits
+{
+    /// Maximal number of nodes in the graph
+    std::size_t max_nodes;
+    /// Maximal number of passes over the graph
+    unsigned max_passes;
+    /// Time in milliseconds given to saturation, zero means no limit
+    unsigned time_ms;
+
+public:
+    /// 10000 nodes, 30 passes and 1 second
+    saturation_limits();
+};
+
+/// What is minimized when a term is extracted from @p expr_egraph
+enum extraction_goals {
+    EXTRACT_SIZE = 0, // number of tree nodes, ties broken by OpCost
+    EXTRACT_COST      // sum of OpCost of operations, ties broken by size
+};
+
+/// Reasons why @p expr_egraph::saturate stopped
+enum saturation_results {
+    SATURATED = 0,   // no rule adds anything new
+    STOPPED_NODES,   // node limit reached
+    STOPPED_PASSES,  // pass limit reached
+    STOPPED_TIME     // time limit reached
+};
+
+/// Identity of a node for merging of identical nodes
+struct egraph_key
+{
+    char type;
+    std::uint32_t left;
+    std::uint32_t right;
+    std::uint64_t bits;
+
+    bool operator ==(const egraph_key& that) const;
+};
+
+struct egraph_key_hash
+{
+    std::size_t operator ()(const egraph_key& key) const;
+};
+
+/**
+ * @brief Set of equivalent expressions represented by classes of equal subexpressions
+ * @details Every node is an operation on classes rather than on nodes, so a class
+ * stands for all expressions that are known to be equal. Rewrite rules only add
+ * nodes and merge classes, never remove anything, so the result does not depend
+ * on the order of rules and the greedy choices of @p expr_tree::simplify
+ * do not get in the way. After saturation the smallest or the cheapest
+ * expression of a class is extracted.
+ *
+ * Integer arithmetic is calculated when it is exact. As in @p expr_tree::simplify,
+ * points where an expression is undefined are not preserved: x/x becomes 1.
+ */
+class expr_egraph
+{
+public:
+    /// Index that stands for a missing operand
+    static const std::uint32_t NO_CLASS = 0xffffffffU;
+
+private:
+    // Nodes: type, value and classes of operands
+    tld::vector<char, 0> types_;
+    tld::vector<expr_value, 0> values_;
+    tld::vector<std::uint32_t, 0> left_;
+    tld::vector<std::uint32_t, 0> right_;
+    // Class of every node, may be merged since
+    tld::vector<std::uint32_t, 0> owner_;
+    // Union-find forest of classes
+    tld::vector<std::uint32_t, 0> parent_;
+    // Distinct nodes of every class, valid for roots of the forest after rebuild
+    tld::vector<tld::vector<std::uint32_t>, 0> members_;
+    // Integer value of a class or NO_CONSTANT, valid for roots after rebuild
+    tld::vector<long, 0> constants_;
+    std::unordered_map<egraph_key, std::uint32_t, egraph_key_hash> memo_;
+    // Nodes that are not duplicates of earlier ones after rebuild
+    tld::vector<unsigned char, 0> unique_;
+    // Pairs of classes found equal during a pass, merged after it
+    tld::vector<std::uint32_t, 0> pending_;
+    // Node limit of the current saturation
+    std::size_t max_nodes_ = 0;
+
+public:
+    /// Construct empty graph
+    expr_egraph() = default;
+
+    expr_egraph(const expr_egraph& that) = delete;
+    expr_egraph& operator =(const expr_egraph& that) = delete;
+
+    /**
+     * @brief Add a tree to the graph
+     * @param root root of the tree, it is not modified
+     * @return Class of the root
+     */
+    std::uint32_t add(const expr_node* root);
+
+    /**
+     * @brief Apply rewrite rules until nothing changes or a limit is reached
+     * @return One of @p saturation_results
+     */
+    int saturate(const saturation_limits& limits);
+
+    /**
+     * @brief Build the best tree of a class
+     * @param cls class returned by @p add
+     * @param goal one of @p extraction_goals
+     * @details Negative integers are written as unary minus. The caller owns the tree.
+     */
+    expr_node* extract(std::uint32_t cls, int goal) const;
+
+    /// Get number of nodes
+    std::size_t size() const;
+
+    /// Get number of classes
+    std::size_t classes() const;
+
+private:
+    // Value of constants_ for classes that are not integers
+    static const long NO_CONSTANT;
+
+    // Get root of the class, NO_CLASS stays as is
+    std::uint32_t find(std::uint32_t cls) const;
+
+    // Add a node unless an identical one exists and return its class
+    std::uint32_t add(char type, const expr_value& value, std::uint32_t lhs, std::uint32_t rhs);
+
+    // Add an operation node and return its class
+    std::uint32_t make(int op, std::uint32_t lhs, std::uint32_t rhs);
+
+    // Add an integer node and return its class
+    std::uint32_t number(long value);
+
+    // Get value of an integer class or NO_CONSTANT
+    long constant(std::uint32_t cls) const;
+
+    // Tell whether a node is the given operation, SUB stands for binary minus only
+    bool isOp(std::uint32_t node, int op) const;
+
+    // Tell whether a node is unary minus
+    bool isNegation(std::uint32_t node) const;
+
+    // Get roots of operand classes of a node
+    std::uint32_t leftOf(std::uint32_t node) const;
+    std::uint32_t rightOf(std::uint32_t node) const;
+
+    // Record that two classes are equal, they are merged after the pass
+    void equal(std::uint32_t lhs, std::uint32_t rhs);
+
+    // Merge two classes, return false if they are already one
+    bool merge(std::uint32_t lhs, std::uint32_t rhs);
+
+    // Restore uniqueness of nodes after merges, merging classes of nodes
+    // that became identical, and collect members of classes
+    void rebuild();
+
+    // Apply every rule to a node
+    void rewrite(std::uint32_t node);
+
+    // The following methods define rules for nodes of each operation //
+
+    void addRules(std::uint32_t cls, std::uint32_t lhs, std::uint32_t rhs);
+    void subRules(std::uint32_t cls, std::uint32_t lhs, std::uint32_t rhs);
+    void negRules(std::uint32_t cls, std::uint32_t arg);
+    void mulRules(std::uint32_t cls, std::uint32_t lhs, std::uint32_t rhs);
+    void divRules(std::uint32_t cls, std::uint32_t lhs, std::uint32_t rhs);
+    void pwrRules(std::uint32_t cls, std::uint32_t lhs, std::uint32_t rhs);
+    void funcRules(std::uint32_t cls, int op, std::uint32_t arg);
+
+    // Tell whether the node limit is reached, rules that pair nodes of two classes stop then
+    bool full() const;
+
+    // Tell whether a class has a node func(arg)
+    bool hasFunc(std::uint32_t cls, int func, std::uint32_t arg) const;
+
+    // Tell whether a class has a node s^2 where s has a node func(arg), e.g. sin(arg)^2
+    bool hasSquareOf(std::uint32_t cls, int func, std::uint32_t arg) const;
+
+    // Build the tree of a class from the best nodes of classes
+    expr_node* build(std::uint32_t cls, const tld::vector<std::uint32_t, 0>& best) const;
+};
+
+#endif // ACRAM_EGRAPH_HPP
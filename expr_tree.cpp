@@ -1,17 +1,76 @@
 #include "expr_tree.hpp"
+#include "stats.hpp"
+#include "taylor.hpp"
+#include <algorithm>
+#include <climits>
+#include <cmath>
 
 expr_tree::~expr_tree()
 {
     delete root_;
 }
 
-expr_tree::expr_tree(expr_node* _root, const tld::vector<std::string>& _parameters, const std::string& _variable, const std::string& _name) :
+expr_tree::expr_tree(
+    expr_node* _root,
+    const tld::vector<std::uint32_t>& _parameters,
+    std::uint32_t _variable,
+    const std::string& _name,
+    const tld::vector<std::uint32_t>& _variables
+    ) :
     root_(_root),
     parameters_(_parameters),
     variable_(_variable),
     name_(_name),
-    errno_(T_OK)
-{}
+    variables_(_variables),
+    errno_(T_OK),
+    abbreviated_(),
+    abbreviations_(),
+    defining_(nullptr),
+    by_(_variable),
+    varying_()
+{
+    if (variables_.empty())
+        variables_.push_back(variable_);
+}
+
+expr_tree::expr_tree(expr_tree&& that) noexcept :
+    root_(that.root_),
+    parameters_(std::move(that.parameters_)),
+    variable_(that.variable_),
+    name_(std::move(that.name_)),
+    variables_(std::move(that.variables_)),
+    errno_(that.errno_),
+    abbreviated_(std::move(that.abbreviated_)),
+    abbreviations_(std::move(that.abbreviations_)),
+    defining_(that.defining_),
+    by_(that.by_),
+    varying_()
+{
+    that.root_ = nullptr;
+    that.abbreviated_.clear();
+    that.defining_ = nullptr;
+}
+
+expr_tree& expr_tree::operator =(expr_tree&& that) noexcept
+{
+    if (this == &that)
+        return *this;
+    delete root_;
+    root_ = that.root_;
+    parameters_ = std::move(that.parameters_);
+    variable_ = that.variable_;
+    name_ = std::move(that.name_);
+    variables_ = std::move(that.variables_);
+    errno_ = that.errno_;
+    abbreviated_ = std::move(that.abbreviated_);
+    abbreviations_ = std::move(that.abbreviations_);
+    defining_ = that.defining_;
+    by_ = that.by_;
+    that.root_ = nullptr;
+    that.abbreviated_.clear();
+    that.defining_ = nullptr;
+    return *this;
+}
 
 std::string expr_tree::texify(const expr_node& node)
 {
@@ -23,35 +82,83 @@ std::string expr_tree::texify(const expr_node& node)
     case OP:
         return OpToTex(node.value.integer);
     case VAR:
-        return ParToTex(this->variable_);
     case PAR:
-        return ParToTex(this->parameters_.at(node.value.integer));
+        return ParToTex(SymbolName((std::uint32_t)node.value.integer));
     default:
         return "nil";
     }
 }
 
+tex_options::tex_options() :
+    fixed_parentheses(false),
+    line_width(0.0),
+    abbreviation_size(0)
+{}
+
 std::string expr_tree::toTex(const expr_node* node)
 {
+    double width = 0.0;
+    bool tall = false;
+    return toTex(node, tex_options(), width, tall);
+}
+
+std::string expr_tree::toTex(const expr_node* node, const tex_options& opts, double& width, bool& tall)
+{
+    if (node != defining_ && !abbreviated_.empty()) {
+        auto found = abbreviated_.find(node);
+        if (found != abbreviated_.end()) {
+            width = 1.0;
+            tall = false;
+            return abbreviations_[found->second].name;
+        }
+    }
     std::string output;
-    bool need_parentheses = NeedParentheses(*node);
-    if (need_parentheses)
-        output += "\\left(";
+    double left_width = 0.0, right_width = 0.0;
+    bool left_tall = false, right_tall = false;
     if (node->type == OP && node->value.integer == DIV) {
-        output += "{" + texify(*node) + "{" + toTex(node->left) + "}{" + toTex(node->right) + "}}";
+        output += "{" + texify(*node) + "{" + toTex(node->left, opts, left_width, left_tall) +
+            "}{" + toTex(node->right, opts, right_width, right_tall) + "}}";
+        width = std::max(left_width, right_width) * 0.8 + 0.4;
+        tall = true;
     } else  if (node->type == OP && node->value.integer == SQRT) {
-        output += texify(*node) + "{" + toTex(node->right) + "}";
+        output += texify(*node) + "{" + toTex(node->right, opts, right_width, right_tall) + "}";
+        width = right_width + OpWidth(SQRT);
+        tall = right_tall;
     } else if (node->type == OP && node->value.integer == PWR) {
-        output += toTex(node->left) + texify(*node) + "{" + toTex(node->right) + "}";
+        output += toTex(node->left, opts, left_width, left_tall) + texify(*node) +
+            "{" + toTex(node->right, opts, right_width, right_tall) + "}";
+        width = left_width + right_width * 0.7;
+        tall = left_tall || right_tall;
     } else {
         if (node->left != nullptr)
-            output += toTex(node->left);
-        output += texify(*node);
+            output += toTex(node->left, opts, left_width, left_tall);
+        std::string value = texify(*node);
+        output += value;
         if (node->right != nullptr)
-            output += toTex(node->right);
+            output += toTex(node->right, opts, right_width, right_tall);
+        switch (node->type) {
+        case OP:
+            width = OpWidth(node->value.integer);
+            break;
+        case VAR:
+        case PAR:
+            // Every character but the first one and "_{}" is a subscript
+            width = 0.5 + std::max(0.0, ((double)value.size() - 4.0) * 0.35);
+            break;
+        default:
+            width = value.size() * 0.5;
+            break;
+        }
+        width += left_width + right_width;
+        tall = left_tall || right_tall;
+    }
+    if (node != defining_ && NeedParentheses(*node)) {
+        if (opts.fixed_parentheses && !tall)
+            output = "(" + output + ")";
+        else
+            output = "\\left(" + output + "\\right)";
+        width += 0.8;
     }
-    if (need_parentheses)
-        output += "\\right)";
     return output;
 }
 
@@ -60,6 +167,213 @@ std::string expr_tree::toTex()
     return toTex(root_);
 }
 
+void expr_tree::sumTerms(const expr_node* node, const char* sign, tld::vector<const expr_node*>& terms, tld::vector<const char*>& signs)
+{
+    bool is_sum = node->type == OP && (node->value.integer == ADD || node->value.integer == SUB);
+    bool is_term = !is_sum || node->left == nullptr;
+    if (node != defining_)
+        is_term = is_term || NeedParentheses(*node) || abbreviated_.count(node);
+    if (is_term) {
+        terms.push_back(node);
+        signs.push_back(sign);
+        return;
+    }
+    sumTerms(node->left, sign, terms, signs);
+    sumTerms(node->right, node->value.integer == ADD ? "+" : "-", terms, signs);
+}
+
+tld::vector<std::string> expr_tree::toTexLines(const tex_options& opts, double indent)
+{
+    abbreviated_.clear();
+    abbreviations_.clear();
+    if (opts.abbreviation_size > 0)
+        findAbbreviations(opts.abbreviation_size);
+    tld::vector<std::string> lines = texLines(root_, opts, indent);
+    // Roots of abbreviations are not kept: they would not survive simplification
+    tld::vector<const expr_node*> roots(abbreviations_.size());
+    roots.resize(abbreviations_.size());
+    for (const auto& abbreviation : abbreviated_)
+        roots[abbreviation.second] = abbreviation.first;
+    for (std::size_t i = 0; i < abbreviations_.size(); i++) {
+        defining_ = roots[i];
+        abbreviations_[i].lines = texLines(roots[i], opts, indent);
+    }
+    defining_ = nullptr;
+    abbreviated_.clear();
+    return lines;
+}
+
+const tld::vector<tex_abbreviation>& expr_tree::abbreviations() const
+{
+    return abbreviations_;
+}
+
+tld::vector<std::string> expr_tree::texLines(const expr_node* node, const tex_options& opts, double indent)
+{
+    tld::vector<const expr_node*> terms;
+    tld::vector<const char*> signs;
+    sumTerms(node, "", terms, signs);
+
+    tld::vector<std::string> lines;
+    std::string line;
+    double line_width = indent;
+    for (std::size_t i = 0; i < terms.size(); i++) {
+        double width = 0.0;
+        bool tall = false;
+        std::string term = signs[i] + toTex(terms[i], opts, width, tall);
+        if (signs[i][0] != '\0')
+            width += OpWidth(ADD);
+        if (opts.line_width > 0.0 && !line.empty() && line_width + width > opts.line_width) {
+            lines.push_back(line);
+            line.clear();
+            line_width = indent;
+        }
+        line += term;
+        line_width += width;
+    }
+    lines.push_back(line);
+    return lines;
+}
+
+void expr_tree::findAbbreviations(std::size_t min_size)
+{
+    struct subtree_info {
+        std::size_t hash;
+        std::size_t size;
+        // Representative of the class of identical subtrees
+        const expr_node* rep;
+    };
+    std::unordered_map<const expr_node*, subtree_info> info;
+    std::unordered_multimap<std::size_t, const expr_node*> reps;
+    std::unordered_map<const expr_node*, std::size_t> count;
+
+    // Classify subtrees in post-order, so that children are classified first
+    tld::vector<const expr_node*> stack;
+    tld::vector<const expr_node*> order;
+    stack.push_back(root_);
+    while (!stack.empty()) {
+        const expr_node* node = stack[stack.size() - 1];
+        stack.pop_back();
+        order.push_back(node);
+        if (node->left)
+            stack.push_back(node->left);
+        if (node->right)
+            stack.push_back(node->right);
+    }
+    for (std::size_t i = order.size(); i-- > 0;) {
+        const expr_node* node = order[i];
+        subtree_info left = {0, 0, nullptr}, right = {0, 0, nullptr};
+        if (node->left)
+            left = info[node->left];
+        if (node->right)
+            right = info[node->right];
+        subtree_info current = {NodeHash(node, left.hash, right.hash), left.size + right.size + 1, node};
+        auto range = reps.equal_range(current.hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (IsEqual(it->second, node)) {
+                current.rep = it->second;
+                break;
+            }
+        }
+        if (current.rep == node)
+            reps.emplace(current.hash, node);
+        info[node] = current;
+        count[current.rep]++;
+    }
+
+    // Count references the output would really have: an abbreviation is defined
+    // once, so subtrees inside its other occurrences are not seen
+    std::unordered_map<const expr_node*, std::size_t> uses;
+    tld::vector<const expr_node*> first_seen;
+    stack.push_back(root_);
+    while (!stack.empty()) {
+        const expr_node* node = stack[stack.size() - 1];
+        stack.pop_back();
+        const subtree_info& node_info = info[node];
+        if (node_info.size >= min_size && count[node_info.rep] > 1) {
+            if (uses[node_info.rep]++ > 0)
+                continue;
+            first_seen.push_back(node_info.rep);
+        }
+        if (node->right)
+            stack.push_back(node->right);
+        if (node->left)
+            stack.push_back(node->left);
+    }
+
+    std::unordered_map<const expr_node*, std::size_t> index;
+    for (std::size_t i = 0; i < first_seen.size(); i++) {
+        if (uses[first_seen[i]] < 2)
+            continue;
+        index[first_seen[i]] = abbreviations_.size();
+        tex_abbreviation abbreviation;
+        abbreviation.name = "\\xi_{" + std::to_string(abbreviations_.size() + 1) + "}";
+        abbreviations_.push_back(abbreviation);
+    }
+    for (const auto& node_info : info) {
+        auto found = index.find(node_info.second.rep);
+        if (found != index.end())
+            abbreviated_[node_info.first] = found->second;
+    }
+}
+
+const expr_node* expr_tree::root() const
+{
+    return root_;
+}
+
+std::size_t expr_tree::size() const
+{
+    return TreeSize(root_);
+}
+
+std::uint32_t expr_tree::variable() const
+{
+    return variable_;
+}
+
+const tld::vector<std::uint32_t>& expr_tree::parameters() const
+{
+    return parameters_;
+}
+
+const tld::vector<std::uint32_t>& expr_tree::variables() const
+{
+    return variables_;
+}
+
+const double* expr_tree::symbolValues(const double* params) const
+{
+    // The buffer is kept between calls and only grows, entries of other symbols are never read
+    static thread_local tld::vector<double, 0> values;
+    std::uint32_t max_id = 0;
+    for (std::size_t i = 0; i < parameters_.size(); i++)
+        max_id = std::max(max_id, parameters_[i]);
+    if (!parameters_.empty() && values.size() <= max_id)
+        values.resize(max_id + 1);
+    for (std::size_t i = 0; i < parameters_.size(); i++)
+        values[parameters_[i]] = params[i];
+    return values.data();
+}
+
+double expr_tree::evaluate(double x, const double* params) const
+{
+    // Values are looked up by symbol ids
+    return Evaluate(root_, x, symbolValues(params));
+}
+
+void expr_tree::taylor(double x, const double* params, std::size_t order, double* coefficients) const
+{
+    const double* values = symbolValues(params);
+    taylor_series series;
+    series.expand(root_, x, values, order, coefficients);
+}
+
+std::string expr_tree::serialize() const
+{
+    return Serialize(root_);
+}
+
 std::string OpToTex(int op)
 {
     switch (op) {
@@ -100,6 +414,36 @@ std::string OpToTex(int op)
     }
 }
 
+double OpWidth(int op)
+{
+    switch (op) {
+    case ADD:
+    case SUB:
+        return 1.3;
+    case MUL:
+        return 0.6;
+    case DIV:
+    case PWR:
+        return 0.0;
+    case SQRT:
+        return 1.0;
+    case EXP:
+    case LOG:
+    case SIN:
+    case COS:
+    case TAN:
+    case COT:
+        return 1.7;
+    case ASIN:
+    case ACOS:
+    case ATAN:
+    case ACOT:
+        return 3.0;
+    default:
+        return 1.0;
+    }
+}
+
 std::string ParToTex(const std::string& par)
 {
     std::string output(1, par[0]);
@@ -109,262 +453,379 @@ std::string ParToTex(const std::string& par)
     return output;
 }
 
+std::string PartialName(const std::string& name, std::uint32_t variable)
+{
+    return "\\partial_{" + ParToTex(SymbolName(variable)) + "}" + name;
+}
+
+// Turn integer arithmetic into a number as calcSimplifs does, reusing the right operand.
+// Returns nullptr if the operands are not integers or division is not exact
+static expr_node* Calculated(int op, expr_node* lhs, expr_node* rhs)
+{
+    if (lhs == nullptr || lhs->type != INT || rhs->type != INT)
+        return nullptr;
+    long result = 0;
+    switch (op) {
+    case ADD:
+        result = lhs->value.integer + rhs->value.integer;
+        break;
+    case SUB:
+        result = lhs->value.integer - rhs->value.integer;
+        break;
+    case MUL:
+        result = lhs->value.integer * rhs->value.integer;
+        break;
+    case DIV:
+        if (rhs->value.integer == 0 || lhs->value.integer % rhs->value.integer)
+            return nullptr;
+        result = lhs->value.integer / rhs->value.integer;
+        break;
+    default:
+        return nullptr;
+    }
+    delete lhs;
+    rhs->value.integer = result;
+    return rhs;
+}
+
+// Make operation node without any rules
+static expr_node* MakeOp(int op, expr_node* lhs, expr_node* rhs)
+{
+    auto node = new expr_node(OP, (long)op, nullptr, lhs, rhs);
+    Link(node, lhs, rhs);
+    return node;
+}
+
+expr_node* MakeAdd(expr_node* lhs, expr_node* rhs)
+{
+    if (expr_node* number = Calculated(ADD, lhs, rhs))
+        return number;
+    if (IsZero(lhs)) {
+        delete lhs;
+        return rhs;
+    }
+    if (IsZero(rhs)) {
+        delete rhs;
+        return lhs;
+    }
+    return MakeOp(ADD, lhs, rhs);
+}
+
+expr_node* MakeSub(expr_node* lhs, expr_node* rhs)
+{
+    if (expr_node* number = Calculated(SUB, lhs, rhs))
+        return number;
+    if (IsZero(lhs)) {
+        delete lhs;
+        return MakeNeg(rhs);
+    }
+    if (IsZero(rhs)) {
+        delete rhs;
+        return lhs;
+    }
+    return MakeOp(SUB, lhs, rhs);
+}
+
+expr_node* MakeNeg(expr_node* arg)
+{
+    if (IsZero(arg))
+        return arg;
+    // Integers are negated in place, calcSimplifs produces negative ones as well
+    if (arg->type == INT && arg->value.integer != LONG_MIN) {
+        arg->value.integer = -arg->value.integer;
+        return arg;
+    }
+    // -(-a) = a
+    if (arg->type == OP && arg->value.integer == SUB && arg->left == nullptr) {
+        expr_node* inner = arg->right;
+        arg->right = nullptr;
+        inner->parent = nullptr;
+        delete arg;
+        return inner;
+    }
+    return MakeOp(SUB, nullptr, arg);
+}
+
+// Tell whether node is a fraction with numerator 1
+static bool IsReciprocal(const expr_node* node)
+{
+    return node->type == OP && node->value.integer == DIV && IsOne(node->left);
+}
+
+// Make a/b of a and a node 1/b
+static expr_node* DivideByReciprocal(expr_node* lhs, expr_node* reciprocal)
+{
+    expr_node* denominator = reciprocal->right;
+    reciprocal->right = nullptr;
+    denominator->parent = nullptr;
+    delete reciprocal;
+    return MakeDiv(lhs, denominator);
+}
+
+expr_node* MakeMul(expr_node* lhs, expr_node* rhs)
+{
+    if (expr_node* number = Calculated(MUL, lhs, rhs))
+        return number;
+    if (IsZero(lhs) || IsOne(rhs)) {
+        delete rhs;
+        return lhs;
+    }
+    if (IsZero(rhs) || IsOne(lhs)) {
+        delete lhs;
+        return rhs;
+    }
+    // (1/b)*a = a/b and a*(1/b) = a/b, as divSimplifs does
+    if (IsReciprocal(lhs))
+        return DivideByReciprocal(rhs, lhs);
+    if (IsReciprocal(rhs))
+        return DivideByReciprocal(lhs, rhs);
+    return MakeOp(MUL, lhs, rhs);
+}
+
+expr_node* MakeDiv(expr_node* lhs, expr_node* rhs)
+{
+    if (expr_node* number = Calculated(DIV, lhs, rhs))
+        return number;
+    if (IsZero(lhs) || IsOne(rhs)) {
+        delete rhs;
+        return lhs;
+    }
+    return MakeOp(DIV, lhs, rhs);
+}
+
+expr_node* MakePwr(expr_node* base, expr_node* exponent)
+{
+    if (IsZero(exponent)) {
+        delete base;
+        exponent->value.integer = 1;
+        return exponent;
+    }
+    if (IsOne(exponent)) {
+        delete exponent;
+        return base;
+    }
+    return MakeOp(PWR, base, exponent);
+}
+
+expr_node* MakeFunc(int op, expr_node* arg)
+{
+    return MakeOp(op, nullptr, arg);
+}
+
+expr_node* MakeInt(long number)
+{
+    return new expr_node(INT, number);
+}
+
+bool expr_tree::findVarying(const expr_node* node)
+{
+    bool varies = false;
+    if (node == nullptr)
+        return false;
+    if (node->type == VAR || node->type == PAR) {
+        varies = (std::uint32_t)node->value.integer == by_;
+    } else if (node->type == OP) {
+        // Both subtrees are visited
+        bool left_varies = findVarying(node->left);
+        varies = findVarying(node->right) || left_varies;
+    }
+    if (varies)
+        varying_.insert(node);
+    return varies;
+}
+
+// Tell whether a subtree contains a symbol
+static bool HasSymbol(const expr_node* node, std::uint32_t id)
+{
+    if (node == nullptr)
+        return false;
+    if (node->type == VAR || node->type == PAR)
+        return (std::uint32_t)node->value.integer == id;
+    return HasSymbol(node->left, id) || HasSymbol(node->right, id);
+}
+
+bool expr_tree::varies(const expr_node* node) const
+{
+    if (variables_.size() > 1)
+        return varying_.find(node) != varying_.end();
+    return HasSymbol(node, by_);
+}
+
 expr_node* expr_tree::derivative(const expr_node* node)
 {
-    expr_node* deriv = nullptr;
-    if (node->type == OP) {
-        switch (node->value.integer) {
-        case ADD:
-            deriv = new expr_node(OP, (long)ADD);
-            deriv->left = derivative(node->left);
-            deriv->right = derivative(node->right);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        case SUB:
-            deriv = new expr_node(OP, (long)SUB);
-            if (node->left != nullptr) // bc minus can be unary
-                deriv->left = derivative(node->left);
-            else
-                deriv->left = nullptr;
-            deriv->right = derivative(node->right);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        case MUL:
-            deriv = mulDeriv(node);
-            break;
-        case DIV:
-            deriv = divDeriv(node);
-            break;
-        case SQRT:
-            deriv = new expr_node(OP, (long)MUL);
-            deriv->left = derivative(node->right);
-            deriv->right = sqrtDeriv(node);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        case EXP:
-            deriv = expDeriv(node);
-            break;
-        case LOG:
-            deriv = logDeriv(node);
-            break;
-        case PWR:
-            deriv = new expr_node(OP, (long)MUL);
-            deriv->left = derivative(node->left);
-            deriv->right = pwrDeriv(node);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        case SIN:
-            deriv = new expr_node(OP, (long)MUL);
-            deriv->left = derivative(node->right);
-            deriv->right = sinDeriv(node);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        case COS:
-            deriv = new expr_node(OP, (long)MUL);
-            deriv->left = derivative(node->right);
-            deriv->right = cosDeriv(node);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        case TAN:
-            deriv = new expr_node(OP, (long)MUL);
-            deriv->left = derivative(node->right);
-            deriv->right = tanDeriv(node);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        case COT:
-            deriv = new expr_node(OP, (long)MUL);
-            deriv->left = derivative(node->right);
-            deriv->right = cotDeriv(node);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        case ASIN:
-            deriv = new expr_node(OP, (long)MUL);
-            deriv->left = derivative(node->right);
-            deriv->right = arcsinDeriv(node);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        case ACOS:
-            deriv = new expr_node(OP, (long)MUL);
-            deriv->left = derivative(node->right);
-            deriv->right = arccosDeriv(node);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        case ATAN:
-            deriv = new expr_node(OP, (long)MUL);
-            deriv->left = derivative(node->right);
-            deriv->right = arctanDeriv(node);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        case ACOT:
-            deriv = new expr_node(OP, (long)MUL);
-            deriv->left = derivative(node->right);
-            deriv->right = arccotDeriv(node);
-            Link(deriv, deriv->left, deriv->right);
-            break;
-        default:
-            break;
-        }
-    } else if (node->type == VAR) {
-        deriv = new expr_node(INT, (long)1, nullptr, nullptr, nullptr);
-    } else {
-        deriv = new expr_node(INT, (long)0, nullptr, nullptr, nullptr);
+    if (node->type != OP)
+        return MakeInt((node->type == VAR || node->type == PAR) && (std::uint32_t)node->value.integer == by_);
+    if (variables_.size() > 1 && varying_.find(node) == varying_.end())
+        return MakeInt(0);
+    switch (node->value.integer) {
+    case ADD:
+        return MakeAdd(derivative(node->left), derivative(node->right));
+    case SUB:
+        if (node->left == nullptr) // bc minus can be unary
+            return MakeNeg(derivative(node->right));
+        return MakeSub(derivative(node->left), derivative(node->right));
+    case MUL:
+        return mulDeriv(node);
+    case DIV:
+        return divDeriv(node);
+    case SQRT:
+        return chain(node, node->right, &expr_tree::sqrtDeriv);
+    case EXP:
+        return expDeriv(node);
+    case LOG:
+        return logDeriv(node);
+    case PWR:
+        if (varies(node->right))
+            return varPwrDeriv(node);
+        return chain(node, node->left, &expr_tree::pwrDeriv);
+    case SIN:
+        return chain(node, node->right, &expr_tree::sinDeriv);
+    case COS:
+        return chain(node, node->right, &expr_tree::cosDeriv);
+    case TAN:
+        return chain(node, node->right, &expr_tree::tanDeriv);
+    case COT:
+        return chain(node, node->right, &expr_tree::cotDeriv);
+    case ASIN:
+        return chain(node, node->right, &expr_tree::arcsinDeriv);
+    case ACOS:
+        return chain(node, node->right, &expr_tree::arccosDeriv);
+    case ATAN:
+        return chain(node, node->right, &expr_tree::arctanDeriv);
+    case ACOT:
+        return chain(node, node->right, &expr_tree::arccotDeriv);
+    default:
+        return nullptr;
     }
-    return deriv;
+}
+
+expr_node* expr_tree::chain(const expr_node* node, const expr_node* inner, expr_node* (expr_tree::*rule)(const expr_node*))
+{
+    expr_node* inner_deriv = derivative(inner);
+    if (IsZero(inner_deriv))
+        return inner_deriv;
+    return MakeMul(inner_deriv, (this->*rule)(node));
 }
 
 expr_tree expr_tree::derivative()
 {
-    return expr_tree(derivative(this->root_), this->parameters_, this->variable_, this->name_ + "'");
+    return derivative(this->variable_, this->name_ + "'");
 }
 
+expr_tree expr_tree::derivative(std::uint32_t variable)
+{
+    return derivative(variable, PartialName(this->name_, variable));
+}
+
+expr_tree expr_tree::derivative(std::uint32_t variable, const std::string& name)
+{
+    by_ = variable;
+    if (variables_.size() > 1)
+        findVarying(this->root_);
+    expr_node* root = derivative(this->root_);
+    varying_.clear();
+    return expr_tree(root, this->parameters_, this->variable_, name, this->variables_);
+}
+
+// Derivatives of products and quotients skip the terms with a zero derivative
+// before copying the other operand
+
 expr_node* expr_tree::mulDeriv(const expr_node* node)
 {
-    auto deriv = new expr_node(OP, (long)ADD);
-    deriv->left = new expr_node(OP, (long)MUL, nullptr, derivative(node->left), Copy(node->right));
-    Link(deriv->left, deriv->left->left, deriv->left->right);
-    deriv->right = new expr_node(OP, (long)MUL, nullptr, Copy(node->left), derivative(node->right));
-    Link(deriv->right, deriv->right->left, deriv->right->right);
-    Link(deriv, deriv->left, deriv->right);
-    return deriv;
+    expr_node* left_deriv = derivative(node->left);
+    expr_node* first = IsZero(left_deriv) ? left_deriv : MakeMul(left_deriv, Copy(node->right));
+    expr_node* right_deriv = derivative(node->right);
+    expr_node* second = IsZero(right_deriv) ? right_deriv : MakeMul(Copy(node->left), right_deriv);
+    return MakeAdd(first, second);
 }
 
 expr_node* expr_tree::divDeriv(const expr_node* node)
 {
-    auto deriv = new expr_node(OP, (long)DIV);
-    deriv->left = mulDeriv(node);
-    deriv->left->value.integer = SUB;
-    deriv->right = new expr_node(OP, (long)PWR);
-    deriv->right->left = Copy(node->right);
-    deriv->right->right = new expr_node(INT, (long)2);
-    Link(deriv->right, deriv->right->left, deriv->right->right);
-    Link(deriv, deriv->left, deriv->right);
-    return deriv;
+    expr_node* left_deriv = derivative(node->left);
+    expr_node* first = IsZero(left_deriv) ? left_deriv : MakeMul(left_deriv, Copy(node->right));
+    expr_node* right_deriv = derivative(node->right);
+    expr_node* second = IsZero(right_deriv) ? right_deriv : MakeMul(Copy(node->left), right_deriv);
+    expr_node* numerator = MakeSub(first, second);
+    if (IsZero(numerator))
+        return numerator;
+    return MakeDiv(numerator, MakePwr(Copy(node->right), MakeInt(2)));
 }
 
 expr_node* expr_tree::sqrtDeriv(const expr_node* node)
 {
-    auto deriv = new expr_node(OP, (long)DIV);
-    deriv->left = new expr_node(INT, (long)1, deriv, nullptr, nullptr);
-    deriv->right = new expr_node(OP, (long)MUL, deriv, nullptr, nullptr);
-    expr_node* denum = deriv->right;
-    denum->left = new expr_node(INT, (long)2);
-    denum->right = Copy(node);
-    Link(denum, denum->left, denum->right);
-    Link(deriv, deriv->left, deriv->right);
-    return deriv;
+    return MakeDiv(MakeInt(1), MakeMul(MakeInt(2), Copy(node)));
 }
 
 expr_node* expr_tree::expDeriv(const expr_node* node)
 {
-    auto deriv = new expr_node(OP, (long)MUL);
-    deriv->left = Copy(node);
-    deriv->right = derivative(node->right);
-    Link(deriv, deriv->left, deriv->right);
-    return deriv;
+    expr_node* inner_deriv = derivative(node->right);
+    if (IsZero(inner_deriv))
+        return inner_deriv;
+    return MakeMul(Copy(node), inner_deriv);
 }
 
 expr_node* expr_tree::logDeriv(const expr_node* node)
 {
-    auto deriv = new expr_node(OP, (long)DIV, nullptr, derivative(node->right), Copy(node->right));
-    Link(deriv, deriv->left, deriv->right);
-    return deriv;
+    expr_node* inner_deriv = derivative(node->right);
+    if (IsZero(inner_deriv))
+        return inner_deriv;
+    return MakeDiv(inner_deriv, Copy(node->right));
 }
 
 expr_node* expr_tree::pwrDeriv(const expr_node* node)
 {
-    auto deriv = new expr_node(OP, (long)MUL);
-    deriv->left = Copy(node->right);
-    deriv->right = new expr_node(OP, (long)PWR);
-    auto new_pwr = new expr_node(OP, (long)SUB);
-    new_pwr->left = Copy(node->right);
-    new_pwr->right = new expr_node(INT, (long)1);
-    Link(new_pwr, new_pwr->left, new_pwr->right);
-    deriv->right->right = new_pwr;
-    deriv->right->left = Copy(node->left);
-    Link(deriv->right, deriv->right->left, deriv->right->right);
-    Link(deriv, deriv->left, deriv->right);
-    return deriv;
+    expr_node* exponent = MakeSub(Copy(node->right), MakeInt(1));
+    return MakeMul(Copy(node->right), MakePwr(Copy(node->left), exponent));
+}
+
+// (u^v)' = u^v * (v' * ln(u) + v * u' / u)
+expr_node* expr_tree::varPwrDeriv(const expr_node* node)
+{
+    expr_node* log_term = MakeMul(derivative(node->right), MakeFunc(LOG, Copy(node->left)));
+    expr_node* base_term = MakeDiv(MakeMul(Copy(node->right), derivative(node->left)), Copy(node->left));
+    return MakeMul(Copy(node), MakeAdd(log_term, base_term));
 }
 
 expr_node* expr_tree::sinDeriv(const expr_node* node)
 {
-    auto deriv = new expr_node(OP, (long)COS);
-    deriv->right = Copy(node->right);
-    Link(deriv, nullptr, deriv->right);
-    return deriv;
+    return MakeFunc(COS, Copy(node->right));
 }
 
 expr_node* expr_tree::cosDeriv(const expr_node* node)
 {
-    auto deriv = new expr_node(OP, (long)SUB);
-    deriv->right = new expr_node(OP, (long)SIN);
-    deriv->right->right = Copy(node->right);
-    Link(deriv->right, nullptr, deriv->right->right);
-    Link(deriv, nullptr, deriv->right);
-    return deriv;
+    return MakeNeg(MakeFunc(SIN, Copy(node->right)));
 }
 
 expr_node* expr_tree::tanDeriv(const expr_node* node)
 {
-    auto deriv = new expr_node(OP, (long)DIV);
-    deriv->left = new expr_node(INT, (long)1);
-    deriv->right = new expr_node(OP, (long)PWR);
-    auto square = deriv->right;
-    square->left = new expr_node(OP, (long)COS);
-    square->left->right = Copy(node->right);
-    Link(square->left, nullptr, square->left->right);
-    square->right = new expr_node(INT, (long)2);
-    Link(square, square->left, square->right);
-    Link(deriv, deriv->left, deriv->right);
-    return deriv;
+    return MakeDiv(MakeInt(1), MakePwr(MakeFunc(COS, Copy(node->right)), MakeInt(2)));
 }
 
 expr_node* expr_tree::cotDeriv(const expr_node* node)
 {
-    auto frac = tanDeriv(node);
-    frac->right->left->value.integer = SIN;
-    auto deriv = new expr_node(OP, (long)SUB);
-    deriv->right = frac;
-    Link(deriv, nullptr, deriv->right);
-    return deriv;
+    return MakeNeg(MakeDiv(MakeInt(1), MakePwr(MakeFunc(SIN, Copy(node->right)), MakeInt(2))));
 }
 
 expr_node* expr_tree::arcsinDeriv(const expr_node* node)
 {
-    auto square = new expr_node(OP, (long)PWR, nullptr, Copy(node->right), new expr_node(INT, (long)2));
-    Link(square, square->left, square->right);
-    auto sub = new expr_node(OP, (long)SUB, nullptr, new expr_node(INT, (long)1), square);
-    Link(sub, sub->left, sub->right);
-    auto root = new expr_node(OP, (long)SQRT, nullptr, nullptr, sub);
-    Link(root, root->left, root->right);
-    auto frac = new expr_node(OP, (long)DIV, nullptr, new expr_node(INT, (long)1), root);
-    Link(frac, frac->left, frac->right);
-    return frac;
+    expr_node* square = MakePwr(Copy(node->right), MakeInt(2));
+    return MakeDiv(MakeInt(1), MakeFunc(SQRT, MakeSub(MakeInt(1), square)));
 }
 
 expr_node* expr_tree::arccosDeriv(const expr_node* node)
 {
-    auto deriv = new expr_node(OP, (long)SUB, nullptr, nullptr, arcsinDeriv(node));
-    Link(deriv, deriv->left, deriv->right);
-    return deriv;
+    return MakeNeg(arcsinDeriv(node));
 }
 
 expr_node* expr_tree::arctanDeriv(const expr_node* node)
 {
-    auto square = new expr_node(OP, (long)PWR, nullptr, Copy(node->right), new expr_node(INT, (long)2));
-    Link(square, square->left, square->right);
-    auto sum = new expr_node(OP, (long)ADD, nullptr, new expr_node(INT, (long)1), square);
-    Link(sum, sum->left, sum->right);
-    auto frac = new expr_node(OP, (long)DIV, nullptr, new expr_node(INT, (long)1), sum);
-    Link(frac, frac->left, frac->right);
-    return frac;
+    expr_node* square = MakePwr(Copy(node->right), MakeInt(2));
+    return MakeDiv(MakeInt(1), MakeAdd(MakeInt(1), square));
 }
 
 expr_node* expr_tree::arccotDeriv(const expr_node* node)
 {
-    auto deriv = new expr_node(OP, (long)SUB, nullptr, nullptr, arctanDeriv(node));
-    Link(deriv, deriv->left, deriv->right);
-    return deriv;
+    return MakeNeg(arctanDeriv(node));
 }
 
 void expr_tree::simplify(expr_node* node)
@@ -376,25 +837,36 @@ void expr_tree::simplify(expr_node* node)
     if (node->right)
         simplify(node->right);
     if (IsCalculable(node)) {
+        STATS_RULE(calc_probe, RULE_CALC);
         calcSimplifs(node);
         return;
     }
     switch (node->value.integer) {
-    case ADD:
+    case ADD: {
+        STATS_RULE(add_probe, RULE_ADD);
         addSimplifs(node);
         break;
-    case SUB:
+    }
+    case SUB: {
+        STATS_RULE(sub_probe, RULE_SUB);
         subSimplifs(node);
         break;
-    case MUL:
+    }
+    case MUL: {
+        STATS_RULE(mul_probe, RULE_MUL);
         mulSimplifs(node);
         break;
-    case DIV:
+    }
+    case DIV: {
+        STATS_RULE(div_probe, RULE_DIV);
         divSimplifs(node);
         break;
-    case PWR:
+    }
+    case PWR: {
+        STATS_RULE(pwr_probe, RULE_PWR);
         pwrSimplifs(node);
         break;
+    }
     default:
         break;
     }
@@ -405,14 +877,108 @@ void expr_tree::simplify()
     simplify(root_);
 }
 
-const std::string& expr_tree::getName()
+// States of subtrees during binding
+enum bind_states {
+    BIND_SYMBOLIC = 0, // depends on the variable or unbound parameters
+    BIND_NUMBER,       // integer arithmetic as written
+    BIND_FOLDED        // a fraction or reduced to a number
+};
+
+// Turn a node without operands into a number, a negative one becomes unary minus
+static void SetNumber(expr_node* node, double number)
+{
+    double magnitude = std::fabs(number);
+    expr_value value;
+    char type;
+    // Whole numbers are exact in double up to 2^53
+    if (magnitude < 9007199254740992.0 && std::floor(magnitude) >= magnitude) {
+        type = INT;
+        value.integer = (long)magnitude;
+    } else {
+        type = FRAC;
+        value.frac = magnitude;
+    }
+    if (number < 0.0) {
+        node->type = OP;
+        node->value.integer = SUB;
+        Link(node, nullptr, new expr_node(type, value));
+    } else {
+        node->type = type;
+        node->value = value;
+    }
+}
+
+void expr_tree::bind(const std::unordered_map<std::uint32_t, double>& values)
+{
+    if (root_ == nullptr || values.empty())
+        return;
+    bind(root_, values);
+    tld::vector<std::uint32_t> unbound;
+    for (std::size_t i = 0; i < parameters_.size(); i++)
+        if (values.find(parameters_[i]) == values.end())
+            unbound.push_back(parameters_[i]);
+    parameters_ = std::move(unbound);
+    // Bound variables are not variables anymore, the main one is never bound
+    tld::vector<std::uint32_t> free_variables;
+    for (std::size_t i = 0; i < variables_.size(); i++)
+        if (i == 0 || values.find(variables_[i]) == values.end())
+            free_variables.push_back(variables_[i]);
+    variables_ = std::move(free_variables);
+}
+
+int expr_tree::bind(expr_node* node, const std::unordered_map<std::uint32_t, double>& values)
+{
+    switch (node->type) {
+    case INT:
+        return BIND_NUMBER;
+    case FRAC:
+        // Fractions are inexact anyway, so nothing is lost by calculating them
+        return BIND_FOLDED;
+    case PAR: {
+        auto it = values.find((std::uint32_t)node->value.integer);
+        if (it == values.end())
+            return BIND_SYMBOLIC;
+        SetNumber(node, it->second);
+        return BIND_FOLDED;
+    }
+    case OP:
+        break;
+    default:
+        return BIND_SYMBOLIC;
+    }
+    int left = node->left == nullptr ? BIND_NUMBER : bind(node->left, values);
+    int right = node->right == nullptr ? BIND_NUMBER : bind(node->right, values);
+    if (left == BIND_SYMBOLIC || right == BIND_SYMBOLIC)
+        return BIND_SYMBOLIC;
+    // Integer arithmetic is exact in the tree, it is left to simplify
+    if (left != BIND_FOLDED && right != BIND_FOLDED)
+        return BIND_NUMBER;
+    double number = Calculate(node->value.integer, Evaluate(node->left, 0.0, nullptr), Evaluate(node->right, 0.0, nullptr));
+    if (!std::isfinite(number))
+        return BIND_NUMBER;
+    delete node->left;
+    delete node->right;
+    node->left = node->right = nullptr;
+    SetNumber(node, number);
+    return BIND_FOLDED;
+}
+
+const std::string& expr_tree::getName() const
 {
     return name_;
 }
 
 std::string expr_tree::getVar()
 {
-    return ParToTex(this->variable_);
+    return ParToTex(SymbolName(this->variable_));
+}
+
+std::string expr_tree::getVars()
+{
+    std::string vars;
+    for (std::size_t i = 0; i < variables_.size(); i++)
+        vars += (i > 0 ? ", " : "") + ParToTex(SymbolName(variables_[i]));
+    return vars;
 }
 
 int expr_tree::checkSemantics(const expr_node* node)
@@ -523,10 +1089,13 @@ void expr_tree::divSimplifs(expr_node* node)
         delete tmp;
     } else if (IsOne(node->left) && node->parent != nullptr && node->parent->type == OP && node->parent->value.integer == MUL) {
         if (IsOnLeft(node)) {
+            // The other operand becomes the numerator before it is visited, so it is simplified here
+            expr_node* numerator = node->parent->right;
             node->parent->value.integer = DIV;
-            Link(node->parent, node->parent->right, node->right);
+            Link(node->parent, numerator, node->right);
             node->right = nullptr;
             delete node;
+            simplify(numerator);
         } else {
             node->parent->value.integer = DIV;
             Link(node->parent, node->parent->left, node->right);
@@ -577,12 +1146,19 @@ void expr_tree::subSimplifs(expr_node* node)
             tmp->left = tmp->right = nullptr;
             delete tmp;
         }
+    } else if (node->left == nullptr && node->right->type == INT && node->right->value.integer < 0) {
+        // Negation of a negative number, as MakeNeg does
+        node->type = INT;
+        node->value.integer = -node->right->value.integer;
+        delete node->right;
+        node->right = nullptr;
     }
 }
 
 void expr_tree::calcSimplifs(expr_node* node)
 {
-    if (node->value.integer == DIV && (node->left->value.integer % node->right->value.integer))
+    // Division by zero is left as is rather than evaluated
+    if (node->value.integer == DIV && (IsZero(node->right) || node->left->value.integer % node->right->value.integer))
         return;
     switch (node->value.integer) {
     case ADD:
@@ -2,6 +2,9 @@
 #define ACRAM_EXPR_TREE_H
 
 #include "common.hpp"
+#include "symbols.hpp"
+#include <unordered_map>
+#include <unordered_set>
 /**
  * @file expr_tree.hpp
  * @brief expression tree class
@@ -15,19 +18,66 @@ enum semantic_errors {
     T_LOG_ZERO
 };
 
+/// Settings of LaTeX output
+struct tex_options
+{
+    /**
+     * Use plain parentheses instead of @p \\left( and @p \\right)
+     * unless the enclosed expression contains fractions
+     */
+    bool fixed_parentheses;
+    /// Estimated line width in em at which top-level sums are broken, zero means no breaking
+    double line_width;
+    /**
+     * Minimal size in nodes of a repeated subexpression that is rendered once
+     * under a name and referenced by the name elsewhere, zero means no abbreviations
+     */
+    std::size_t abbreviation_size;
+
+public:
+    /// Options that give the classic output: sized parentheses, no line breaks
+    tex_options();
+};
+
+/// Named repeated subexpression in LaTeX output
+struct tex_abbreviation
+{
+    /// Name that stands for the subexpression
+    std::string name;
+    /// Subexpression in LaTeX commands, split into lines
+    tld::vector<std::string> lines;
+};
+
 /// Expression tree class that can simplify itself and calculate its derivative
 class expr_tree
 {
-    expr_node* root_;
-    // Inherited from parser or antiderivative
-    tld::vector<std::string> parameters_;
-    // Inherited from parser or antiderivative
-    std::string variable_;
-    // Inherited from parser or antiderivative
+    expr_node* root_ = nullptr;
+    // Symbol ids of parameters in order of appearance, inherited from parser or antiderivative
+    tld::vector<std::uint32_t> parameters_;
+    // Symbol id of the variable, inherited from parser or antiderivative
+    std::uint32_t variable_ = 0;
+    // Name of the function, inherited from parser or antiderivative
     std::string name_;
+    // Symbol ids of all variables, the main one first. Other variables are
+    // the first parameters too, so values are given to them in the same way
+    tld::vector<std::uint32_t> variables_;
 
     // For semantic check
-    int errno_;
+    int errno_ = T_OK;
+
+    // Nodes that are replaced by names of abbreviations during LaTeX output,
+    // mapped to indices in abbreviations_
+    std::unordered_map<const expr_node*, std::size_t> abbreviated_;
+    // Abbreviations used in the last output
+    tld::vector<tex_abbreviation> abbreviations_;
+    // Root of abbreviation being defined, it is not replaced by its name
+    const expr_node* defining_ = nullptr;
+
+    // Symbol id of the variable by which the derivative is being calculated
+    std::uint32_t by_ = 0;
+    // Nodes that depend on that variable, derivatives of others are zero and are not calculated.
+    // Only functions of several variables fill it, where most subtrees may not depend on it
+    std::unordered_set<const expr_node*> varying_;
 
 public:
     /**
@@ -38,14 +88,33 @@ public:
 
     /**
      * @brief Construct normal expression tree
-     * @details This is the constructor that is normally used by other functions
+     * @details This is the constructor that is normally used by other functions.
+     * Symbols are given as ids of the symbol table, see @p InternSymbol.
+     * A function of several variables is given all of them in @p _variables,
+     * @p _variable first and the others first in @p _parameters
      */
-    expr_tree(expr_node* _root, const tld::vector<std::string>& _parameters, const std::string& _variable, const std::string& _name);
+    expr_tree(
+        expr_node* _root,
+        const tld::vector<std::uint32_t>& _parameters,
+        std::uint32_t _variable,
+        const std::string& _name,
+        const tld::vector<std::uint32_t>& _variables = tld::vector<std::uint32_t>()
+        );
     
     expr_tree(const expr_tree& that) = delete;
-    expr_tree(const expr_tree&& that) = delete;
     expr_tree& operator =(const expr_tree& that) = delete;
-    expr_tree& operator =(expr_tree&& that) = delete;
+
+    /**
+     * @brief Move constructor
+     * @param that source object, left empty
+     */
+    expr_tree(expr_tree&& that) noexcept;
+
+    /**
+     * @brief Move assignment operator
+     * @param that source object, left empty
+     */
+    expr_tree& operator =(expr_tree&& that) noexcept;
 
     /// Recursively frees allocated memory
     ~expr_tree();
@@ -53,21 +122,92 @@ public:
     /// Get representation of the expression in LaTeX commands
     std::string toTex();
 
+    /**
+     * @brief Get representation of the expression in LaTeX commands split into lines
+     * @param opts output settings
+     * @param indent estimated width in em of the text preceding the first line
+     * @details Lines are broken only at top-level '+' and '-' operators, every line
+     * but the first starts with the operator. Widths are estimated while emitting.
+     * If abbreviations are enabled, definitions of those used can be obtained
+     * by calling @p abbreviations method afterwards.
+     */
+    tld::vector<std::string> toTexLines(const tex_options& opts, double indent = 0.0);
+
+    /// Get abbreviations used in the last call of @p toTexLines in order of appearance
+    const tld::vector<tex_abbreviation>& abbreviations() const;
+
+    /// Get root node of the expression
+    const expr_node* root() const;
+
+    /// Get number of nodes in the expression
+    std::size_t size() const;
+
+    /// Get symbol id of the main variable
+    std::uint32_t variable() const;
+
+    /// Get symbol ids of parameters in order of their first appearance
+    const tld::vector<std::uint32_t>& parameters() const;
+
+    /// Get symbol ids of all variables, the main one first
+    const tld::vector<std::uint32_t>& variables() const;
+
+    /// Get compact textual representation of the expression, see @p Serialize
+    std::string serialize() const;
+
     /// Get derivative of the expression
     expr_tree derivative();
 
+    /**
+     * @brief Get partial derivative of the expression
+     * @param variable symbol id of any variable, see @p variables
+     * @details Other variables and parameters are constants, subtrees that do not
+     * contain the variable are not visited. The derivative is named by @p PartialName
+     * and has the same variables and parameters as the expression.
+     */
+    expr_tree derivative(std::uint32_t variable);
+
+    /**
+     * @brief Calculate value of the expression
+     * @param x value of the variable
+     * @param params values of parameters in order of @p parameters
+     */
+    double evaluate(double x, const double* params) const;
+
+    /**
+     * @brief Calculate Taylor coefficients of the expression, see @p taylor_series
+     * @param x point of expansion
+     * @param params values of parameters in order of @p parameters
+     * @param order highest order of coefficients
+     * @param coefficients storage for @p order + 1 numbers, the k-th derivative divided by k! each
+     */
+    void taylor(double x, const double* params, std::size_t order, double* coefficients) const;
+
     /**
      * Simplify the expression
      * This method modifies the object
      */
     void simplify();
 
+    /**
+     * @brief Substitute numbers for parameters
+     * @param values numbers by symbol ids of parameters, other ids are ignored
+     * @details Every subexpression that becomes numeric or involves fractions
+     * is calculated, functions of numbers included, unless its value is
+     * not finite: such subexpressions are kept for the semantic check.
+     * Expressions of integers alone are left to @p simplify.
+     * Bound parameters are removed from @p parameters.
+     */
+    void bind(const std::unordered_map<std::uint32_t, double>& values);
+
     /// @return Name of the function (for 'f(x)' it would be 'f')
-    const std::string& getName();
+    const std::string& getName() const;
 
     /// @return Main variable of the function (for 'f(x)' it would be 'x')
     std::string getVar();
 
+    /// @return All variables of the function (for 'f(x, y)' it would be 'x, y')
+    std::string getVars();
+
     /**
      * Check if the expression is semantically correct
      * (Or, to be more precise, if it's not explicitly incorrect)
@@ -82,16 +222,46 @@ public:
 
 private:
     
+    // Get values of parameters by symbol ids from values in order of parameters_,
+    // stored in a buffer of the thread that is valid until the next call
+    const double* symbolValues(const double* params) const;
+
     // Get LaTeX representation of a node
     std::string toTex(const expr_node* node);
 
+    // Get LaTeX representation of a node, estimating its width in em
+    // and telling whether it is taller than a line of text
+    std::string toTex(const expr_node* node, const tex_options& opts, double& width, bool& tall);
+
+    // Split expression into lines at top-level sum operators
+    tld::vector<std::string> texLines(const expr_node* node, const tex_options& opts, double indent);
+
+    // Choose repeated subexpressions of at least min_size nodes to be abbreviated
+    void findAbbreviations(std::size_t min_size);
+
+    // Collect operands of top-level sum with their signs ("+", "-" or "" for the first one)
+    void sumTerms(const expr_node* node, const char* sign, tld::vector<const expr_node*>& terms, tld::vector<const char*>& signs);
+
     // Get LaTeX representation of node's value
     // toTex method traverses the tree applying this method to nodes
     std::string texify(const expr_node& node);
 
+    // Get derivative by a variable under the given name
+    expr_tree derivative(std::uint32_t variable, const std::string& name);
+
+    // Recursively fill varying_, return whether the node depends on by_
+    bool findVarying(const expr_node* node);
+
+    // Tell whether a subtree depends on by_, by varying_ if it is filled
+    bool varies(const expr_node* node) const;
+
     // Recursively calculates derivative of node
     expr_node* derivative(const expr_node* node);
 
+    // Apply the chain rule: derivative of the inner function times the factor built by the rule,
+    // which is not built at all if the former is zero
+    expr_node* chain(const expr_node* node, const expr_node* inner, expr_node* (expr_tree::*rule)(const expr_node*));
+
     // The following methods define rules of differentiation //
 
     expr_node* mulDeriv(const expr_node* node);
@@ -100,6 +270,7 @@ private:
     expr_node* expDeriv(const expr_node* node);
     expr_node* logDeriv(const expr_node* node);
     expr_node* pwrDeriv(const expr_node* node);
+    expr_node* varPwrDeriv(const expr_node* node);
     expr_node* sinDeriv(const expr_node* node);
     expr_node* cosDeriv(const expr_node* node);
     expr_node* tanDeriv(const expr_node* node);
@@ -112,6 +283,9 @@ private:
     // Recursively simplify expression
     void simplify(expr_node* node);
 
+    // Recursively substitute and calculate numbers, return state of the subtree
+    int bind(expr_node* node, const std::unordered_map<std::uint32_t, double>& values);
+
     // The following methods define rules of simplification //
     
     void mulSimplifs(expr_node* node);
@@ -129,9 +303,46 @@ private:
     int checkNode(const expr_node* node);
 };
 
+/**
+ * @brief Make node of an addition, taking ownership of the operands
+ * @details This and the following constructors apply the rules of @p expr_tree::simplify
+ * that depend on the operands alone: integer arithmetic is calculated, additions of zero,
+ * multiplications by zero and one and powers of zero and one are removed.
+ * The result may be one of the operands then, and the other one is deleted.
+ * Derivatives are built with them and never contain such nodes.
+ */
+expr_node* MakeAdd(expr_node* lhs, expr_node* rhs);
+
+/// Make node of a subtraction, see @p MakeAdd
+expr_node* MakeSub(expr_node* lhs, expr_node* rhs);
+
+/// Make node of unary minus, see @p MakeAdd
+expr_node* MakeNeg(expr_node* arg);
+
+/// Make node of a multiplication, see @p MakeAdd
+expr_node* MakeMul(expr_node* lhs, expr_node* rhs);
+
+/// Make node of a division, see @p MakeAdd
+expr_node* MakeDiv(expr_node* lhs, expr_node* rhs);
+
+/// Make node of a power, see @p MakeAdd
+expr_node* MakePwr(expr_node* base, expr_node* exponent);
+
+/// Make node of a function of one argument, such as @p SIN
+expr_node* MakeFunc(int op, expr_node* arg);
+
+/// Make integer node
+expr_node* MakeInt(long number);
+
+/// Get name of the partial derivative of a function by a variable, "\\partial_{y}f" for "f" and "y"
+std::string PartialName(const std::string& name, std::uint32_t variable);
+
 /// Get LaTex command corresponding to operator code
 std::string OpToTex(int op);
 
+/// Get estimated width in em of an operator sign or function name
+double OpWidth(int op);
+
 /**
  * @brief Get LaTeX representation of a parameter or a variable name
  * @details All characters but the first are rendered as lower index
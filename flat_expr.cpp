@@ -0,0 +1,844 @@
+#include "flat_expr.hpp"
+#include <cstring>
+#include <unordered_map>
+
+// Bits of the code byte that hold the node type
+static const unsigned TYPE_BITS = 3;
+static const unsigned TYPE_MASK = (1U << TYPE_BITS) - 1;
+
+flat_expr::flat_expr(const expr_node* root)
+{
+    if (root == nullptr)
+        return;
+    std::size_t count = TreeSize(root);
+    codes_.reserve(count);
+    left_.reserve(count);
+    right_.reserve(count);
+    values_.reserve(count);
+    append(root);
+}
+
+std::size_t flat_expr::size() const
+{
+    return codes_.size();
+}
+
+bool flat_expr::empty() const
+{
+    return codes_.empty();
+}
+
+int flat_expr::type(std::uint32_t node) const
+{
+    return codes_[node] & TYPE_MASK;
+}
+
+int flat_expr::operation(std::uint32_t node) const
+{
+    return codes_[node] >> TYPE_BITS;
+}
+
+std::uint32_t flat_expr::left(std::uint32_t node) const
+{
+    return left_[node];
+}
+
+std::uint32_t flat_expr::right(std::uint32_t node) const
+{
+    return right_[node];
+}
+
+const expr_value& flat_expr::value(std::uint32_t node) const
+{
+    return values_[node];
+}
+
+std::uint32_t flat_expr::push(int node_type, const expr_value& node_value, std::uint32_t left_node, std::uint32_t right_node)
+{
+    unsigned code = (unsigned)node_type;
+    if (node_type == OP)
+        code |= (unsigned)node_value.integer << TYPE_BITS;
+    codes_.push_back((unsigned char)code);
+    left_.push_back(left_node);
+    right_.push_back(right_node);
+    values_.push_back(node_value);
+    return (std::uint32_t)(codes_.size() - 1);
+}
+
+std::uint32_t flat_expr::op(int code, std::uint32_t left_node, std::uint32_t right_node)
+{
+    return push(OP, (long)code, left_node, right_node);
+}
+
+std::uint32_t flat_expr::integer(long number)
+{
+    return push(INT, number, NO_NODE, NO_NODE);
+}
+
+bool flat_expr::isInteger(std::uint32_t node, long number) const
+{
+    return node != NO_NODE && type(node) == INT && values_[node].integer == number;
+}
+
+std::uint32_t flat_expr::append(const expr_node* node)
+{
+    std::uint32_t lhs = node->left ? append(node->left) : NO_NODE;
+    std::uint32_t rhs = node->right ? append(node->right) : NO_NODE;
+    return push(node->type, node->value, lhs, rhs);
+}
+
+expr_node* flat_expr::toTree() const
+{
+    if (empty())
+        return nullptr;
+    std::size_t count = size();
+    tld::vector<expr_node*, 0> nodes;
+    nodes.resize(count);
+    // The first user of a node takes it, the others get copies
+    tld::vector<unsigned char, 0> taken;
+    taken.resize(count);
+    auto take = [&](std::uint32_t node) -> expr_node* {
+        if (node == NO_NODE)
+            return nullptr;
+        if (taken[node])
+            return Copy(nodes[node]);
+        taken[node] = 1;
+        return nodes[node];
+    };
+    for (std::uint32_t i = 0; i < count; i++) {
+        nodes[i] = new expr_node((char)type(i), values_[i]);
+        expr_node* lhs = take(left_[i]);
+        Link(nodes[i], lhs, take(right_[i]));
+    }
+    return nodes[count - 1];
+}
+
+void flat_expr::compact()
+{
+    if (empty())
+        return;
+    std::uint32_t count = (std::uint32_t)size();
+    tld::vector<unsigned char, 0> reachable;
+    reachable.resize(count);
+    reachable[count - 1] = 1;
+    for (std::uint32_t i = count; i-- > 0;) {
+        if (!reachable[i])
+            continue;
+        if (left_[i] != NO_NODE)
+            reachable[left_[i]] = 1;
+        if (right_[i] != NO_NODE)
+            reachable[right_[i]] = 1;
+    }
+    // Nodes only move towards the beginning, so they are moved in place
+    tld::vector<std::uint32_t, 0> index;
+    index.resize(count);
+    std::uint32_t kept = 0;
+    for (std::uint32_t i = 0; i < count; i++) {
+        if (!reachable[i])
+            continue;
+        index[i] = kept;
+        codes_[kept] = codes_[i];
+        left_[kept] = left_[i] == NO_NODE ? NO_NODE : index[left_[i]];
+        right_[kept] = right_[i] == NO_NODE ? NO_NODE : index[right_[i]];
+        values_[kept] = values_[i];
+        kept++;
+    }
+    codes_.resize(kept);
+    left_.resize(kept);
+    right_.resize(kept);
+    values_.resize(kept);
+}
+
+flat_expr flat_expr::derivative() const
+{
+    // Nodes of the function are kept at the same indices and referred to by the rules
+    flat_expr deriv(*this);
+    if (empty())
+        return deriv;
+    std::uint32_t count = (std::uint32_t)size();
+
+    // Operands precede operations, so whether a node contains the variable is known in one pass
+    tld::vector<unsigned char, 0> varying;
+    varying.resize(count);
+    for (std::uint32_t i = 0; i < count; i++) {
+        if (type(i) == VAR)
+            varying[i] = 1;
+        else if (type(i) == OP)
+            varying[i] = (left_[i] != NO_NODE && varying[left_[i]]) || (right_[i] != NO_NODE && varying[right_[i]]);
+    }
+
+    // Derivatives are needed of all operands but exponents without the variable
+    tld::vector<unsigned char, 0> needed;
+    needed.resize(count);
+    needed[count - 1] = 1;
+    for (std::uint32_t i = count; i-- > 0;) {
+        if (!needed[i] || type(i) != OP)
+            continue;
+        if (left_[i] != NO_NODE)
+            needed[left_[i]] = 1;
+        if (right_[i] != NO_NODE && (operation(i) != PWR || varying[right_[i]]))
+            needed[right_[i]] = 1;
+    }
+
+    tld::vector<std::uint32_t, 0> d;
+    d.resize(count);
+    for (std::uint32_t i = 0; i < count; i++) {
+        if (!needed[i])
+            continue;
+        if (type(i) == VAR) {
+            d[i] = deriv.integer(1);
+            continue;
+        } else if (type(i) != OP) {
+            d[i] = deriv.integer(0);
+            continue;
+        }
+        std::uint32_t lhs = left_[i];
+        std::uint32_t rhs = right_[i];
+        std::uint32_t factor = NO_NODE;
+        switch (operation(i)) {
+        case ADD:
+            d[i] = deriv.op(ADD, d[lhs], d[rhs]);
+            continue;
+        case SUB:
+            d[i] = deriv.op(SUB, lhs == NO_NODE ? NO_NODE : d[lhs], d[rhs]);
+            continue;
+        case MUL:
+        case DIV: {
+            std::uint32_t first = deriv.op(MUL, d[lhs], rhs);
+            std::uint32_t second = deriv.op(MUL, lhs, d[rhs]);
+            if (operation(i) == MUL) {
+                d[i] = deriv.op(ADD, first, second);
+            } else {
+                std::uint32_t numerator = deriv.op(SUB, first, second);
+                std::uint32_t two = deriv.integer(2);
+                d[i] = deriv.op(DIV, numerator, deriv.op(PWR, rhs, two));
+            }
+            continue;
+        }
+        case PWR: {
+            if (varying[rhs]) {
+                // (u^v)' = u^v * (v' * ln(u) + v * u' / u)
+                std::uint32_t log_term = deriv.op(MUL, d[rhs], deriv.op(LOG, NO_NODE, lhs));
+                std::uint32_t base_term = deriv.op(DIV, deriv.op(MUL, rhs, d[lhs]), lhs);
+                d[i] = deriv.op(MUL, i, deriv.op(ADD, log_term, base_term));
+                continue;
+            }
+            std::uint32_t one = deriv.integer(1);
+            std::uint32_t exponent = deriv.op(SUB, rhs, one);
+            std::uint32_t power = deriv.op(PWR, lhs, exponent);
+            d[i] = deriv.op(MUL, d[lhs], deriv.op(MUL, rhs, power));
+            continue;
+        }
+        case EXP:
+            d[i] = deriv.op(MUL, i, d[rhs]);
+            continue;
+        case LOG:
+            d[i] = deriv.op(DIV, d[rhs], rhs);
+            continue;
+        case SQRT: {
+            std::uint32_t one = deriv.integer(1);
+            std::uint32_t two = deriv.integer(2);
+            factor = deriv.op(DIV, one, deriv.op(MUL, two, i));
+            break;
+        }
+        case SIN:
+            factor = deriv.op(COS, NO_NODE, rhs);
+            break;
+        case COS:
+            factor = deriv.op(SUB, NO_NODE, deriv.op(SIN, NO_NODE, rhs));
+            break;
+        case TAN:
+        case COT: {
+            std::uint32_t one = deriv.integer(1);
+            std::uint32_t trig = deriv.op(operation(i) == TAN ? COS : SIN, NO_NODE, rhs);
+            std::uint32_t two = deriv.integer(2);
+            factor = deriv.op(DIV, one, deriv.op(PWR, trig, two));
+            if (operation(i) == COT)
+                factor = deriv.op(SUB, NO_NODE, factor);
+            break;
+        }
+        case ASIN:
+        case ACOS: {
+            std::uint32_t one = deriv.integer(1);
+            std::uint32_t two = deriv.integer(2);
+            std::uint32_t square = deriv.op(PWR, rhs, two);
+            std::uint32_t root = deriv.op(SQRT, NO_NODE, deriv.op(SUB, deriv.integer(1), square));
+            factor = deriv.op(DIV, one, root);
+            if (operation(i) == ACOS)
+                factor = deriv.op(SUB, NO_NODE, factor);
+            break;
+        }
+        case ATAN:
+        case ACOT: {
+            std::uint32_t one = deriv.integer(1);
+            std::uint32_t two = deriv.integer(2);
+            std::uint32_t square = deriv.op(PWR, rhs, two);
+            factor = deriv.op(DIV, one, deriv.op(ADD, deriv.integer(1), square));
+            if (operation(i) == ACOT)
+                factor = deriv.op(SUB, NO_NODE, factor);
+            break;
+        }
+        default:
+            d[i] = deriv.integer(0);
+            continue;
+        }
+        // Chain rule for functions
+        d[i] = deriv.op(MUL, d[rhs], factor);
+    }
+    deriv.compact();
+    return deriv;
+}
+
+std::uint32_t flat_expr::simplified(int code, std::uint32_t left_node, std::uint32_t right_node)
+{
+    bool arith = (code == ADD || code == SUB || code == MUL || code == DIV);
+    if (arith && left_node != NO_NODE && type(left_node) == INT && type(right_node) == INT) {
+        long lhs = values_[left_node].integer;
+        long rhs = values_[right_node].integer;
+        switch (code) {
+        case ADD:
+            return integer(lhs + rhs);
+        case SUB:
+            return integer(lhs - rhs);
+        case MUL:
+            return integer(lhs * rhs);
+        default:
+            // Division by zero is left as is rather than evaluated
+            if (rhs == 0 || lhs % rhs)
+                return op(DIV, left_node, right_node);
+            return integer(lhs / rhs);
+        }
+    }
+    switch (code) {
+    case ADD:
+        if (isInteger(left_node, 0))
+            return right_node;
+        if (isInteger(right_node, 0))
+            return left_node;
+        break;
+    case SUB:
+        if (isInteger(left_node, 0))
+            return op(SUB, NO_NODE, right_node);
+        if (isInteger(right_node, 0))
+            return left_node == NO_NODE ? integer(0) : left_node;
+        break;
+    case MUL:
+        // (1/a)*b and b*(1/a) become b/a
+        if (type(left_node) == OP && operation(left_node) == DIV && isInteger(left_[left_node], 1))
+            return simplified(DIV, right_node, right_[left_node]);
+        if (type(right_node) == OP && operation(right_node) == DIV && isInteger(left_[right_node], 1))
+            return simplified(DIV, left_node, right_[right_node]);
+        if (isInteger(left_node, 0) || isInteger(right_node, 0))
+            return integer(0);
+        if (isInteger(left_node, 1))
+            return right_node;
+        if (isInteger(right_node, 1))
+            return left_node;
+        break;
+    case DIV:
+        if (isInteger(left_node, 0))
+            return integer(0);
+        if (isInteger(right_node, 1))
+            return left_node;
+        break;
+    case PWR:
+        if (isInteger(right_node, 0))
+            return integer(1);
+        if (isInteger(right_node, 1))
+            return left_node;
+        break;
+    default:
+        break;
+    }
+    return op(code, left_node, right_node);
+}
+
+void flat_expr::simplify()
+{
+    if (empty())
+        return;
+    std::uint32_t count = (std::uint32_t)size();
+    flat_expr result;
+    result.codes_.reserve(count);
+    result.left_.reserve(count);
+    result.right_.reserve(count);
+    result.values_.reserve(count);
+    // Index of the simplified node in the result
+    tld::vector<std::uint32_t, 0> index;
+    index.resize(count);
+    for (std::uint32_t i = 0; i < count; i++) {
+        if (type(i) != OP) {
+            index[i] = result.push(type(i), values_[i], NO_NODE, NO_NODE);
+            continue;
+        }
+        std::uint32_t lhs = left_[i] == NO_NODE ? NO_NODE : index[left_[i]];
+        std::uint32_t rhs = right_[i] == NO_NODE ? NO_NODE : index[right_[i]];
+        index[i] = result.simplified(operation(i), lhs, rhs);
+    }
+    // The root may have become one of the earlier nodes
+    std::uint32_t root = index[count - 1];
+    if (root != result.size() - 1)
+        result.push(result.type(root), result.values_[root], result.left_[root], result.right_[root]);
+    *this = std::move(result);
+    compact();
+}
+
+double flat_expr::evaluate(double x, const double* params, tld::vector<double, 0>& results) const
+{
+    if (empty())
+        return 0.0;
+    std::size_t count = size();
+    results.resize(count);
+    double* res = results.data();
+    for (std::size_t i = 0; i < count; i++)
+        res[i] = evaluate((std::uint32_t)i, x, params, res);
+    return res[count - 1];
+}
+
+void flat_expr::evaluate(const tld::vector<std::uint32_t, 0>& nodes, double x, const double* params, double* results) const
+{
+    for (std::size_t i = 0; i < nodes.size(); i++)
+        results[nodes[i]] = evaluate(nodes[i], x, params, results);
+}
+
+double flat_expr::evaluate(std::uint32_t node, double x, const double* params, const double* results) const
+{
+    switch (codes_[node] & TYPE_MASK) {
+    case INT:
+        return (double)values_[node].integer;
+    case FRAC:
+        return values_[node].frac;
+    case VAR:
+        return x;
+    case PAR:
+        return params[values_[node].integer];
+    case OP:
+        return Calculate(
+            codes_[node] >> TYPE_BITS,
+            left_[node] == NO_NODE ? 0.0 : results[left_[node]],
+            results[right_[node]]);
+    default:
+        return 0.0;
+    }
+}
+
+double OpCost(int op)
+{
+    switch (op) {
+    case ADD:
+    case SUB:
+    case MUL:
+        return 1.0;
+    case DIV:
+        return 4.0;
+    case SQRT:
+        return 6.0;
+    case EXP:
+    case LOG:
+    case SIN:
+    case COS:
+        return 20.0;
+    case TAN:
+    case COT:
+    case ASIN:
+    case ACOS:
+    case ATAN:
+    case ACOT:
+        return 25.0;
+    case PWR:
+        return 40.0;
+    case NONE:
+    default:
+        return 0.0;
+    }
+}
+
+double flat_expr::cost() const
+{
+    double total = 0.0;
+    for (std::size_t i = 0; i < size(); i++)
+        if (type((std::uint32_t)i) == OP)
+            total += OpCost(operation((std::uint32_t)i));
+    return total;
+}
+
+/// Identity of a node for merging of identical subexpressions
+struct flat_node_key
+{
+    unsigned char code;
+    std::uint32_t left;
+    std::uint32_t right;
+    std::uint64_t bits;
+
+    bool operator ==(const flat_node_key& that) const
+    {
+        return code == that.code && left == that.left && right == that.right && bits == that.bits;
+    }
+};
+
+struct flat_node_hash
+{
+    std::size_t operator ()(const flat_node_key& key) const
+    {
+        std::uint64_t hash = key.bits * 0x9e3779b97f4a7c15ULL;
+        hash ^= ((std::uint64_t)key.left << 32 | key.right) + 0x632be59bd9b4e019ULL + (hash << 6) + (hash >> 2);
+        hash ^= key.code + (hash << 6) + (hash >> 2);
+        return (std::size_t)hash;
+    }
+};
+
+/// Term of a sum: product of factors with a sign
+struct flat_term
+{
+    bool negative;
+    tld::vector<std::uint32_t> factors;
+};
+
+/// Builder of the rewritten expression, see @p flat_expr::optimize
+class flat_rewriter
+{
+    const flat_expr& src_;
+    flat_expr& out_;
+    std::unordered_map<flat_node_key, std::uint32_t, flat_node_hash> nodes_;
+    // Nodes of the result that depend on the variable
+    tld::vector<unsigned char, 0> varies_;
+    // Source sums that are terms of the sum using them, they are collected with it
+    tld::vector<unsigned char, 0> in_sum_;
+    // Index of every source node in the result
+    tld::vector<std::uint32_t, 0> index_;
+    // Marks of nodes for cost estimation, valid if equal to the current stamp:
+    // factors of terms of the sum being rewritten and nodes already counted
+    tld::vector<std::uint32_t, 0> stop_;
+    tld::vector<std::uint32_t, 0> visited_;
+    std::uint32_t stop_stamp_;
+    std::uint32_t visit_stamp_;
+
+public:
+    flat_rewriter(const flat_expr& src, flat_expr& out) :
+        src_(src),
+        out_(out),
+        stop_stamp_(0),
+        visit_stamp_(0)
+    {}
+
+    /// Rewrite the source and return the root in the result
+    std::uint32_t run()
+    {
+        const std::uint32_t NO_NODE = flat_expr::NO_NODE;
+        std::uint32_t count = (std::uint32_t)src_.size();
+        tld::vector<std::uint32_t, 0> users;
+        users.resize(count);
+        for (std::uint32_t i = 0; i < count; i++) {
+            if (src_.left(i) != NO_NODE)
+                users[src_.left(i)]++;
+            if (src_.right(i) != NO_NODE && src_.right(i) != src_.left(i))
+                users[src_.right(i)]++;
+        }
+        in_sum_.resize(count);
+        for (std::uint32_t i = 0; i < count; i++) {
+            if (!isSum(src_, i))
+                continue;
+            if (src_.left(i) != NO_NODE && isSum(src_, src_.left(i)) && users[src_.left(i)] == 1)
+                in_sum_[src_.left(i)] = 1;
+            if (isSum(src_, src_.right(i)) && users[src_.right(i)] == 1)
+                in_sum_[src_.right(i)] = 1;
+        }
+
+        index_.resize(count);
+        for (std::uint32_t i = 0; i < count; i++) {
+            if (src_.type(i) != OP) {
+                index_[i] = node(src_.type(i), src_.value(i), NO_NODE, NO_NODE);
+                continue;
+            }
+            int code = src_.operation(i);
+            std::uint32_t lhs = src_.left(i) == NO_NODE ? NO_NODE : index_[src_.left(i)];
+            std::uint32_t rhs = src_.right(i) == NO_NODE ? NO_NODE : index_[src_.right(i)];
+            long exponent = code == PWR ? integerValue(rhs) : 0;
+            if (exponent >= 2 && exponent <= SMALL_POWER)
+                index_[i] = power(lhs, (unsigned)exponent);
+            else if (exponent <= -1 && exponent >= -SMALL_POWER)
+                index_[i] = node(OP, (long)DIV, node(INT, 1L, NO_NODE, NO_NODE), power(lhs, (unsigned)-exponent));
+            else if (isSum(src_, i) && !in_sum_[i])
+                index_[i] = sum(i, node(OP, (long)code, lhs, rhs));
+            else
+                index_[i] = node(OP, (long)code, lhs, rhs);
+        }
+        return index_[count - 1];
+    }
+
+private:
+    // Largest magnitude of integer exponents turned into multiplications
+    static const long SMALL_POWER = 16;
+
+    // Get value of an integer or its negation in the result, zero for other nodes
+    long integerValue(std::uint32_t node_index) const
+    {
+        if (out_.type(node_index) == INT)
+            return out_.value(node_index).integer;
+        if (out_.type(node_index) == OP && out_.operation(node_index) == SUB
+            && out_.left(node_index) == flat_expr::NO_NODE && out_.type(out_.right(node_index)) == INT)
+            return -out_.value(out_.right(node_index)).integer;
+        return 0;
+    }
+
+    // Tell whether a node is addition or subtraction, unary minus included
+    static bool isSum(const flat_expr& expr, std::uint32_t node)
+    {
+        return expr.type(node) == OP && (expr.operation(node) == ADD || expr.operation(node) == SUB);
+    }
+
+    // Get index of a node in the result, appending it if there is no identical one
+    std::uint32_t node(int node_type, const expr_value& node_value, std::uint32_t left_node, std::uint32_t right_node)
+    {
+        flat_node_key key{(unsigned char)node_type, left_node, right_node, 0};
+        std::memcpy(&key.bits, &node_value, sizeof(node_value) < sizeof(key.bits) ? sizeof(node_value) : sizeof(key.bits));
+        if (node_type == OP)
+            key.code = (unsigned char)(node_type | node_value.integer << 3);
+        auto found = nodes_.find(key);
+        if (found != nodes_.end())
+            return found->second;
+        std::uint32_t index = out_.push(node_type, node_value, left_node, right_node);
+        nodes_.emplace(key, index);
+        unsigned char varies = node_type == VAR;
+        if (left_node != flat_expr::NO_NODE && varies_[left_node])
+            varies = 1;
+        if (right_node != flat_expr::NO_NODE && varies_[right_node])
+            varies = 1;
+        varies_.push_back(varies);
+        return index;
+    }
+
+    std::uint32_t mul(std::uint32_t lhs, std::uint32_t rhs)
+    {
+        return node(OP, (long)MUL, lhs, rhs);
+    }
+
+    // Get power with a positive integer exponent by squaring and multiplying
+    std::uint32_t power(std::uint32_t base, unsigned exponent)
+    {
+        if (exponent == 1)
+            return base;
+        std::uint32_t half = power(base, exponent / 2);
+        std::uint32_t square = mul(half, half);
+        return exponent % 2 ? mul(square, base) : square;
+    }
+
+    // Get product of factors, one if there are none
+    std::uint32_t product(const tld::vector<std::uint32_t>& factors)
+    {
+        if (factors.empty())
+            return node(INT, 1L, flat_expr::NO_NODE, flat_expr::NO_NODE);
+        std::uint32_t result = factors[0];
+        for (std::size_t i = 1; i < factors.size(); i++)
+            result = mul(result, factors[i]);
+        return result;
+    }
+
+    // Add a term to a sum that may be missing
+    std::uint32_t accumulate(std::uint32_t total, bool negative, std::uint32_t term)
+    {
+        if (total == flat_expr::NO_NODE)
+            return negative ? node(OP, (long)SUB, flat_expr::NO_NODE, term) : term;
+        return node(OP, (long)(negative ? SUB : ADD), total, term);
+    }
+
+    // Collect terms of a source sum with their signs
+    void collect(std::uint32_t src_node, bool negative, bool top, tld::vector<flat_term>& terms)
+    {
+        if ((top || in_sum_[src_node]) && isSum(src_, src_node)) {
+            if (src_.left(src_node) != flat_expr::NO_NODE)
+                collect(src_.left(src_node), negative, false, terms);
+            collect(src_.right(src_node), src_.operation(src_node) == SUB ? !negative : negative, false, terms);
+            return;
+        }
+        flat_term& term = terms.emplace_back();
+        term.negative = negative;
+        factorize(index_[src_node], term.factors);
+    }
+
+    // Split a product in the result into factors
+    void factorize(std::uint32_t node_index, tld::vector<std::uint32_t>& factors)
+    {
+        if (out_.type(node_index) == OP && out_.operation(node_index) == MUL) {
+            factorize(out_.left(node_index), factors);
+            factorize(out_.right(node_index), factors);
+        } else {
+            factors.push_back(node_index);
+        }
+    }
+
+    // Build sum of terms, factoring out multiplicands common to several of them
+    std::uint32_t factored(tld::vector<flat_term>& terms)
+    {
+        // Count terms that contain every factor
+        std::unordered_map<std::uint32_t, std::size_t> counts;
+        for (std::size_t i = 0; i < terms.size(); i++) {
+            for (std::size_t j = 0; j < terms[i].factors.size(); j++) {
+                std::uint32_t factor = terms[i].factors[j];
+                bool first = true;
+                for (std::size_t k = 0; k < j; k++)
+                    first = first && terms[i].factors[k] != factor;
+                if (first)
+                    counts[factor]++;
+            }
+        }
+        std::uint32_t common = flat_expr::NO_NODE;
+        std::size_t best = 1;
+        for (std::size_t i = 0; i < terms.size(); i++) {
+            for (std::size_t j = 0; j < terms[i].factors.size(); j++) {
+                std::size_t found = counts[terms[i].factors[j]];
+                if (found > best) {
+                    best = found;
+                    common = terms[i].factors[j];
+                }
+            }
+        }
+        if (common == flat_expr::NO_NODE) {
+            std::uint32_t total = flat_expr::NO_NODE;
+            for (std::size_t i = 0; i < terms.size(); i++)
+                total = accumulate(total, terms[i].negative, product(terms[i].factors));
+            return total;
+        }
+
+        // common * (terms that have it without it) + other terms
+        tld::vector<flat_term> with;
+        tld::vector<flat_term> others;
+        for (std::size_t i = 0; i < terms.size(); i++) {
+            tld::vector<std::uint32_t>& factors = terms[i].factors;
+            std::size_t j = 0;
+            while (j < factors.size() && factors[j] != common)
+                j++;
+            if (j == factors.size()) {
+                others.push_back(std::move(terms[i]));
+                continue;
+            }
+            flat_term& term = with.emplace_back();
+            term.negative = terms[i].negative;
+            for (std::size_t k = 0; k < factors.size(); k++)
+                if (k != j)
+                    term.factors.push_back(factors[k]);
+        }
+        flat_term& grouped = others.emplace_back();
+        grouped.negative = false;
+        grouped.factors.push_back(common);
+        grouped.factors.push_back(factored(with));
+        return factored(others);
+    }
+
+    // Rewrite a source sum, return the plain form if it is not cheaper
+    std::uint32_t sum(std::uint32_t src_node, std::uint32_t plain)
+    {
+        tld::vector<flat_term> terms;
+        collect(src_node, false, true, terms);
+        if (terms.size() < 2)
+            return plain;
+
+        // Powers of the variable times coefficients that do not depend on it
+        // are gathered into a polynomial, terms of coefficients are indexed by powers
+        tld::vector<tld::vector<flat_term>, 0> coefs;
+        tld::vector<flat_term> rest;
+        std::uint32_t variable = flat_expr::NO_NODE;
+        std::size_t monomials = 0;
+        stop_stamp_++;
+        for (std::size_t i = 0; i < terms.size(); i++) {
+            flat_term coef;
+            coef.negative = terms[i].negative;
+            std::size_t degree = 0;
+            bool polynomial = true;
+            for (std::size_t j = 0; j < terms[i].factors.size(); j++) {
+                std::uint32_t factor = terms[i].factors[j];
+                mark(stop_, factor, stop_stamp_);
+                if (out_.type(factor) == VAR) {
+                    variable = factor;
+                    degree++;
+                } else if (varies_[factor]) {
+                    polynomial = false;
+                } else {
+                    coef.factors.push_back(factor);
+                }
+            }
+            if (!polynomial || degree == 0) {
+                rest.push_back(std::move(terms[i]));
+                continue;
+            }
+            if (coefs.size() <= degree)
+                coefs.resize(degree + 1);
+            if (coefs[degree].empty())
+                monomials++;
+            coefs[degree].push_back(std::move(coef));
+        }
+        if (monomials > 1 || coefs.size() > 2) {
+            std::uint32_t horner = factored(coefs[coefs.size() - 1]);
+            unsigned gap = 0;
+            for (std::size_t degree = coefs.size() - 1; degree-- > 0;) {
+                gap++;
+                if (coefs[degree].empty())
+                    continue;
+                horner = node(OP, (long)ADD, mul(horner, power(variable, gap)), factored(coefs[degree]));
+                gap = 0;
+            }
+            if (gap > 0)
+                horner = mul(horner, power(variable, gap));
+            flat_term& term = rest.emplace_back();
+            term.negative = false;
+            term.factors.push_back(horner);
+        } else if (monomials == 1) {
+            // Too small for Horner form, the only power is a common multiplicand
+            flat_term& term = rest.emplace_back();
+            term.negative = false;
+            term.factors.push_back(factored(coefs[1]));
+            term.factors.push_back(variable);
+        }
+        std::uint32_t rewritten = factored(rest);
+        return skeletonCost(rewritten) < skeletonCost(plain) ? rewritten : plain;
+    }
+
+    // Mark a node with a stamp
+    void mark(tld::vector<std::uint32_t, 0>& marks, std::uint32_t node_index, std::uint32_t stamp)
+    {
+        if (marks.size() <= node_index)
+            marks.resize(out_.size());
+        marks[node_index] = stamp;
+    }
+
+    bool marked(const tld::vector<std::uint32_t, 0>& marks, std::uint32_t node_index, std::uint32_t stamp) const
+    {
+        return node_index < marks.size() && marks[node_index] == stamp;
+    }
+
+    // Get cost of operations of a sum down to the factors of its terms, which both forms share
+    double skeletonCost(std::uint32_t root)
+    {
+        double total = 0.0;
+        visit_stamp_++;
+        tld::vector<std::uint32_t, 0> stack;
+        stack.push_back(root);
+        while (!stack.empty()) {
+            std::uint32_t node_index = stack[stack.size() - 1];
+            stack.pop_back();
+            if (node_index == flat_expr::NO_NODE || marked(visited_, node_index, visit_stamp_))
+                continue;
+            mark(visited_, node_index, visit_stamp_);
+            if (out_.type(node_index) != OP || marked(stop_, node_index, stop_stamp_))
+                continue;
+            total += OpCost(out_.operation(node_index));
+            stack.push_back(out_.left(node_index));
+            stack.push_back(out_.right(node_index));
+        }
+        return total;
+    }
+};
+
+void flat_expr::optimize()
+{
+    if (empty())
+        return;
+    flat_expr result;
+    flat_rewriter rewriter(*this, result);
+    std::uint32_t root = rewriter.run();
+    // The root may be one of the earlier nodes
+    if (root != result.size() - 1)
+        result.push(result.type(root), result.values_[root], result.left_[root], result.right_[root]);
+    *this = std::move(result);
+    compact();
+}
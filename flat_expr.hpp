@@ -0,0 +1,153 @@
+#ifndef ACRAM_FLAT_EXPR_HPP
+#define ACRAM_FLAT_EXPR_HPP
+
+#include "common.hpp"
+#include <cstdint>
+/**
+ * @file flat_expr.hpp
+ * @brief compact expression storage in contiguous arrays
+ */
+
+/**
+ * @brief Get estimated cost of an operation in floating point operations
+ * @details Addition, subtraction, negation and multiplication cost 1,
+ * division 4, square root 6, exponent, logarithm, sine and cosine 20,
+ * other trigonometric functions 25 and power 40
+ */
+double OpCost(int op);
+
+/**
+ * @brief Expression stored as a structure of arrays in post-order
+ * @details Node @p i is described by the i-th element of every array:
+ * a byte with its type and operation, 32-bit indices of its operands
+ * and its value. Operands always precede the node that uses them,
+ * and the last node is the root, so every pass over the expression
+ * is a single sequential sweep without recursion.
+ *
+ * A node may be an operand of several nodes: derivatives refer to
+ * subexpressions of the original function instead of copying them.
+ * Nodes that are not reachable from the root are removed after every
+ * transformation.
+ */
+class flat_expr
+{
+public:
+    /// Index that stands for a missing operand
+    static const std::uint32_t NO_NODE = 0xffffffffU;
+
+private:
+    // Type in the lower 3 bits, operation code in the upper 5 bits
+    tld::vector<unsigned char, 0> codes_;
+    tld::vector<std::uint32_t, 0> left_;
+    tld::vector<std::uint32_t, 0> right_;
+    // Values of numbers and symbol ids of parameters, unused for operations
+    tld::vector<expr_value, 0> values_;
+
+public:
+    /// Construct empty expression
+    flat_expr() = default;
+
+    /**
+     * @brief Construct expression from a tree
+     * @param root root of the tree, it is not modified
+     */
+    explicit flat_expr(const expr_node* root);
+
+    /// Get number of nodes
+    std::size_t size() const;
+
+    /// Tell whether there are no nodes
+    bool empty() const;
+
+    /// Get type of a node ( @p INT, @p OP, etc.)
+    int type(std::uint32_t node) const;
+
+    /// Get operation code of a node, @p NONE for nodes that are not operations
+    int operation(std::uint32_t node) const;
+
+    /// Get index of the left operand or @p NO_NODE
+    std::uint32_t left(std::uint32_t node) const;
+
+    /// Get index of the right operand or @p NO_NODE
+    std::uint32_t right(std::uint32_t node) const;
+
+    /// Get value of a number or symbol id of a parameter node
+    const expr_value& value(std::uint32_t node) const;
+
+    /**
+     * @brief Build a tree of the expression
+     * @details Subexpressions used several times are copied, so the tree
+     * may have more nodes than this expression. The caller owns the tree.
+     */
+    expr_node* toTree() const;
+
+    /// Get derivative of the expression by the same rules as @p expr_tree::derivative
+    flat_expr derivative() const;
+
+    /**
+     * @brief Simplify the expression
+     * @details Applies the rules of @p expr_tree::simplify in one sweep
+     */
+    void simplify();
+
+    /**
+     * @brief Calculate value of the expression
+     * @param x value of the variable
+     * @param params values of parameters indexed by symbol ids
+     * @param results storage for values of all nodes, resized as necessary
+     */
+    double evaluate(double x, const double* params, tld::vector<double, 0>& results) const;
+
+    /**
+     * @brief Calculate values of some nodes
+     * @param nodes indices of nodes in increasing order
+     * @param x value of the variable
+     * @param params values of parameters indexed by symbol ids
+     * @param results values of all nodes, operands that are not among @p nodes
+     * must be calculated before
+     */
+    void evaluate(const tld::vector<std::uint32_t, 0>& nodes, double x, const double* params, double* results) const;
+
+    /// Get estimated cost of evaluation, the sum of @p OpCost of all operations
+    double cost() const;
+
+    /**
+     * @brief Rewrite the expression for cheaper evaluation
+     * @details Identical subexpressions are merged, integer powers up to 16
+     * become chains of multiplications, powers of the variable in sums become
+     * Horner form and multiplicands common to several terms are factored out.
+     * A sum is rewritten only if it becomes cheaper by @p OpCost.
+     * Values are equal mathematically, but rounding may differ.
+     */
+    void optimize();
+
+private:
+    friend class flat_rewriter;
+
+    // Calculate value of a node whose operands are in results
+    double evaluate(std::uint32_t node, double x, const double* params, const double* results) const;
+
+    // Append a node and return its index
+    std::uint32_t push(int node_type, const expr_value& node_value, std::uint32_t left_node, std::uint32_t right_node);
+
+    // Append an operation node and return its index
+    std::uint32_t op(int code, std::uint32_t left_node, std::uint32_t right_node);
+
+    // Apply rules of simplification to an operation on simplified operands,
+    // append the result if it is a new node and return its index
+    std::uint32_t simplified(int code, std::uint32_t left_node, std::uint32_t right_node);
+
+    // Append an integer node and return its index
+    std::uint32_t integer(long number);
+
+    // Tell if node represents the given integer
+    bool isInteger(std::uint32_t node, long number) const;
+
+    // Append nodes of a subtree in post-order and return index of its root
+    std::uint32_t append(const expr_node* node);
+
+    // Remove nodes that are not reachable from the root
+    void compact();
+};
+
+#endif // ACRAM_FLAT_EXPR_HPP
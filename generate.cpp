@@ -0,0 +1,81 @@
+#include "generator.hpp"
+#include <cstdio>
+#include <cstdlib>
+/**
+ * @file generate.cpp
+ * @brief command line front end of the function generator
+ * @details Prints generated definitions to stdout, one per line,
+ * so the output can be given to Acram Alpha in file mode.
+ *
+ * Usage: acram_gen [--count=n] [--first=n] [--size=n] [--depth=n] [--skew=x]
+ * [--params=n] [--mix=kind:weight,...] [--name=f] [--seed=n]
+ */
+
+static const char USAGE[] =
+    "usage: acram_gen [--count=n] [--first=n] [--size=n] [--depth=n] [--skew=x]\n"
+    "                 [--params=n] [--mix=kind:weight,...] [--name=f] [--seed=n]\n"
+    "kinds: var int frac par add sub mul div pow neg exp ln sqrt\n"
+    "       sin cos tan cot arcsin arccos arctan arccot\n";
+
+// Read unsigned integer option value. Returns false on malformed input
+static bool ReadNumber(const std::string& str, unsigned long long& number)
+{
+    char* end = nullptr;
+    number = std::strtoull(str.c_str(), &end, 10);
+    return end != str.c_str() && *end == '\0';
+}
+
+int main(int argc, char* argv[])
+{
+    generator_options opts;
+    unsigned long long count = 1, first = 0, number = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]), name, value;
+        std::size_t eq_pos = Extract(arg, name, 0, '=');
+        if (eq_pos != std::string::npos)
+            value = arg.substr(eq_pos + 1);
+        else
+            name = arg;
+        bool valid = (eq_pos != std::string::npos);
+        if (name == "--count") {
+            valid = valid && ReadNumber(value, count);
+        } else if (name == "--first") {
+            valid = valid && ReadNumber(value, first);
+        } else if (name == "--size") {
+            valid = valid && ReadNumber(value, number) && number > 0;
+            opts.size = number;
+        } else if (name == "--depth") {
+            valid = valid && ReadNumber(value, number) && number > 0 && number < 1000000;
+            opts.max_depth = (unsigned)number;
+        } else if (name == "--skew") {
+            char* end = nullptr;
+            opts.skew = std::strtod(value.c_str(), &end);
+            valid = valid && end != value.c_str() && *end == '\0' && opts.skew >= 0.0 && opts.skew <= 1.0;
+        } else if (name == "--params") {
+            valid = valid && ReadNumber(value, number) && number < 1000000;
+            opts.parameters = (unsigned)number;
+        } else if (name == "--mix") {
+            valid = valid && ReadMix(value, opts);
+        } else if (name == "--name") {
+            valid = valid && !value.empty() && value.find_first_of("( \t\n") == std::string::npos;
+            opts.name = value;
+        } else if (name == "--seed") {
+            valid = valid && ReadNumber(value, number);
+            opts.seed = number;
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            std::fprintf(stderr, "acram_gen: invalid argument \"%s\"\n%s", argv[i], USAGE);
+            return 1;
+        }
+    }
+
+    expr_generator generator(opts);
+    for (unsigned long long index = first; index < first + count; index++) {
+        std::string line = generator.generate(index);
+        line += '\n';
+        std::fwrite(line.data(), 1, line.size(), stdout);
+    }
+    return std::fflush(stdout) == 0 ? 0 : 1;
+}
@@ -0,0 +1,233 @@
+#include "generator.hpp"
+#include <cstdlib>
+
+// Names of node kinds used in operator mix strings
+static const char* const KIND_NAMES[GEN_KINDS_COUNT] = {
+    "var", "int", "frac", "par",
+    "add", "sub", "mul", "div", "pow", "neg",
+    "exp", "ln", "sqrt",
+    "sin", "cos", "tan", "cot",
+    "arcsin", "arccos", "arctan", "arccot"
+};
+
+// Spellings of functions accepted by the parser, indexed by kind - GEN_EXP
+static const char* const FUNCTION_NAMES[][2] = {
+    {"exp", "exp"}, {"ln", "log"}, {"sqrt", "squirt"},
+    {"sin", "sin"}, {"cos", "cos"}, {"tan", "tg"}, {"cot", "ctg"},
+    {"arcsin", "arcsin"}, {"arccos", "arccos"}, {"arctan", "arctg"}, {"arccot", "arcctg"}
+};
+
+// Letters of parameter names, the variable "x" is not among them
+static const char PARAMETER_LETTERS[] = "abcdkmnpqrsuvw";
+
+// Priorities of generated subexpressions: the higher, the tighter it binds
+enum generator_priorities {
+    PRIORITY_SUM = 1, PRIORITY_PRODUCT, PRIORITY_POWER, PRIORITY_PRIMARY
+};
+
+generator_options::generator_options() :
+    name("f"),
+    size(32),
+    max_depth(64),
+    skew(0.5),
+    parameters(3),
+    weights{4, 3, 0, 2, 3, 2, 3, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1},
+    seed(1)
+{}
+
+bool ReadMix(const std::string& str, generator_options& opts)
+{
+    std::size_t pos = 0;
+    while (pos < str.size()) {
+        std::string entry;
+        std::size_t end = str.find(',', pos);
+        if (end == std::string::npos)
+            end = str.size();
+        entry = str.substr(pos, end - pos);
+        pos = end + 1;
+        std::size_t colon = entry.find(':');
+        if (colon == std::string::npos)
+            return false;
+        std::string kind = entry.substr(0, colon);
+        char* num_end = nullptr;
+        unsigned long weight = std::strtoul(entry.c_str() + colon + 1, &num_end, 10);
+        if (num_end == entry.c_str() + colon + 1 || *num_end != '\0' || weight > 1000000)
+            return false;
+        int found = -1;
+        for (int i = 0; i < GEN_KINDS_COUNT; i++)
+            if (kind == KIND_NAMES[i])
+                found = i;
+        if (found < 0)
+            return false;
+        opts.weights[found] = (unsigned)weight;
+    }
+    return true;
+}
+
+expr_generator::expr_generator(const generator_options& opts) :
+    opts_(opts),
+    leaf_total_(0),
+    state_(0)
+{
+    if (opts_.parameters == 0)
+        opts_.weights[GEN_PAR] = 0;
+    for (int i = GEN_VAR; i <= GEN_PAR; i++)
+        leaf_total_ += opts_.weights[i];
+    if (leaf_total_ == 0) {
+        opts_.weights[GEN_VAR] = 1;
+        leaf_total_ = 1;
+    }
+    if (opts_.skew < 0.0)
+        opts_.skew = 0.0;
+    else if (opts_.skew > 1.0)
+        opts_.skew = 1.0;
+}
+
+std::uint64_t expr_generator::next()
+{
+    // SplitMix64: fast, and the same sequence on every platform
+    std::uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+std::uint64_t expr_generator::below(std::uint64_t bound)
+{
+    return next() % bound;
+}
+
+std::string expr_generator::generate(std::uint64_t index)
+{
+    state_ = opts_.seed ^ (index * 0xd1342543de82ef95ULL);
+    next();
+    std::string out = opts_.name + "(x) = ";
+    out.reserve(out.size() + opts_.size * 4);
+    expression(out, opts_.size, 0);
+    return out;
+}
+
+int expr_generator::chooseKind(std::size_t size)
+{
+    // Leaves only fit a single node, unary operations need two nodes and binary ones three
+    int first = GEN_VAR, last = GEN_PAR;
+    if (size == 2) {
+        first = GEN_NEG;
+        last = GEN_KINDS_COUNT - 1;
+    } else if (size > 2) {
+        first = GEN_ADD;
+        last = GEN_KINDS_COUNT - 1;
+    }
+    unsigned total = 0;
+    for (int i = first; i <= last; i++)
+        total += opts_.weights[i];
+    if (total == 0) {
+        first = GEN_VAR;
+        last = GEN_PAR;
+        total = leaf_total_;
+    }
+    std::uint64_t choice = below(total);
+    for (int i = first; i <= last; i++) {
+        if (choice < opts_.weights[i])
+            return i;
+        choice -= opts_.weights[i];
+    }
+    return last;
+}
+
+void expr_generator::leaf(std::string& out, bool constant)
+{
+    unsigned total = leaf_total_ - (constant ? opts_.weights[GEN_VAR] : 0);
+    int kind = GEN_INT;
+    if (total > 0) {
+        std::uint64_t choice = below(total);
+        for (int i = constant ? GEN_INT : GEN_VAR; i <= GEN_PAR; i++) {
+            if (choice < opts_.weights[i]) {
+                kind = i;
+                break;
+            }
+            choice -= opts_.weights[i];
+        }
+    }
+    switch (kind) {
+    case GEN_VAR:
+        out += 'x';
+        break;
+    case GEN_INT:
+        out += std::to_string(constant ? 2 + below(4) : 1 + below(20));
+        break;
+    case GEN_FRAC:
+        out += std::to_string(below(10)) + '.' + std::to_string(1 + below(99));
+        break;
+    case GEN_PAR: {
+        std::uint64_t par = below(opts_.parameters);
+        out += PARAMETER_LETTERS[par % (sizeof(PARAMETER_LETTERS) - 1)];
+        if (par >= sizeof(PARAMETER_LETTERS) - 1)
+            out += std::to_string(par / (sizeof(PARAMETER_LETTERS) - 1));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void expr_generator::operand(std::string& out, std::size_t size, unsigned depth, int min_priority)
+{
+    std::size_t start = out.size();
+    int priority = expression(out, size, depth);
+    if (priority < min_priority) {
+        out.insert(start, 1, '(');
+        out += ')';
+    }
+}
+
+int expr_generator::expression(std::string& out, std::size_t size, unsigned depth)
+{
+    int kind = (depth >= opts_.max_depth) ? (int)GEN_VAR : chooseKind(size);
+    if (kind <= GEN_PAR) {
+        leaf(out, false);
+        return PRIORITY_PRIMARY;
+    }
+    if (kind >= GEN_EXP) {
+        out += FUNCTION_NAMES[kind - GEN_EXP][below(2)];
+        out += '(';
+        expression(out, size - 1, depth + 1);
+        out += ')';
+        return PRIORITY_PRIMARY;
+    }
+    switch (kind) {
+    case GEN_NEG:
+        // The parser takes unary minus only at the beginning of an expression
+        out += "(-";
+        operand(out, size - 1, depth + 1, PRIORITY_PRODUCT);
+        out += ')';
+        return PRIORITY_PRIMARY;
+    case GEN_PWR:
+        // Exponents are kept constant: f(x)^g(x) is not supported
+        operand(out, size - 2, depth + 1, PRIORITY_PRIMARY);
+        out += '^';
+        leaf(out, true);
+        return PRIORITY_POWER;
+    default:
+        break;
+    }
+
+    std::size_t rest = size - 1;
+    double share = 0.5 + opts_.skew * ((double)(next() >> 11) * 0x1.0p-53 - 0.5);
+    std::size_t left = (std::size_t)(rest * share + 0.5);
+    left = std::min(std::max(left, (std::size_t)1), rest - 1);
+    // Right operands bind tighter to keep the shape of the tree when it is parsed back
+    switch (kind) {
+    case GEN_ADD:
+    case GEN_SUB:
+        operand(out, left, depth + 1, PRIORITY_SUM);
+        out += (kind == GEN_ADD) ? " + " : " - ";
+        operand(out, rest - left, depth + 1, PRIORITY_PRODUCT);
+        return PRIORITY_SUM;
+    default:
+        operand(out, left, depth + 1, PRIORITY_PRODUCT);
+        out += (kind == GEN_MUL) ? '*' : '/';
+        operand(out, rest - left, depth + 1, PRIORITY_POWER);
+        return PRIORITY_PRODUCT;
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef ACRAM_GENERATOR_HPP
+#define ACRAM_GENERATOR_HPP
+
+#include "common.hpp"
+#include <cstdint>
+/**
+ * @file generator.hpp
+ * @brief random function definitions for stress tests and benchmarks
+ */
+
+/// Kinds of nodes the generator can produce, used to index operator mix weights
+enum generator_kinds {
+    GEN_VAR = 0, GEN_INT, GEN_FRAC, GEN_PAR,
+    GEN_ADD, GEN_SUB, GEN_MUL, GEN_DIV, GEN_PWR, GEN_NEG,
+    GEN_EXP, GEN_LOG, GEN_SQRT,
+    GEN_SIN, GEN_COS, GEN_TAN, GEN_COT,
+    GEN_ASIN, GEN_ACOS, GEN_ATAN, GEN_ACOT,
+    GEN_KINDS_COUNT
+};
+
+/// Settings of the generator
+struct generator_options
+{
+    /// Name of generated functions, the variable is always "x"
+    std::string name;
+    /// Approximate number of nodes in every function
+    std::size_t size;
+    /// Maximal depth of expression trees, subtrees are cut to leaves below it
+    unsigned max_depth;
+    /**
+     * @brief Shape of trees, from 0 (balanced, shallow) to 1 (random splits, deep)
+     * @details Share of nodes given to the left operand of a binary operator
+     * is drawn from [0.5 - skew / 2, 0.5 + skew / 2]
+     */
+    double skew;
+    /// Number of distinct parameters that may appear in functions
+    unsigned parameters;
+    /// Relative frequencies of node kinds, indexed by @p generator_kinds
+    unsigned weights[GEN_KINDS_COUNT];
+    /// Seed of the corpus
+    std::uint64_t seed;
+
+public:
+    /// Initialize options with default values
+    generator_options();
+};
+
+/**
+ * @brief Set node kind frequencies from a string like "add:3,mul:2,sin:0"
+ * @return false if the string is malformed, weights are left partially updated then
+ * @details Kinds are named var, int, frac, par, add, sub, mul, div, pow, neg
+ * and after the functions: exp, ln, sqrt, sin, cos, tan, cot,
+ * arcsin, arccos, arctan, arccot
+ */
+bool ReadMix(const std::string& str, generator_options& opts);
+
+/**
+ * @brief Generator of random function definitions
+ * @details Every function is a line of the form "name(x) = ..." accepted by @p expr_parser.
+ * Functions are determined by the seed and their index only,
+ * so any part of a corpus can be reproduced independently of the rest.
+ */
+class expr_generator
+{
+    generator_options opts_;
+    // Sum of weights of leaf kinds
+    unsigned leaf_total_;
+    // State of the random number generator
+    std::uint64_t state_;
+
+public:
+    expr_generator() = delete;
+    expr_generator(const generator_options& opts);
+    ~expr_generator() = default;
+
+    /// Get function definition with the given index in the corpus
+    std::string generate(std::uint64_t index);
+
+private:
+    // Get next random number
+    std::uint64_t next();
+    // Get random number from [0, bound)
+    std::uint64_t below(std::uint64_t bound);
+
+    // Choose node kind for a subtree of the given size
+    int chooseKind(std::size_t size);
+
+    // Write subtree with about @p size nodes, return priority of its top operation
+    int expression(std::string& out, std::size_t size, unsigned depth);
+    // Write a leaf, constants only if @p constant is set
+    void leaf(std::string& out, bool constant);
+    // Write a subtree, wrapping it in parentheses if its priority is less than @p min_priority
+    void operand(std::string& out, std::size_t size, unsigned depth, int min_priority);
+};
+
+#endif // ACRAM_GENERATOR_HPP
@@ -0,0 +1,581 @@
+#include "jit.hpp"
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define ACRAM_JIT_X86_64 1
+#include <sys/mman.h>
+#else
+#define ACRAM_JIT_X86_64 0
+#endif
+
+#if ACRAM_JIT_X86_64
+// Functions called by the generated code, computed as in Calculate
+static double JitPow(double left, double right) { return std::pow(left, right); }
+static double JitExp(double arg) { return std::exp(arg); }
+static double JitLog(double arg) { return std::log(arg); }
+static double JitSin(double arg) { return std::sin(arg); }
+static double JitCos(double arg) { return std::cos(arg); }
+static double JitTan(double arg) { return std::tan(arg); }
+static double JitCot(double arg) { return 1.0 / std::tan(arg); }
+static double JitAsin(double arg) { return std::asin(arg); }
+static double JitAcos(double arg) { return std::acos(arg); }
+static double JitAtan(double arg) { return std::atan(arg); }
+static double JitAcot(double arg) { return std::acos(0.0) - std::atan(arg); }
+
+// Numbers of general purpose registers
+static const unsigned char REG_RSP = 4;
+static const unsigned char REG_RBX = 3;
+static const unsigned char REG_R12 = 12;
+static const unsigned char REG_R13 = 13;
+
+// Opcodes of SSE2 scalar double instructions following F2 0F
+static const unsigned char SSE_LOAD = 0x10;
+static const unsigned char SSE_STORE = 0x11;
+static const unsigned char SSE_SQRT = 0x51;
+static const unsigned char SSE_ADD = 0x58;
+static const unsigned char SSE_MUL = 0x59;
+static const unsigned char SSE_SUB = 0x5c;
+static const unsigned char SSE_DIV = 0x5e;
+
+/// Memory operand: base register and 32-bit displacement
+struct jit_location {
+    unsigned char base;
+    std::int32_t disp;
+};
+
+/// Writer of machine code
+class jit_assembler
+{
+    tld::vector<unsigned char, 0> code_;
+
+public:
+    explicit jit_assembler(std::size_t capacity) :
+        code_(capacity)
+    {}
+
+    const tld::vector<unsigned char, 0>& code() const
+    {
+        return code_;
+    }
+
+    void bytes(std::initializer_list<unsigned char> list)
+    {
+        for (unsigned char byte: list)
+            code_.push_back(byte);
+    }
+
+    void imm32(std::uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            code_.push_back((unsigned char)(value >> (8 * i)));
+    }
+
+    void imm64(std::uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+            code_.push_back((unsigned char)(value >> (8 * i)));
+    }
+
+    /// Overwrite @p size bytes of code at @p pos with a little-endian value
+    void patch(std::size_t pos, std::uint64_t value, int size)
+    {
+        for (int i = 0; i < size; i++)
+            code_[pos + i] = (unsigned char)(value >> (8 * i));
+    }
+
+    /// Scalar double instruction between xmm register and memory
+    void sse(unsigned char opcode, unsigned char xmm, const jit_location& mem)
+    {
+        code_.push_back(0xf2);
+        if (mem.base >= 8)
+            code_.push_back(0x41);
+        bytes({0x0f, opcode, (unsigned char)(0x80 | (xmm << 3) | (mem.base & 7))});
+        // rsp and r12 as a base require the SIB byte
+        if ((mem.base & 7) == REG_RSP)
+            code_.push_back(0x24);
+        imm32((std::uint32_t)mem.disp);
+    }
+
+    /// Scalar double instruction between xmm registers
+    void sse(unsigned char opcode, unsigned char dst, unsigned char src)
+    {
+        bytes({0xf2, 0x0f, opcode, (unsigned char)(0xc0 | (dst << 3) | src)});
+    }
+
+    /// movapd xmm1, xmm0
+    void copyToXmm1()
+    {
+        bytes({0x66, 0x0f, 0x28, 0xc8});
+    }
+
+    /// xorpd xmm0, xmm0
+    void zeroXmm0()
+    {
+        bytes({0x66, 0x0f, 0x57, 0xc0});
+    }
+
+    /// mov rax, function; call rax
+    void call(const void* function)
+    {
+        bytes({0x48, 0xb8});
+        imm64((std::uint64_t)(std::uintptr_t)function);
+        bytes({0xff, 0xd0});
+    }
+};
+
+// Get function called for an operation, nullptr if it is inlined
+static const void* Callee(int op)
+{
+    switch (op) {
+    case PWR:
+        return (const void*)&JitPow;
+    case EXP:
+        return (const void*)&JitExp;
+    case LOG:
+        return (const void*)&JitLog;
+    case SIN:
+        return (const void*)&JitSin;
+    case COS:
+        return (const void*)&JitCos;
+    case TAN:
+        return (const void*)&JitTan;
+    case COT:
+        return (const void*)&JitCot;
+    case ASIN:
+        return (const void*)&JitAsin;
+    case ACOS:
+        return (const void*)&JitAcos;
+    case ATAN:
+        return (const void*)&JitAtan;
+    case ACOT:
+        return (const void*)&JitAcot;
+    case NONE:
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+    case SQRT:
+    default:
+        return nullptr;
+    }
+}
+/// Translation of operation nodes to the body of a function
+class jit_lowering
+{
+    const flat_expr& expr_;
+    jit_assembler& as_;
+    tld::vector<jit_location, 0>& where_;
+    // Index of the last node of the body that uses each node
+    tld::vector<std::uint32_t, 0> last_use_;
+    tld::vector<std::int32_t, 0> free_slots_;
+    std::int32_t slots_;
+    // Node whose value is in xmm0
+    std::uint32_t in_xmm0_;
+
+public:
+    jit_lowering(const flat_expr& expr, jit_assembler& as, tld::vector<jit_location, 0>& where) :
+        expr_(expr),
+        as_(as),
+        where_(where),
+        slots_(0),
+        in_xmm0_(flat_expr::NO_NODE)
+    {
+        last_use_.resize(expr.size());
+        for (std::size_t i = 0; i < last_use_.size(); i++)
+            last_use_[i] = flat_expr::NO_NODE;
+    }
+
+    /**
+     * @brief Emit calculation of operation nodes in increasing order
+     * @details Results needed by later nodes are kept in frame slots above x at [rsp],
+     * those with non-negative @p outputs are also stored to [r13 + 8 * output].
+     * The result of the last node is left in xmm0.
+     * @return false if a node is not supported
+     */
+    bool lower(const tld::vector<std::uint32_t, 0>& nodes, const std::int32_t* outputs)
+    {
+        const std::uint32_t NO_NODE = flat_expr::NO_NODE;
+        for (std::size_t k = 0; k < nodes.size(); k++) {
+            if (expr_.left(nodes[k]) != NO_NODE)
+                last_use_[expr_.left(nodes[k])] = nodes[k];
+            if (expr_.right(nodes[k]) != NO_NODE)
+                last_use_[expr_.right(nodes[k])] = nodes[k];
+        }
+        for (std::size_t k = 0; k < nodes.size(); k++) {
+            std::uint32_t i = nodes[k];
+            int code = expr_.operation(i);
+            std::uint32_t left = expr_.left(i);
+            std::uint32_t right = expr_.right(i);
+            // Only subtraction and division have a unary form
+            if (right == NO_NODE || (left == NO_NODE && (code == ADD || code == MUL || code == PWR)))
+                return false;
+            switch (code) {
+            case ADD:
+            case MUL:
+                // Operands commute, so the one already in xmm0 goes first
+                if (right == in_xmm0_)
+                    std::swap(left, right);
+                load(0, left);
+                apply(code == ADD ? SSE_ADD : SSE_MUL, right);
+                break;
+            case SUB:
+            case DIV:
+                if (left == NO_NODE) {
+                    load(1, right);
+                    as_.zeroXmm0();
+                    as_.sse(code == SUB ? SSE_SUB : SSE_DIV, 0, 1);
+                } else if (right == in_xmm0_ && left != right) {
+                    load(1, right);
+                    load(0, left);
+                    as_.sse(code == SUB ? SSE_SUB : SSE_DIV, 0, 1);
+                } else {
+                    load(0, left);
+                    apply(code == SUB ? SSE_SUB : SSE_DIV, right);
+                }
+                break;
+            case SQRT:
+                apply(SSE_SQRT, right);
+                break;
+            case PWR:
+                if (right == in_xmm0_ && left != right) {
+                    load(1, right);
+                    load(0, left);
+                } else {
+                    load(0, left);
+                    load(1, right);
+                }
+                as_.call(Callee(code));
+                break;
+            case EXP:
+            case LOG:
+            case SIN:
+            case COS:
+            case TAN:
+            case COT:
+            case ASIN:
+            case ACOS:
+            case ATAN:
+            case ACOT:
+                load(0, right);
+                as_.call(Callee(code));
+                break;
+            case NONE:
+            default:
+                return false;
+            }
+            in_xmm0_ = i;
+
+            // Slots of operands used for the last time can hold the result
+            release(left, i);
+            if (right != left)
+                release(right, i);
+            if (outputs != nullptr && outputs[i] >= 0)
+                as_.sse(SSE_STORE, 0, jit_location{REG_R13, 8 * outputs[i]});
+            if (last_use_[i] == NO_NODE)
+                continue;
+            std::int32_t disp;
+            if (free_slots_.empty()) {
+                disp = 8 * ++slots_;
+            } else {
+                disp = free_slots_[free_slots_.size() - 1];
+                free_slots_.pop_back();
+            }
+            where_[i] = jit_location{REG_RSP, disp};
+            as_.sse(SSE_STORE, 0, where_[i]);
+        }
+        return true;
+    }
+
+    /// Load value of a node to xmm0 or xmm1
+    void load(unsigned char xmm, std::uint32_t node)
+    {
+        if (node == in_xmm0_) {
+            if (xmm != 0)
+                as_.copyToXmm1();
+            return;
+        }
+        as_.sse(SSE_LOAD, xmm, where_[node]);
+        if (xmm == 0)
+            in_xmm0_ = node;
+    }
+
+    /// Get number of frame slots used
+    std::int32_t slots() const
+    {
+        return slots_;
+    }
+
+private:
+    // Apply instruction to xmm0 and an operand loaded before or in memory
+    void apply(unsigned char opcode, std::uint32_t node)
+    {
+        if (node == in_xmm0_)
+            as_.sse(opcode, 0, 0);
+        else
+            as_.sse(opcode, 0, where_[node]);
+    }
+
+    // Free the frame slot of an operand after its last use
+    void release(std::uint32_t node, std::uint32_t user)
+    {
+        if (node != flat_expr::NO_NODE && expr_.type(node) == OP
+            && where_[node].base == REG_RSP && last_use_[node] == user)
+            free_slots_.push_back(where_[node].disp);
+    }
+};
+
+// Emit saving of registers, allocation of the frame and loading of constants.
+// With out, the second argument is kept in r13. Positions of the frame size
+// and the address of constants are returned for patching
+static void Prologue(jit_assembler& as, bool out, std::size_t& frame_at, std::size_t& constants_at)
+{
+    // push rbx; push r12
+    as.bytes({0x53, 0x41, 0x54});
+    if (out)
+        as.bytes({0x41, 0x55});
+    // sub rsp, frame
+    as.bytes({0x48, 0x81, 0xec});
+    frame_at = as.code().size();
+    as.imm32(0);
+    // mov rbx, rdi
+    as.bytes({0x48, 0x89, 0xfb});
+    if (out)
+        as.bytes({0x49, 0x89, 0xf5});
+    // mov r12, constants
+    as.bytes({0x49, 0xbc});
+    constants_at = as.code().size();
+    as.imm64(0);
+}
+
+// Emit release of the frame and return, patch size of the frame
+static void Epilogue(jit_assembler& as, bool out, std::size_t frame_at, std::int32_t slots)
+{
+    // Return address and saved registers take 24 or 32 bytes,
+    // the frame makes rsp aligned to 16 bytes for calls
+    std::uint32_t frame = 8 * (std::uint32_t)(slots + 1);
+    if ((frame + (out ? 32 : 24)) % 16 != 0)
+        frame += 8;
+    // add rsp, frame
+    as.bytes({0x48, 0x81, 0xc4});
+    as.imm32(frame);
+    if (out)
+        as.bytes({0x41, 0x5d});
+    // pop r12; pop rbx; ret
+    as.bytes({0x41, 0x5c, 0x5b, 0xc3});
+    as.patch(frame_at, frame, 4);
+}
+#endif
+
+jit_function::jit_function(const flat_expr& expr) :
+    hoisted_(0),
+    code_(nullptr),
+    code_size_(0),
+    prepare_(nullptr),
+    entry_(nullptr)
+{
+    const std::uint32_t NO_NODE = flat_expr::NO_NODE;
+    std::uint32_t count = (std::uint32_t)expr.size();
+    // A node varies if it is the variable or one of its operands varies
+    tld::vector<unsigned char, 0> varying;
+    varying.resize(count);
+    for (std::uint32_t i = 0; i < count; i++) {
+        if (expr.type(i) == VAR) {
+            varying[i] = 1;
+        } else if (expr.type(i) == OP) {
+            varying[i] = (expr.left(i) != NO_NODE && varying[expr.left(i)])
+                || (expr.right(i) != NO_NODE && varying[expr.right(i)]);
+            if (!varying[i])
+                hoisted_++;
+        }
+    }
+    if (compile(expr, varying))
+        return;
+
+    constants_.clear();
+    expr_ = expr;
+    for (std::uint32_t i = 0; i < count; i++) {
+        if (varying[i])
+            varying_.push_back(i);
+        else
+            invariant_.push_back(i);
+    }
+    values_.clear();
+    values_.resize(count);
+}
+
+jit_function::~jit_function()
+{
+#if ACRAM_JIT_X86_64
+    if (code_ != nullptr)
+        munmap(code_, code_size_);
+#endif
+}
+
+bool jit_function::native() const
+{
+    return entry_ != nullptr;
+}
+
+std::size_t jit_function::hoisted() const
+{
+    return hoisted_;
+}
+
+std::size_t jit_function::codeSize() const
+{
+    return code_size_;
+}
+
+void jit_function::setParameters(const double* params)
+{
+    if (prepare_ != nullptr)
+        prepare_(params, values_.data());
+    else
+        expr_.evaluate(invariant_, 0.0, params, values_.data());
+}
+
+double jit_function::evaluate(double x)
+{
+    if (entry_ != nullptr)
+        return entry_(x, values_.data());
+    if (expr_.empty())
+        return 0.0;
+    // Nodes that vary never read parameters
+    expr_.evaluate(varying_, x, nullptr, values_.data());
+    return values_[values_.size() - 1];
+}
+
+#if ACRAM_JIT_X86_64
+/*
+ * Two functions are generated:
+ * void prepare(const double* params, double* values) calculates nodes
+ * that do not depend on x and stores those needed by the other one,
+ * double entry(double x, const double* values) calculates the rest.
+ * rbx holds the first argument, r12 the constants, r13 the values being
+ * stored and the frame at rsp holds x followed by slots of intermediate
+ * results. Every operation leaves its result in xmm0, so an operand
+ * computed right before its use is not loaded again.
+ */
+bool jit_function::compile(const flat_expr& expr, const tld::vector<unsigned char, 0>& varying)
+{
+    const std::uint32_t NO_NODE = flat_expr::NO_NODE;
+    std::uint32_t count = (std::uint32_t)expr.size();
+    if (count == 0)
+        return false;
+
+    // Where the value of each node is found, numbers are placed in the constants
+    tld::vector<jit_location, 0> where;
+    where.resize(count);
+    tld::vector<std::uint32_t, 0> invariant_ops;
+    tld::vector<std::uint32_t, 0> varying_ops;
+    for (std::uint32_t i = 0; i < count; i++) {
+        switch (expr.type(i)) {
+        case INT:
+            where[i] = jit_location{REG_R12, (std::int32_t)(8 * constants_.size())};
+            constants_.push_back((double)expr.value(i).integer);
+            break;
+        case FRAC:
+            where[i] = jit_location{REG_R12, (std::int32_t)(8 * constants_.size())};
+            constants_.push_back(expr.value(i).frac);
+            break;
+        case VAR:
+            where[i] = jit_location{REG_RSP, 0};
+            break;
+        case PAR:
+            if (expr.value(i).integer > 0x0fffffffL)
+                return false;
+            where[i] = jit_location{REG_RBX, (std::int32_t)(8 * expr.value(i).integer)};
+            break;
+        case OP:
+            if (varying[i])
+                varying_ops.push_back(i);
+            else
+                invariant_ops.push_back(i);
+            break;
+        case EMPTY:
+        default:
+            where[i] = jit_location{REG_R12, (std::int32_t)(8 * constants_.size())};
+            constants_.push_back(0.0);
+            break;
+        }
+    }
+
+    // Indices in values of parameters and operations passed to the second function
+    tld::vector<std::int32_t, 0> outputs;
+    outputs.resize(count);
+    for (std::uint32_t i = 0; i < count; i++)
+        outputs[i] = -1;
+    std::int32_t passed = 0;
+    auto pass = [&](std::uint32_t node) {
+        if (node != NO_NODE && !varying[node] && outputs[node] < 0
+            && (expr.type(node) == PAR || expr.type(node) == OP))
+            outputs[node] = passed++;
+    };
+    for (std::size_t k = 0; k < varying_ops.size(); k++) {
+        pass(expr.left(varying_ops[k]));
+        pass(expr.right(varying_ops[k]));
+    }
+    pass(count - 1);
+
+    // Most nodes take one or two instructions of 9 bytes
+    jit_assembler as(16 * (std::size_t)count + 128);
+    std::size_t frame_at = 0;
+    std::size_t constants_at = 0;
+    std::uint64_t constants = (std::uint64_t)(std::uintptr_t)constants_.data();
+
+    Prologue(as, true, frame_at, constants_at);
+    as.patch(constants_at, constants, 8);
+    for (std::uint32_t i = 0; i < count; i++) {
+        if (outputs[i] >= 0 && expr.type(i) == PAR) {
+            as.sse(SSE_LOAD, 0, where[i]);
+            as.sse(SSE_STORE, 0, jit_location{REG_R13, 8 * outputs[i]});
+        }
+    }
+    jit_lowering prepare(expr, as, where);
+    if (!prepare.lower(invariant_ops, outputs.data()))
+        return false;
+    Epilogue(as, true, frame_at, prepare.slots());
+
+    // The second function starts at 16 bytes boundary, padded with int3
+    while (as.code().size() % 16 != 0)
+        as.bytes({0xcc});
+    std::size_t entry_at = as.code().size();
+    for (std::uint32_t i = 0; i < count; i++)
+        if (outputs[i] >= 0)
+            where[i] = jit_location{REG_RBX, 8 * outputs[i]};
+    Prologue(as, false, frame_at, constants_at);
+    as.patch(constants_at, constants, 8);
+    // movsd [rsp], xmm0
+    as.sse(SSE_STORE, 0, jit_location{REG_RSP, 0});
+    jit_lowering entry(expr, as, where);
+    if (!entry.lower(varying_ops, nullptr))
+        return false;
+    entry.load(0, count - 1);
+    Epilogue(as, false, frame_at, entry.slots());
+
+    const tld::vector<unsigned char, 0>& code = as.code();
+    void* buffer = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED)
+        return false;
+    std::memcpy(buffer, code.data(), code.size());
+    if (mprotect(buffer, code.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(buffer, code.size());
+        return false;
+    }
+    code_ = buffer;
+    code_size_ = code.size();
+    values_.resize((std::size_t)passed);
+    prepare_ = reinterpret_cast<void (*)(const double*, double*)>(buffer);
+    entry_ = reinterpret_cast<double (*)(double, const double*)>((unsigned char*)buffer + entry_at);
+    return true;
+}
+#else
+bool jit_function::compile(const flat_expr& expr, const tld::vector<unsigned char, 0>& varying)
+{
+    (void)expr;
+    (void)varying;
+    return false;
+}
+#endif
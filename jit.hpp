@@ -0,0 +1,88 @@
+#ifndef ACRAM_JIT_HPP
+#define ACRAM_JIT_HPP
+
+#include "flat_expr.hpp"
+/**
+ * @file jit.hpp
+ * @brief compilation of expressions to native code
+ */
+
+/**
+ * @brief Expression compiled to machine code at run time
+ * @details Nodes that do not depend on the variable are calculated once
+ * by @p setParameters, so that sweeping the variable with fixed parameters
+ * costs only the nodes that depend on it.
+ *
+ * On x86-64 both parts are translated to SSE2 scalar code in an executable
+ * buffer: intermediate results are kept in a stack frame whose slots
+ * are reused once their values are no longer needed, arithmetic and square
+ * roots are inlined and other functions are called from the C library.
+ * The buffer is writable only while code is written to it.
+ *
+ * On other architectures, or if executable memory can't be obtained,
+ * the same split is evaluated by @p flat_expr, @p native tells which way is used.
+ */
+class jit_function
+{
+    // Expression for the interpreter, empty if native code is used
+    flat_expr expr_;
+    // Nodes of the interpreter that depend on the variable and the other ones
+    tld::vector<std::uint32_t, 0> varying_;
+    tld::vector<std::uint32_t, 0> invariant_;
+    // Values of numbers used by the code
+    tld::vector<double, 0> constants_;
+    // Values that do not depend on the variable, of all nodes for the interpreter
+    tld::vector<double, 0> values_;
+    // Number of operations calculated by setParameters
+    std::size_t hoisted_;
+    // Executable buffer and its size
+    void* code_;
+    std::size_t code_size_;
+    void (*prepare_)(const double* params, double* values);
+    double (*entry_)(double x, const double* values);
+
+public:
+    jit_function() = delete;
+
+    /**
+     * @brief Compile an expression
+     * @param expr expression, it is not referred to after construction
+     */
+    explicit jit_function(const flat_expr& expr);
+
+    jit_function(const jit_function& that) = delete;
+    jit_function(jit_function&& that) = delete;
+    jit_function& operator =(const jit_function& that) = delete;
+    jit_function& operator =(jit_function&& that) = delete;
+
+    /// Releases the executable buffer
+    ~jit_function();
+
+    /**
+     * @brief Calculate subexpressions that do not depend on the variable
+     * @param params values of parameters indexed by symbol ids
+     * @details Must be called before @p evaluate and whenever parameters change
+     */
+    void setParameters(const double* params);
+
+    /**
+     * @brief Calculate value of the expression with the last parameters given
+     * @param x value of the variable
+     */
+    double evaluate(double x);
+
+    /// Tell whether native code is used
+    bool native() const;
+
+    /// Get number of operations that do not depend on the variable
+    std::size_t hoisted() const;
+
+    /// Get size of the native code in bytes, zero if it is not used
+    std::size_t codeSize() const;
+
+private:
+    // Translate expression to machine code, return false if it is not supported
+    bool compile(const flat_expr& expr, const tld::vector<unsigned char, 0>& varying);
+};
+
+#endif // ACRAM_JIT_HPP
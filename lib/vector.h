@@ -1,16 +1,25 @@
 #ifndef TLD_VECTOR_H
 #define TLD_VECTOR_H
+#include <cstddef>
+#include <new>
+#include <type_traits>
 #include <utility>
 
 namespace tld {
 /**
  * @brief A random-access container with automatically allocated memory
  * @tparam T data type stored in vector
+ * @tparam N number of elements stored inside the vector itself, without allocation
+ * @details Elements live in raw storage and are constructed in place, so reserved
+ * but unused slots are never constructed. Up to @p N elements are kept
+ * in a buffer inside the object, an empty vector allocates nothing.
+ * Elements are moved rather than copied when storage grows.
  */
-template <typename T>
+template <typename T, std::size_t N = 4>
 class vector
 {
-const std::size_t DEFAULT_CAPACITY = 16UL;
+/// Capacity of the first heap buffer
+static constexpr std::size_t MIN_HEAP_CAPACITY = 8UL;
 
 /**
  * @brief This structure is thrown as an exception when trying to access not allocated memory using at() method
@@ -27,13 +36,15 @@ private:
     T* m_data_;
     std::size_t size_;
     std::size_t capacity_;
+    // Storage for the first N elements
+    alignas(T) unsigned char inline_[N > 0 ? N * sizeof(T) : 1];
 
 public:
-    /// @brief Constructs vector with some pre-allocated space and default values
-    vector();
+    /// @brief Constructs empty vector, no memory is allocated
+    vector() noexcept;
 
     /**
-     * @brief Creates vector with specified preallocated space and default values
+     * @brief Creates empty vector with specified preallocated space
      * @param capacity initial vector capacity
      */
     explicit vector(std::size_t capacity);
@@ -46,12 +57,12 @@ public:
 
     /**
      * @brief Move constructor
-     * @param that source object
+     * @param that source object, left empty
      */
-    vector(vector&& that) noexcept;
+    vector(vector&& that) noexcept(std::is_nothrow_move_constructible<T>::value);
 
     /**
-     * @brief Frees all allocated memory
+     * @brief Destructs all elements and frees all allocated memory
      */
     ~vector();
 
@@ -63,9 +74,9 @@ public:
 
     /**
      * @brief Move assignment operator
-     * @param that source object
+     * @param that source object, left empty
      */
-    vector& operator =(vector&& that) noexcept;
+    vector& operator =(vector&& that) noexcept(std::is_nothrow_move_constructible<T>::value);
 
     /**
      * @brief Fast random access operator without boundary check
@@ -101,11 +112,25 @@ public:
     void clear();
 
     /**
-     * @brief Place new element at the end of the vector
+     * @brief Place copy of an element at the end of the vector
      * @param elem new value
      */
     void push_back(const T& elem);
 
+    /**
+     * @brief Move an element to the end of the vector
+     * @param elem new value
+     */
+    void push_back(T&& elem);
+
+    /**
+     * @brief Construct new element in place at the end of the vector
+     * @param args arguments passed to the constructor of the element
+     * @return Reference to the new element
+     */
+    template <typename... Args>
+    T& emplace_back(Args&&... args);
+
     /**
      * @brief Remove the last element from vector (caling its destructor)
      */
@@ -127,186 +152,265 @@ public:
     void reserve(std::size_t new_capacity);
 
     /**
-     * @brief Change size of the vector. Elements that do not fit into new size will be destructed,
-     * but capacity will not be reduced.
+     * @brief Change size of the vector. New elements are value-initialized, elements that
+     * do not fit into new size will be destructed, but capacity will not be reduced.
      * @param new_size
      */
     void resize(std::size_t new_size);
 
-    /// Make capacity equal to the size of the vector
+    /// Make capacity equal to the size of the vector, or return elements to the inline buffer
     void shrink();
+
+private:
+    // Get address of the inline buffer
+    T* inlineData() noexcept;
+
+    // Tell whether elements are stored on the heap
+    bool onHeap() const noexcept;
+
+    // Move elements to a new buffer of given capacity, which may be the inline one
+    void relocate(T* new_data, std::size_t new_capacity);
+
+    // Destruct elements and free heap buffer, leaving the vector empty and inline
+    void release() noexcept;
+
+    // Take elements of another vector, which is left empty
+    void take(vector& that);
 };
 
-template <typename T>
-vector<T>::vector() :
-    m_data_(new T[DEFAULT_CAPACITY]),
+template <typename T, std::size_t N>
+vector<T, N>::vector() noexcept :
+    m_data_(inlineData()),
     size_(0),
-    capacity_(DEFAULT_CAPACITY)
+    capacity_(N)
 {}
 
-template <typename T>
-vector<T>::vector(std::size_t capacity) :
-    m_data_(new T[capacity]),
-    size_(0),
-    capacity_(capacity)
-{}
+template <typename T, std::size_t N>
+vector<T, N>::vector(std::size_t capacity) :
+    vector()
+{
+    reserve(capacity);
+}
 
-template <typename T>
-vector<T>::vector(const vector<T>& that) :
-    m_data_(new T[that.capacity_]),
-    size_(that.size_),
-    capacity_(that.capacity_)
+template <typename T, std::size_t N>
+vector<T, N>::vector(const vector<T, N>& that) :
+    vector()
 {
-    for (std::size_t i = 0; i < size_; i++)
-        m_data_[i] = that.m_data_[i];
+    reserve(that.size_);
+    for (std::size_t i = 0; i < that.size_; i++) {
+        new (m_data_ + i) T(that.m_data_[i]);
+        size_++;
+    }
 }
 
-template <typename T>
-vector<T>::vector(vector<T>&& that) noexcept:
-    m_data_(that.m_data_),
-    size_(that.size_),
-    capacity_(that.capacity_)
+template <typename T, std::size_t N>
+vector<T, N>::vector(vector<T, N>&& that) noexcept(std::is_nothrow_move_constructible<T>::value) :
+    vector()
 {
-    that.m_data_ = nullptr;
-    that.size_ = 0;
-    that.capacity_ = 0;
+    take(that);
 }
 
-template <typename T>
-vector<T>::~vector()
+template <typename T, std::size_t N>
+vector<T, N>::~vector()
 {
-    delete[] m_data_;
+    release();
 }
 
-template <typename T>
-vector<T>& vector<T>::operator =(const vector<T>& that)
+template <typename T, std::size_t N>
+vector<T, N>& vector<T, N>::operator =(const vector<T, N>& that)
 {
     if (this == &that)
         return *this;
-    delete[] this->m_data_;
-    this->m_data_ = new T[that.capacity_];
-    this->capacity_ = that.capacity_;
-    this->size_ = that.size_;
-    for (std::size_t i = 0; i < size_; i++)
-        this->m_data_[i] = that.m_data_[i];
+    while (size_ > 0)
+        pop_back();
+    reserve(that.size_);
+    for (std::size_t i = 0; i < that.size_; i++) {
+        new (m_data_ + i) T(that.m_data_[i]);
+        size_++;
+    }
     return *this;
 }
 
-template <typename T>
-vector<T>& vector<T>::operator =(vector<T>&& that) noexcept
+template <typename T, std::size_t N>
+vector<T, N>& vector<T, N>::operator =(vector<T, N>&& that) noexcept(std::is_nothrow_move_constructible<T>::value)
 {
-    delete[] this->m_data_;
-    this->m_data_ = that.m_data_;
-    this->capacity_ = that.capacity_;
-    this->size_ = that.size_;
-    that.m_data_ = nullptr;
+    if (this == &that)
+        return *this;
+    release();
+    take(that);
     return *this;
 }
 
-template <typename T>
-bool vector<T>::empty() const
+template <typename T, std::size_t N>
+T* vector<T, N>::inlineData() noexcept
+{
+    return reinterpret_cast<T*>(inline_);
+}
+
+template <typename T, std::size_t N>
+bool vector<T, N>::onHeap() const noexcept
+{
+    return m_data_ != reinterpret_cast<const T*>(inline_);
+}
+
+template <typename T, std::size_t N>
+void vector<T, N>::relocate(T* new_data, std::size_t new_capacity)
+{
+    for (std::size_t i = 0; i < size_; i++) {
+        new (new_data + i) T(std::move_if_noexcept(m_data_[i]));
+        m_data_[i].~T();
+    }
+    if (onHeap())
+        ::operator delete(m_data_);
+    m_data_ = new_data;
+    capacity_ = new_capacity;
+}
+
+template <typename T, std::size_t N>
+void vector<T, N>::release() noexcept
+{
+    for (std::size_t i = 0; i < size_; i++)
+        m_data_[i].~T();
+    if (onHeap())
+        ::operator delete(m_data_);
+    m_data_ = inlineData();
+    size_ = 0;
+    capacity_ = N;
+}
+
+template <typename T, std::size_t N>
+void vector<T, N>::take(vector<T, N>& that)
+{
+    if (that.onHeap()) {
+        m_data_ = that.m_data_;
+        size_ = that.size_;
+        capacity_ = that.capacity_;
+        that.m_data_ = that.inlineData();
+        that.size_ = 0;
+        that.capacity_ = N;
+        return;
+    }
+    for (std::size_t i = 0; i < that.size_; i++) {
+        new (m_data_ + i) T(std::move(that.m_data_[i]));
+        size_++;
+    }
+    that.release();
+}
+
+template <typename T, std::size_t N>
+bool vector<T, N>::empty() const
 {
     return (size_ == 0);
 }
 
-template <typename T>
-std::size_t vector<T>::capacity() const
+template <typename T, std::size_t N>
+std::size_t vector<T, N>::capacity() const
 {
     return capacity_;
 }
 
-template <typename T>
-std::size_t vector<T>::size() const
+template <typename T, std::size_t N>
+std::size_t vector<T, N>::size() const
 {
     return size_;
 }
 
-template <typename T>
-void vector<T>::reserve(std::size_t new_capacity)
+template <typename T, std::size_t N>
+void vector<T, N>::reserve(std::size_t new_capacity)
 {
     if (this->capacity_ >= new_capacity)
         return;
-    T* temp_buf = new T[new_capacity];
-    for (std::size_t i = 0; i < size_; i++)
-        temp_buf[i] = std::move(m_data_[i]);
-    delete[] m_data_;
-    m_data_ = temp_buf;
-    capacity_ = new_capacity;
+    relocate(static_cast<T*>(::operator new(new_capacity * sizeof(T))), new_capacity);
 }
 
-template <typename T>
-void vector<T>::resize(std::size_t new_size)
+template <typename T, std::size_t N>
+void vector<T, N>::resize(std::size_t new_size)
 {
     if (capacity_ < new_size)
         reserve(new_size);
-    if (new_size < size_)
-        for (std::size_t i = new_size; i < size_; i++)
-            m_data_[i].~T();
-    size_ = new_size;
+    while (size_ < new_size) {
+        new (m_data_ + size_) T();
+        size_++;
+    }
+    while (size_ > new_size)
+        pop_back();
+}
+
+template <typename T, std::size_t N>
+void vector<T, N>::push_back(const T& elem)
+{
+    emplace_back(elem);
 }
 
-template <typename T>
-void vector<T>::push_back(const T& elem)
+template <typename T, std::size_t N>
+void vector<T, N>::push_back(T&& elem)
 {
-    if (capacity_ == 0) {
-        reserve(DEFAULT_CAPACITY);
-    } else if (size_ == capacity_) {
-        reserve(capacity_ * 2);
+    emplace_back(std::move(elem));
+}
+
+template <typename T, std::size_t N>
+template <typename... Args>
+T& vector<T, N>::emplace_back(Args&&... args)
+{
+    if (size_ == capacity_) {
+        // Arguments may refer to elements of this vector, so the new one is built before growing
+        T elem(std::forward<Args>(args)...);
+        reserve(capacity_ * 2 < MIN_HEAP_CAPACITY ? MIN_HEAP_CAPACITY : capacity_ * 2);
+        new (m_data_ + size_) T(std::move(elem));
+    } else {
+        new (m_data_ + size_) T(std::forward<Args>(args)...);
     }
-    m_data_[size_++] = elem;
+    return m_data_[size_++];
 }
 
-template <typename T>
-T& vector<T>::at(std::size_t pos)
+template <typename T, std::size_t N>
+T& vector<T, N>::at(std::size_t pos)
 {
     if (pos >= size_)
         throw out_of_range(capacity_, pos);
     return m_data_[pos];
 }
 
-template <typename T>
-const T& vector<T>::at(std::size_t pos) const
+template <typename T, std::size_t N>
+const T& vector<T, N>::at(std::size_t pos) const
 {
     if (pos >= size_)
         throw out_of_range(capacity_, pos);
     return m_data_[pos];
 }
 
-template <typename T>
-T& vector<T>::operator [](std::size_t pos) noexcept
+template <typename T, std::size_t N>
+T& vector<T, N>::operator [](std::size_t pos) noexcept
 {
     return m_data_[pos];
 }
 
-template <typename T>
-const T& vector<T>::operator [](std::size_t pos) const noexcept
+template <typename T, std::size_t N>
+const T& vector<T, N>::operator [](std::size_t pos) const noexcept
 {
     return m_data_[pos];
 }
 
-template <typename T>
-T* vector<T>::data()
+template <typename T, std::size_t N>
+T* vector<T, N>::data()
 {
     return m_data_;
 }
 
-template <typename T>
-const T* vector<T>::data() const
+template <typename T, std::size_t N>
+const T* vector<T, N>::data() const
 {
     return m_data_;
 }
 
-template <typename T>
-void vector<T>::clear()
+template <typename T, std::size_t N>
+void vector<T, N>::clear()
 {
-    delete[] m_data_;
-    m_data_ = nullptr;
-    size_ = 0;
-    capacity_ = 0;
+    release();
 }
 
-template <typename T>
-void vector<T>::pop_back()
+template <typename T, std::size_t N>
+void vector<T, N>::pop_back()
 {
     if (size_ > 0) {
         m_data_[size_ - 1].~T();
@@ -314,17 +418,15 @@ void vector<T>::pop_back()
     }
 }
 
-template <typename T>
-void vector<T>::shrink()
+template <typename T, std::size_t N>
+void vector<T, N>::shrink()
 {
-    if (capacity_ == size_)
+    if (!onHeap() || capacity_ == size_)
         return;
-    T* temp_buf = new T[size_];
-    for (std::size_t i = 0; i < size_; i++)
-        temp_buf[i] = m_data_[i];
-    delete[] m_data_;
-    m_data_ = temp_buf;
-    capacity_ = size_;
+    if (size_ <= N)
+        relocate(inlineData(), N);
+    else
+        relocate(static_cast<T*>(::operator new(size_ * sizeof(T))), size_);
 }
 
 } // namespace tld
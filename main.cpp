@@ -1,51 +1,419 @@
 #include "common.hpp"
 #include "parser.hpp"
 #include "texio.hpp"
+#include "options.hpp"
+#include "cache.hpp"
+#include "stats.hpp"
+#include "csource.hpp"
+#include "flat_expr.hpp"
+#include "egraph.hpp"
+#include "taylor.hpp"
+#include "partials.hpp"
+#include <cmath>
 #include <stdexcept>
+#include <thread>
 /**
  * @file main.cpp
  * @brief functions for main control logic of the program
  */
 
-/// Return initial text of LaTeX document with randomly chosen splash phrase
-std::string Header()
+/// State shared by all stages of a run
+struct acram_session
+{
+    acram_options options;
+    // Cache of processed functions
+    derivative_cache cache;
+    // Cache of compiled documents
+    pdf_cache pdfs;
+    // C functions of processed functions, used if C source is requested
+    c_emitter emitter;
+    // Numbers substituted for parameters, by symbol ids
+    std::unordered_map<std::uint32_t, double> bindings;
+
+public:
+    acram_session(const acram_options& _options) :
+        options(_options),
+        cache(_options.cache_dir, _options.cache_limit),
+        pdfs(_options.cache_dir.empty() ? fs::path() : _options.cache_dir / "pdf", _options.cache_limit),
+        emitter(),
+        bindings()
+    {
+        for (const auto& binding: options.bindings)
+            bindings[InternSymbol(binding.first)] = binding.second;
+    }
+};
+
+/// Estimated width of a line of formulas in em, used by the fast layout
+const double LINE_WIDTH = 30.0;
+
+/// Return LaTeX preamble up to the beginning of the document body
+std::string Preamble(const acram_options& opts)
 {
     return
     "\\documentclass[12pt]{article}\n"
     "\\usepackage[russian]{babel}\n"
-    "\\usepackage{amsmath}\n"
-    "\\usepackage{breqn}\n"
+    "\\usepackage{amsmath}\n" +
+    std::string(opts.fast_layout ? "" : "\\usepackage{breqn}\n") +
     "\\DeclareMathOperator{\\arccot}{arccot}\n"
     "\\pagestyle{empty}\n"
-    "\\begin{document}\n"
+    "\\begin{document}\n";
+}
+
+/// Return title of LaTeX document with given splash phrase
+std::string Title(const std::string& splash)
+{
+    return
     "\\begin{center}\n"
-    "{\\Large " + Splash() + "}\n"
+    "{\\Large " + splash + "}\n"
     "\\end{center}\n";
 }
 
+/// Return initial text of LaTeX document with given splash phrase
+std::string Header(const std::string& splash, const acram_options& opts)
+{
+    return Preamble(opts) + Title(splash);
+}
+
+/**
+ * @brief Choose splash phrase for a document
+ * @details The splash phrase is random, unless caching is on: then it is chosen
+ * by the body, so that the same functions always give byte-identical documents
+ */
+std::string ChooseSplash(const std::string& body, const acram_session& session)
+{
+    if (session.pdfs.enabled())
+        return Splash((unsigned)Fnv1a(body));
+    else
+        return Splash();
+}
+
+/**
+ * @brief Concatenate a range of document sections
+ * @param sections LaTeX code produced for each function
+ * @param begin index of the first section
+ * @param end index after the last section
+ */
+std::string JoinSections(const tld::vector<std::string>& sections, std::size_t begin, std::size_t end)
+{
+    std::string body;
+    for (std::size_t i = begin; i < end; i++)
+        body += sections[i];
+    return body;
+}
+
+/**
+ * @brief Get LaTeX environment with a formula
+ * @param lhs left-hand side of the formula
+ * @param lines right-hand side split into lines
+ * @param opts options of the run
+ */
+std::string Formula(const std::string& lhs, const tld::vector<std::string>& lines, const acram_options& opts)
+{
+    if (!opts.fast_layout)
+        return "\\begin{dmath*}\n" + lhs + "=" + lines[0] + "\\end{dmath*}\n";
+    if (lines.size() == 1)
+        return "\\begin{equation*}\n" + lhs + "=" + lines[0] + "\n\\end{equation*}\n";
+    std::string output = "\\begin{align*}\n" + lhs + "&=" + lines[0];
+    for (std::size_t i = 1; i < lines.size(); i++)
+        output += "\\\\\n&\\quad " + lines[i];
+    return output + "\n\\end{align*}\n";
+}
+
+/**
+ * @brief Get LaTeX equation defining a function
+ * @param tree expression of the function
+ * @param opts options of the run
+ * @details By default @p dmath* environment is used, which breaks lines by itself.
+ * In fast layout, lines are broken in advance at top-level '+' and '-' by estimated
+ * widths, and plain @p equation* or @p align* environment is used, which is much
+ * cheaper for pdflatex. Abbreviated subexpressions are defined after the equation.
+ */
+std::string Equation(expr_tree& tree, const acram_options& opts)
+{
+    std::string lhs = tree.getName() + '(' + tree.getVars() + ')';
+    tex_options tex_opts;
+    tex_opts.abbreviation_size = opts.abbreviation_size;
+    if (opts.fast_layout) {
+        tex_opts.fixed_parentheses = true;
+        tex_opts.line_width = LINE_WIDTH;
+    }
+    std::string output = Formula(lhs, tree.toTexLines(tex_opts, lhs.size() * 0.5 + 1.3), opts);
+    const tld::vector<tex_abbreviation>& abbreviations = tree.abbreviations();
+    if (abbreviations.empty())
+        return output;
+    output += "\\noindent where\n";
+    for (std::size_t i = 0; i < abbreviations.size(); i++)
+        output += Formula(abbreviations[i].name, abbreviations[i].lines, opts);
+    return output;
+}
+
+/**
+ * @brief Get LaTeX equation with a matrix of expressions
+ * @param lhs left-hand side of the equation
+ * @param entries expressions by rows
+ * @param columns number of columns
+ * @details An array is used, since matrix environments are limited to 10 columns
+ */
+std::string MatrixEquation(const std::string& lhs, const tld::vector<expr_tree*>& entries, std::size_t columns)
+{
+    std::string output = "\\begin{equation*}\n" + lhs + "=\\left(\\begin{array}{" + std::string(columns, 'c') + "}\n";
+    for (std::size_t i = 0; i < entries.size(); i++) {
+        output += entries[i]->toTex();
+        if (i + 1 == entries.size())
+            output += "\n";
+        else
+            output += ((i + 1) % columns == 0) ? "\\\\\n" : " & ";
+    }
+    return output + "\\end{array}\\right)\n\\end{equation*}\n";
+}
+
+/**
+ * @brief Get LaTeX equation with the Taylor polynomial of a function
+ * @param function expression of the function, without unbound parameters
+ * @param opts options of the run, set the order and the point
+ * @details Empty string is returned and the reason is printed if the function
+ * has parameters without values or is not differentiable at the point
+ */
+std::string TaylorEquation(expr_tree& function, const acram_options& opts)
+{
+    if (!function.parameters().empty()) {
+        std::cout << "Acram: Taylor polynomial of " << function.getName()
+            << " needs values of all parameters, see --bind" << std::endl;
+        return std::string();
+    }
+    tld::vector<double, 0> coefficients;
+    coefficients.resize(opts.taylor_order + 1);
+    function.taylor(opts.taylor_point, nullptr, opts.taylor_order, coefficients.data());
+    for (std::size_t i = 0; i < coefficients.size(); i++) {
+        if (!std::isfinite(coefficients[i])) {
+            std::cout << "Acram: Taylor polynomial of " << function.getName() << " is undefined at "
+                << function.getVar() << " = " << opts.taylor_point << std::endl;
+            return std::string();
+        }
+    }
+    std::string name = "T_{" + std::to_string(opts.taylor_order) + "}" + function.getName();
+    expr_node* root = TaylorPolynomial(coefficients.data(), opts.taylor_order, opts.taylor_point, function.variable());
+    expr_tree polynomial(root, function.parameters(), function.variable(), name);
+    return Equation(polynomial, opts);
+}
+
+/**
+ * @brief Get a copy of an expression rewritten for cheaper evaluation, see @p flat_expr::optimize
+ * @param tree expression to rewrite
+ * @param cost estimated cost of the expression is added to it
+ * @param optimized_cost estimated cost of the copy is added to it
+ */
+expr_tree Optimized(const expr_tree& tree, double& cost, double& optimized_cost)
+{
+    flat_expr flat(tree.root());
+    cost += flat.cost();
+    flat.optimize();
+    optimized_cost += flat.cost();
+    return expr_tree(flat.toTree(), tree.parameters(), tree.variable(), tree.getName(), tree.variables());
+}
+
+/**
+ * @brief Get a copy of an expression rewritten for cheaper evaluation
+ * @details Estimated costs before and after rewriting are printed, see @p flat_expr::optimize
+ */
+expr_tree ForEvaluation(const expr_tree& tree)
+{
+    double cost = 0.0, optimized_cost = 0.0;
+    expr_tree optimized = Optimized(tree, cost, optimized_cost);
+    std::cout << "Acram: evaluation cost of " << tree.getName() << ": "
+        << cost << " -> " << optimized_cost << " flops" << std::endl;
+    return optimized;
+}
+
+/// Get tree extracted from a class of e-graph with the names of another tree
+expr_tree Extracted(const expr_egraph& graph, std::uint32_t cls, int goal, const expr_tree& like)
+{
+    return expr_tree(graph.extract(cls, goal), like.parameters(), like.variable(), like.getName(), like.variables());
+}
+
+/**
+ * @brief Get LaTeX with a function of one variable and its derivative
+ * @param function the function after the semantic check
+ * @param session state of the run, C source is emitted to it if requested
+ * @param serialized receives the serialized derivative for the cache
+ */
+std::string DerivativeTex(expr_tree& function, acram_session& session, std::string& serialized)
+{
+    std::string tex;
+    bool emit_c = !session.options.c_path.empty();
+    STATS_TIMER(derive_timer, PHASE_DERIVE);
+    auto derivative = function.derivative();
+    // Numbers that differentiation puts next to bound values are calculated too
+    if (!session.bindings.empty())
+        derivative.bind(session.bindings);
+    STATS_STOP(derive_timer);
+    STATS_COUNT(COUNTER_DERIVED_NODES, derivative.size());
+    STATS_TIMER(simplify_timer, PHASE_SIMPLIFY);
+    derivative.simplify();
+    STATS_STOP(simplify_timer);
+    STATS_COUNT(COUNTER_SIMPLIFIED_NODES, derivative.size());
+    // The smallest form is shown, the cheapest one is compiled
+    expr_tree cheapest;
+    if (session.options.saturate) {
+        STATS_TIMER(saturate_timer, PHASE_SATURATE);
+        std::size_t simplified_size = derivative.size();
+        expr_egraph graph;
+        std::uint32_t root = graph.add(derivative.root());
+        graph.saturate(session.options.saturation);
+        if (emit_c)
+            cheapest = Extracted(graph, root, EXTRACT_COST, derivative);
+        derivative = Extracted(graph, root, EXTRACT_SIZE, derivative);
+        STATS_STOP(saturate_timer);
+        STATS_COUNT(COUNTER_SATURATED_NODES, derivative.size());
+        std::cout << "Acram: saturation of " << derivative.getName() << ": " << simplified_size
+            << " -> " << derivative.size() << " nodes, " << graph.size() << " in e-graph" << std::endl;
+    }
+    std::string taylor_tex;
+    if (session.options.taylor_order > 0) {
+        STATS_TIMER(taylor_timer, PHASE_TAYLOR);
+        taylor_tex = TaylorEquation(function, session.options);
+        STATS_STOP(taylor_timer);
+    }
+    STATS_TIMER(emit_timer, PHASE_EMIT);
+    tex += Equation(function, session.options);
+    tex += Equation(derivative, session.options);
+    tex += taylor_tex;
+    if (emit_c) {
+        std::string name = function.getName();
+        expr_tree fast_function = ForEvaluation(function);
+        expr_tree fast_derivative = ForEvaluation(cheapest.root() ? cheapest : derivative);
+        session.emitter.add(fast_function, session.emitter.uniqueName(name));
+        session.emitter.add(fast_derivative, session.emitter.uniqueName(name + "'"));
+        tld::vector<const expr_tree*> group;
+        group.push_back(&fast_function);
+        group.push_back(&fast_derivative);
+        session.emitter.addGroup(group, session.emitter.uniqueName(name + "_all"));
+    }
+    STATS_STOP(emit_timer);
+    serialized = derivative.serialize();
+    return tex;
+}
+
+/**
+ * @brief Get LaTeX with a function of several variables, its Jacobian and Hessian
+ * @param function the function after the semantic check
+ * @param session state of the run, C source is emitted to it if requested
+ * @param serialized receives serialized entries of the Jacobian for the cache
+ * @details In C source the Jacobian and the Hessian are computed by one function each
+ * that stores entries by rows, so subexpressions common to entries are computed once.
+ * Entries below the diagonal of the Hessian are the same trees as those above it.
+ */
+std::string PartialsTex(expr_tree& function, acram_session& session, std::string& serialized)
+{
+    STATS_TIMER(derive_timer, PHASE_DERIVE);
+    expr_partials partials(function);
+    STATS_STOP(derive_timer);
+    STATS_COUNT(COUNTER_SIMPLIFIED_NODES, partials.nodes());
+    std::size_t count = partials.size();
+    std::cout << "Acram: partial derivatives of " << function.getName() << ": " << partials.zeros()
+        << " of " << count * (count + 3) / 2 << " are zero by structure" << std::endl;
+    if (session.options.taylor_order > 0)
+        std::cout << "Acram: Taylor polynomials are calculated for functions of one variable only" << std::endl;
+    STATS_TIMER(emit_timer, PHASE_EMIT);
+    tld::vector<expr_tree*> jacobian, hessian;
+    for (std::size_t i = 0; i < count; i++)
+        jacobian.push_back(&partials.jacobian(i));
+    for (std::size_t i = 0; i < count; i++)
+        for (std::size_t j = 0; j < count; j++)
+            hessian.push_back(&partials.hessian(i, j));
+    std::string args = '(' + function.getVars() + ')';
+    std::string tex = Equation(function, session.options);
+    tex += MatrixEquation("J_{" + function.getName() + "}" + args, jacobian, count);
+    tex += MatrixEquation("H_{" + function.getName() + "}" + args, hessian, count);
+    if (!session.options.c_path.empty()) {
+        std::string name = function.getName();
+        session.emitter.add(ForEvaluation(function), session.emitter.uniqueName(name));
+        double cost = 0.0, optimized_cost = 0.0;
+        tld::vector<expr_tree> fast_jacobian, fast_hessian;
+        for (std::size_t i = 0; i < count; i++)
+            fast_jacobian.push_back(Optimized(partials.jacobian(i), cost, optimized_cost));
+        for (std::size_t i = 0; i < count; i++)
+            for (std::size_t j = i; j < count; j++)
+                fast_hessian.push_back(Optimized(partials.hessian(i, j), cost, optimized_cost));
+        std::cout << "Acram: evaluation cost of partial derivatives of " << function.getName() << ": "
+            << cost << " -> " << optimized_cost << " flops" << std::endl;
+        tld::vector<const expr_tree*> group;
+        for (std::size_t i = 0; i < count; i++)
+            group.push_back(&fast_jacobian[i]);
+        session.emitter.addGroup(group, session.emitter.uniqueName(name + "_jacobian"));
+        group.clear();
+        for (std::size_t i = 0; i < count; i++) {
+            for (std::size_t j = 0; j < count; j++) {
+                // Upper triangle is stored by rows
+                std::size_t row = std::min(i, j), column = std::max(i, j);
+                group.push_back(&fast_hessian[row * count - row * (row - 1) / 2 + (column - row)]);
+            }
+        }
+        session.emitter.addGroup(group, session.emitter.uniqueName(name + "_hessian"));
+    }
+    STATS_STOP(emit_timer);
+    for (std::size_t i = 0; i < count; i++)
+        serialized += (i > 0 ? " " : "") + partials.jacobian(i).serialize();
+    return tex;
+}
+
 /**
  * @brief Parse string with a function and append it and it's derivative in LaTeX format to another string
  * @param func_str string to parse
  * @param output_ss where to append data
+ * @param session state of the run, its cache is consulted before processing
  * @return Zero on success or non-zero error code
  */
-int ProcessFunction(const std::string& func_str, std::string& output_ss)
+int ProcessFunction(const std::string& func_str, std::string& output_ss, acram_session& session)
 {
+    derivative_cache& cache = session.cache;
+    std::string options_key = OptionsKey(session.options);
+    std::string tex;
+    STATS_TIMER(function_timer, PHASE_FUNCTION);
+    STATS_DESCRIBE(function_timer, func_str);
+    STATS_COUNT(COUNTER_FUNCTIONS, 1);
+    STATS_TIMER(cache_timer, PHASE_CACHE);
+    // Cached entries hold no trees to generate C source from
+    bool emit_c = !session.options.c_path.empty();
+    if (!emit_c && cache.lookup(func_str, options_key, tex)) {
+        STATS_STOP(cache_timer);
+        STATS_COUNT(COUNTER_CACHED, 1);
+        output_ss += tex;
+        std::cout << "Acram: function differentiated sucessfully (cached)" << std::endl;
+        return OK;
+    }
+    STATS_STOP(cache_timer);
+    auto start = std::chrono::steady_clock::now();
+    STATS_TIMER(parse_timer, PHASE_PARSE);
     expr_parser parser(func_str);
     expr_tree function = parser.read();
+    if (parser.status() == OK && !session.bindings.empty())
+        function.bind(session.bindings);
+    STATS_STOP(parse_timer);
     if (parser.status() != OK) {
+        STATS_COUNT(COUNTER_FAILED, 1);
         std::cout << "Acram: " << parser.strerror() << std::endl;
         return parser.status();
     }
+    STATS_COUNT(COUNTER_PARSED_NODES, function.size());
+    STATS_TIMER(semantics_timer, PHASE_SEMANTICS);
     function.checkSemantics();
+    STATS_STOP(semantics_timer);
     if (function.status() != OK) {
+        STATS_COUNT(COUNTER_FAILED, 1);
         std::cout << "Acram: " << function.strerror() << std::endl;
         return function.status();
     }
-    auto derivative = function.derivative();
-    derivative.simplify();
-    output_ss += "\\begin{dmath*}\n" + function.getName() + '(' + function.getVar() + ")=" + function.toTex() + "\\end{dmath*}\n";
-    output_ss += "\\begin{dmath*}\n" + derivative.getName() + '(' + derivative.getVar() + ")=" + derivative.toTex() + "\\end{dmath*}\n";
+    std::string serialized;
+    if (function.variables().size() > 1)
+        tex = PartialsTex(function, session, serialized);
+    else
+        tex = DerivativeTex(function, session, serialized);
+    STATS_COUNT(COUNTER_TEX_BYTES, tex.size());
+    output_ss += tex;
+    STATS_TIMER(store_timer, PHASE_CACHE);
+    cache.store(func_str, options_key, serialized, tex, std::chrono::steady_clock::now() - start);
+    STATS_STOP(store_timer);
     std::cout << "Acram: function differentiated sucessfully" << std::endl;
     return OK;
 }
@@ -62,6 +430,7 @@ void WriteTex(const std::string& code, const fs::path& output_filename)
     if (!output_fs.is_open())
         throw std::runtime_error("Acram: couldn't open file \"" + output_filename.string() + "\" to write TeX output");
     std::cout << "Acram: writing TeX output to \"" + output_filename.string() + "\"..." << std::endl;
+    STATS_TIMER(write_timer, PHASE_WRITE_TEX);
     output_fs.write(code.c_str(), code.size());
     if (!output_fs.good())
         throw std::runtime_error("Acram: errors occured during writing. Data may be incomplete");
@@ -75,27 +444,224 @@ bool LatexExists()
 }
 
 /**
- * Create .pdf output file from a source code string
+ * @brief Run pdflatex on a source code string
  * @param code string containing LaTeX source code
  * @param output_filename name of file to be created (without an extension)
- * @details output_filename.log and output_filename.aux files are created as
- * on usual pdflatex run
+ * @param timeout time in seconds given to pdflatex, zero means no limit
+ * @return Empty string on success or error description
+ * @details Prints nothing, so it can be run in parallel
  */
-void LatexToPdf(const std::string& code, const fs::path& output_filename)
+std::string CompilePdf(const std::string& code, const fs::path& output_filename, unsigned timeout)
 {
-    std::cout << "Acram: Converting output to pdf..." << std::endl;
-    tex_sentry tex(output_filename);
+    STATS_TIMER(pdflatex_timer, PHASE_PDFLATEX);
+    tex_sentry tex(output_filename, std::chrono::seconds(timeout));
     if (tex.getState())
-        throw std::runtime_error("Acram: couldn't run LaTeX executable");
+        return "Acram: couldn't run LaTeX executable";
     tex.transmit(code);
+    if (tex.getState() == ETIMEDOUT)
+        return "Acram: LaTeX did not finish in time and was stopped";
     if (tex.getState())
-        throw std::runtime_error("Acram: failed to transmit data to LaTeX executable");
+        return "Acram: failed to transmit data to LaTeX executable";
     tex.end();
+    if (tex.getState() == ETIMEDOUT)
+        return "Acram: LaTeX did not finish in time and was stopped";
     if (tex.getState())
-        throw std::runtime_error("Acram: LaTeX exited with bad status");
+        return "Acram: LaTeX exited with bad status";
+    return std::string();
+}
+
+/**
+ * Create .pdf output file from a source code string
+ * @param code string containing LaTeX source code
+ * @param output_filename name of file to be created (without an extension)
+ * @param session state of the run
+ * @details output_filename.log and output_filename.aux files are created as
+ * on usual pdflatex run. If the same document was compiled before,
+ * pdflatex is not run and cached pdf is taken instead
+ */
+void LatexToPdf(const std::string& code, const fs::path& output_filename, acram_session& session)
+{
+    pdf_cache& pdfs = session.pdfs;
+    fs::path pdf_path(output_filename.string() + ".pdf");
+    if (pdfs.fetch(code, pdf_path)) {
+        std::cout << "Acram: document is unchanged, output taken from cache to \"" + pdf_path.string() + "\"" << std::endl;
+        return;
+    }
+    // Output may be a link to a cached file left by a previous run, pdflatex must not overwrite it
+    std::error_code err;
+    fs::remove(pdf_path, err);
+    std::cout << "Acram: Converting output to pdf..." << std::endl;
+    std::string error = CompilePdf(code, output_filename, session.options.tex_timeout);
+    if (!error.empty())
+        throw std::runtime_error(error);
+    pdfs.store(code, pdf_path);
     std::cout << "Acram: output written successfully to \"" + output_filename.string() + ".pdf\"" << std::endl;
 }
 
+/**
+ * @brief Merge several pdf files into one using any of known local tools
+ * @param parts files to merge in the order of pages
+ * @param pdf_path path of the resulting file
+ * @return true on success, false if no tool is available or all of them failed
+ */
+bool MergePdf(const tld::vector<std::string>& parts, const std::string& pdf_path)
+{
+    tld::vector<std::string> argv;
+    if (ExecutableExists("pdfunite")) {
+        argv.push_back("pdfunite");
+        for (std::size_t i = 0; i < parts.size(); i++)
+            argv.push_back(parts[i]);
+        argv.push_back(pdf_path);
+        if (RunProcess(argv) == 0)
+            return true;
+        argv.clear();
+    }
+    if (ExecutableExists("qpdf")) {
+        argv.push_back("qpdf");
+        argv.push_back("--empty");
+        argv.push_back("--pages");
+        for (std::size_t i = 0; i < parts.size(); i++)
+            argv.push_back(parts[i]);
+        argv.push_back("--");
+        argv.push_back(pdf_path);
+        if (RunProcess(argv) == 0)
+            return true;
+        argv.clear();
+    }
+    if (ExecutableExists("gs")) {
+        argv.push_back("gs");
+        argv.push_back("-q");
+        argv.push_back("-dNOPAUSE");
+        argv.push_back("-dBATCH");
+        argv.push_back("-sDEVICE=pdfwrite");
+        argv.push_back("-sOutputFile=" + pdf_path);
+        for (std::size_t i = 0; i < parts.size(); i++)
+            argv.push_back(parts[i]);
+        if (RunProcess(argv) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Create .pdf output file compiling parts of the document in parallel
+ * @param sections LaTeX code produced for each function
+ * @param splash splash phrase of the document
+ * @param output_filename name of file to be created (without an extension)
+ * @param session state of the run, sets the number of parts
+ * @details Sections are divided into parts of roughly equal size.
+ * Each part is compiled by its own pdflatex process as "output_filename-N".
+ * Parts are merged with pdfunite, qpdf or ghostscript, whichever is found.
+ * If none of them is available, parts are left as they are and
+ * "output_filename.index" listing them in order is written.
+ */
+void LatexToPdfChunked(
+    const tld::vector<std::string>& sections,
+    const std::string& splash,
+    const fs::path& output_filename,
+    acram_session& session
+    )
+{
+    std::size_t chunks_count = std::min<std::size_t>(session.options.chunks, sections.size());
+    std::size_t total_size = 0;
+    for (std::size_t i = 0; i < sections.size(); i++)
+        total_size += sections[i].size();
+
+    // Split sections greedily so that each part gets about the same amount of code
+    tld::vector<std::string> codes, parts;
+    std::size_t begin = 0, accumulated = 0;
+    for (std::size_t chunk = 0; chunk < chunks_count; chunk++) {
+        std::size_t end = begin;
+        std::size_t target = total_size * (chunk + 1) / chunks_count;
+        // Leave at least one section for each of the remaining parts
+        std::size_t max_end = sections.size() - (chunks_count - chunk - 1);
+        do {
+            accumulated += sections[end++].size();
+        } while (end < max_end && accumulated + sections[end].size() / 2 <= target);
+        if (chunk == chunks_count - 1) {
+            while (end < sections.size())
+                accumulated += sections[end++].size();
+        }
+        std::string title = (chunk == 0) ? Title(splash) : std::string();
+        codes.push_back(Preamble(session.options) + title + JoinSections(sections, begin, end) + "\\end{document}\n");
+        parts.push_back(output_filename.string() + '-' + std::to_string(chunk + 1));
+        begin = end;
+    }
+
+    std::cout << "Acram: Converting output to pdf in " << chunks_count << " parts..." << std::endl;
+    tld::vector<std::string> errors;
+    errors.resize(chunks_count);
+    tld::vector<std::thread> workers(chunks_count);
+    for (std::size_t chunk = 0; chunk < chunks_count; chunk++) {
+        workers.emplace_back([&, chunk]() {
+            fs::path part_pdf(parts[chunk] + ".pdf");
+            if (session.pdfs.fetch(codes[chunk], part_pdf))
+                return;
+            std::error_code err;
+            fs::remove(part_pdf, err);
+            errors[chunk] = CompilePdf(codes[chunk], parts[chunk], session.options.tex_timeout);
+            if (errors[chunk].empty())
+                session.pdfs.store(codes[chunk], part_pdf);
+        });
+    }
+    for (std::size_t chunk = 0; chunk < chunks_count; chunk++)
+        workers[chunk].join();
+    for (std::size_t chunk = 0; chunk < chunks_count; chunk++)
+        if (!errors[chunk].empty())
+            throw std::runtime_error(errors[chunk] + " (part " + std::to_string(chunk + 1) + ')');
+
+    for (std::size_t chunk = 0; chunk < chunks_count; chunk++)
+        parts[chunk] += ".pdf";
+    std::string pdf_path = output_filename.string() + ".pdf";
+    std::error_code err;
+    fs::remove(pdf_path, err);
+    if (MergePdf(parts, pdf_path)) {
+        for (std::size_t chunk = 0; chunk < chunks_count; chunk++)
+            fs::remove(parts[chunk], err);
+        std::cout << "Acram: output written successfully to \"" + pdf_path + "\"" << std::endl;
+        return;
+    }
+    std::string index_path = output_filename.string() + ".index";
+    std::ofstream index_fs(index_path);
+    if (!index_fs.is_open())
+        throw std::runtime_error("Acram: couldn't open file \"" + index_path + "\" to write index of output parts");
+    for (std::size_t chunk = 0; chunk < chunks_count; chunk++)
+        index_fs << parts[chunk] << '\n';
+    if (!index_fs.good())
+        throw std::runtime_error("Acram: errors occured during writing. Data may be incomplete");
+    std::cout << "Acram: no tool to merge pdf files found, output is written in "
+        << chunks_count << " parts listed in \"" + index_path + "\"" << std::endl;
+}
+
+/**
+ * @brief Save document as pdf if possible or as LaTeX source otherwise
+ * @param sections LaTeX code produced for each function
+ * @param output_filename name of pdf file to be created (without an extension)
+ * @param tex_filename name of LaTeX source file to be created instead
+ * @param session state of the run
+ * @return process exit code
+ */
+int SaveDocument(const tld::vector<std::string>& sections, const fs::path& output_filename, const fs::path& tex_filename, acram_session& session)
+{
+    std::string body = JoinSections(sections, 0, sections.size());
+    std::string splash = ChooseSplash(body, session);
+    std::string code = Header(splash, session.options) + body + "\\end{document}\n";
+    try {
+        if (LatexExists() && session.options.chunks > 1 && sections.size() > 1 && !session.pdfs.contains(code)) {
+            LatexToPdfChunked(sections, splash, output_filename, session);
+            session.pdfs.store(code, output_filename.string() + ".pdf");
+        } else if (LatexExists() || session.pdfs.contains(code)) {
+            LatexToPdf(code, output_filename, session);
+        } else {
+            WriteTex(code, tex_filename);
+        }
+    } catch (std::runtime_error& ex) {
+        std::cout << ex.what() << std::endl;;
+        return 1;
+    }
+    return 0;
+}
+
 /**
  * @brief Ask user to continue or to leave application
  * @return true if 'y' was entered, false if 'n'
@@ -125,31 +691,24 @@ bool Ask()
 /**
  * @brief Run Acram Alpha in console input mode
  * @param output_filename derived from second command line argument
+ * @param session state of the run
  * @return process exit code
  */
-int ConsoleMode(const fs::path& output_filename)
+int ConsoleMode(const fs::path& output_filename, acram_session& session)
 {
-    std::string input_buf, output(Header());
+    std::string input_buf, section;
+    tld::vector<std::string> sections;
     std::cout << "Acram Alpha, symbolic differentiator by @teldufalsari" << std::endl;
     while (1) {
         std::cout << "Acram: print Y to continue or Q to exit:\n]=> ";
         bool proceed = Ask();
-        if (proceed == false) {
-            output += "\\end{document}\n";
-            try {
-                if (LatexExists())
-                    LatexToPdf(output, output_filename);
-                else
-                    WriteTex(output, output_filename);
-            } catch (std::runtime_error& ex) {
-                std::cout << ex.what() << std::endl;;
-                return 1;
-            }
-            return 0;
-        }
+        if (proceed == false)
+            return SaveDocument(sections, output_filename, output_filename, session);
         std::cout << "Acram: enter your function in the format \"f(x)=...\"\n]=> ";
         std::getline(std::cin, input_buf, '\n');
-        ProcessFunction(input_buf, output);
+        section.clear();
+        if (ProcessFunction(input_buf, section, session) == OK)
+            sections.push_back(section);
     }
 }
 
@@ -157,11 +716,13 @@ int ConsoleMode(const fs::path& output_filename)
  * @brief Run Acram Alpha in file input mode
  * @param inputs input file names
  * @param output_filename derived from the last line argument
+ * @param session state of the run
  * @return process exit code
  */
-int FileMode(const tld::vector<fs::path>& inputs, const fs::path& output_filename)
+int FileMode(const tld::vector<fs::path>& inputs, const fs::path& output_filename, acram_session& session)
 {
-    std::string input_buf, output(Header());
+    std::string input_buf, section;
+    tld::vector<std::string> sections;
     std::cout << "Acram Alpha, symbolic differentiator by @teldufalsari" << std::endl;
     for (std::size_t i = 0; i < inputs.size(); i++) {
         std::ifstream input_fs(inputs[i]);
@@ -170,34 +731,100 @@ int FileMode(const tld::vector<fs::path>& inputs, const fs::path& output_filenam
             continue;
         }
         std::cout << "Acram: processing file " << inputs[i] << std::endl;
-        std::getline(input_fs, input_buf);
-        ProcessFunction(input_buf,output);
+        // Every non-empty line is a function, so generated corpora can be given as one file
+        while (std::getline(input_fs, input_buf)) {
+            if (SkipSpaces(input_buf, 0) == input_buf.size())
+                continue;
+            section.clear();
+            if (ProcessFunction(input_buf, section, session) == OK)
+                sections.push_back(section);
+        }
     }
-    output += "\\end{document}\n";
-    try {
-        if (LatexExists())
-            LatexToPdf(output, output_filename);
-        else
-            WriteTex(output, output_filename.string() + ".tex");
-    } catch (std::runtime_error& ex) {
-        std::cout << ex.what() << std::endl;;
-        return 1;
+    return SaveDocument(sections, output_filename, output_filename.string() + ".tex", session);
+}
+
+/**
+ * @brief Generate a @p std::filesystem::path vector from command line argument vector
+ * @param names_count number of strings to read from @p names
+ * @param names argument array starting from the first name to convert
+ */
+tld::vector<fs::path> FillPathv(int names_count, const char* const names[])
+{
+    tld::vector<fs::path> pathv;
+    for (int i = 0; i < names_count; i++) {
+        fs::path current_path(names[i]);
+        if (!fs::exists(current_path)) {
+            std::cout << "File " << current_path <<
+                " does not exist and would not be differentiated" << std::endl;
+            continue;
+        }
+        if (!fs::is_regular_file(current_path)) {
+            std::cout << "File " << current_path <<
+            " is not a regular file, I won't touch it" << std::endl;;
+            continue;
+        }
+        pathv.push_back(current_path);
     }
-    return 0;
+    return pathv;
 }
 
-int main(int argc, char* argv[])
+/**
+ * @brief Run Acram Alpha in the mode chosen by positional arguments
+ * @param args positional command line arguments
+ * @param session state of the run
+ * @return process exit code
+ */
+int Run(const tld::vector<char*>& args, acram_session& session)
 {
-    if (argc == 1) {
-        return ConsoleMode("Acram_out");
-    } else if (argc == 2) {
-        return ConsoleMode(argv[1]);
+    if (args.size() == 0) {
+        return ConsoleMode("Acram_out", session);
+    } else if (args.size() == 1) {
+        return ConsoleMode(args[0], session);
     }
-    tld::vector<fs::path> pathv = FillPathv(argc - 2, argv + 1);
+    tld::vector<fs::path> pathv = FillPathv(args.size() - 1, args.data());
     if (pathv.size() == 0) {
         std::cout << "Acram: no real files were provided, leaving" << std::endl;
         return ERR_NO_FILE;
     }
-    fs::path output_filename(argv[argc - 1]);
-    return FileMode(pathv, output_filename);
+    fs::path output_filename(args[args.size() - 1]);
+    return FileMode(pathv, output_filename, session);
+}
+
+int main(int argc, char* argv[])
+{
+    acram_options opts;
+    tld::vector<char*> args;
+    if (ParseOptions(argc, argv, opts, args) != 0)
+        return ERR_BAD_OPTION;
+    acram_session session(opts);
+    StatsEnable(opts.stats != STATS_OFF);
+    if (!opts.trace_path.empty())
+        TraceEnable();
+    int status = Run(args, session);
+    session.cache.trim();
+    session.pdfs.trim();
+    std::string cache_report = session.cache.report();
+    if (!cache_report.empty())
+        std::cout << "Acram: cache: " << cache_report << std::endl;
+    if (opts.stats != STATS_OFF) {
+#ifdef ACRAM_STATS
+        std::cout << (opts.stats == STATS_TABLE ? "Acram: stats:\n" : "") << StatsReport(opts.stats) << std::flush;
+#else
+        std::cout << "Acram: statistics are not compiled in, rebuild with ACRAM_STATS" << std::endl;
+#endif
+    }
+    if (!opts.c_path.empty()) {
+        std::ofstream c_fs(opts.c_path);
+        if (!(c_fs << session.emitter.source()))
+            std::cout << "Acram: couldn't write C source to " << opts.c_path << std::endl;
+    }
+    if (!opts.trace_path.empty()) {
+#ifdef ACRAM_STATS
+        if (!TraceWrite(opts.trace_path.string()))
+            std::cout << "Acram: couldn't write trace to " << opts.trace_path << std::endl;
+#else
+        std::cout << "Acram: tracing is not compiled in, rebuild with ACRAM_STATS" << std::endl;
+#endif
+    }
+    return status;
 }
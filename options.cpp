@@ -0,0 +1,225 @@
+#include "options.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+acram_options::acram_options() :
+    cache_dir(),
+    cache_limit(64UL << 20),
+    chunks(1),
+    tex_timeout(600),
+    fast_layout(false),
+    abbreviation_size(0),
+    stats(STATS_OFF),
+    trace_path(),
+    c_path(),
+    bindings(),
+    saturate(false),
+    saturation(),
+    taylor_order(0),
+    taylor_point(0.0)
+{}
+
+// Read size with optional K, M or G suffix. Returns false on malformed input
+static bool ReadSize(const std::string& str, std::uintmax_t& size)
+{
+    char* end = nullptr;
+    unsigned long long value = std::strtoull(str.c_str(), &end, 10);
+    if (end == str.c_str())
+        return false;
+    switch (*end) {
+    case 'G': case 'g':
+        value <<= 10;
+        [[fallthrough]];
+    case 'M': case 'm':
+        value <<= 10;
+        [[fallthrough]];
+    case 'K': case 'k':
+        value <<= 10;
+        end++;
+        break;
+    default:
+        break;
+    }
+    if (*end != '\0')
+        return false;
+    size = value;
+    return true;
+}
+
+// Read integer from [min, max] range. Returns false on malformed input
+static bool ReadCount(const std::string& str, unsigned& count, unsigned long min, unsigned long max)
+{
+    char* end = nullptr;
+    unsigned long value = std::strtoul(str.c_str(), &end, 10);
+    if (end == str.c_str() || *end != '\0' || value < min || value > max)
+        return false;
+    count = (unsigned)value;
+    return true;
+}
+
+// Read bindings like "a=1.5,b=2". Returns false on malformed input
+static bool ReadBindings(const std::string& str, std::map<std::string, double>& bindings)
+{
+    std::size_t pos = 0;
+    while (pos <= str.size()) {
+        std::size_t end = str.find(',', pos);
+        if (end == std::string::npos)
+            end = str.size();
+        std::string binding = str.substr(pos, end - pos);
+        std::size_t eq_pos = binding.find('=');
+        if (eq_pos == 0 || eq_pos == std::string::npos || eq_pos + 1 == binding.size())
+            return false;
+        char* num_end = nullptr;
+        double value = std::strtod(binding.c_str() + eq_pos + 1, &num_end);
+        if (*num_end != '\0' || !std::isfinite(value))
+            return false;
+        bindings[binding.substr(0, eq_pos)] = value;
+        pos = end + 1;
+    }
+    return true;
+}
+
+// Read Taylor expansion like "5" or "5,1.5". Returns false on malformed input
+static bool ReadTaylor(const std::string& str, unsigned& order, double& point)
+{
+    std::size_t comma = str.find(',');
+    if (!ReadCount(str.substr(0, comma), order, 1, 100))
+        return false;
+    if (comma == std::string::npos) {
+        point = 0.0;
+        return true;
+    }
+    char* end = nullptr;
+    point = std::strtod(str.c_str() + comma + 1, &end);
+    return end != str.c_str() + comma + 1 && *end == '\0' && std::isfinite(point);
+}
+
+int ParseOptions(int argc, char* argv[], acram_options& opts, tld::vector<char*>& args)
+{
+    bool options_end = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (options_end || arg.size() < 3 || arg.compare(0, 2, "--") != 0) {
+            if (arg == "--")
+                options_end = true;
+            else
+                args.push_back(argv[i]);
+            continue;
+        }
+        std::string name, value;
+        std::size_t eq_pos = Extract(arg, name, 2, '=');
+        if (eq_pos != std::string::npos)
+            value = arg.substr(eq_pos + 1);
+        else
+            name = arg.substr(2);
+
+        if (name == "cache") {
+            opts.cache_dir = value.empty() ? DefaultCacheDir() : fs::path(value);
+        } else if (name == "cache-size") {
+            if (!ReadSize(value, opts.cache_limit)) {
+                std::cout << "Acram: invalid cache size \"" << value << '\"' << std::endl;
+                return 1;
+            }
+        } else if (name == "chunks") {
+            if (!ReadCount(value, opts.chunks, 1, 4096)) {
+                std::cout << "Acram: invalid number of parts \"" << value << '\"' << std::endl;
+                return 1;
+            }
+        } else if (name == "tex-timeout") {
+            if (!ReadCount(value, opts.tex_timeout, 0, 1000000)) {
+                std::cout << "Acram: invalid timeout \"" << value << '\"' << std::endl;
+                return 1;
+            }
+        } else if (name == "fast-layout") {
+            opts.fast_layout = true;
+        } else if (name == "abbreviate") {
+            opts.abbreviation_size = 6;
+            if (!value.empty() && !ReadCount(value, opts.abbreviation_size, 2, 1000000)) {
+                std::cout << "Acram: invalid subexpression size \"" << value << '\"' << std::endl;
+                return 1;
+            }
+        } else if (name == "stats") {
+            if (value.empty() || value == "table") {
+                opts.stats = STATS_TABLE;
+            } else if (value == "json") {
+                opts.stats = STATS_JSON;
+            } else {
+                std::cout << "Acram: unknown statistics format \"" << value << '\"' << std::endl;
+                return 1;
+            }
+        } else if (name == "trace") {
+            if (value.empty()) {
+                std::cout << "Acram: trace file name is missing" << std::endl;
+                return 1;
+            }
+            opts.trace_path = value;
+        } else if (name == "emit-c") {
+            if (value.empty()) {
+                std::cout << "Acram: C source file name is missing" << std::endl;
+                return 1;
+            }
+            opts.c_path = value;
+        } else if (name == "saturate") {
+            opts.saturate = true;
+            unsigned nodes = (unsigned)opts.saturation.max_nodes;
+            if (!value.empty() && !ReadCount(value, nodes, 100, 100000000)) {
+                std::cout << "Acram: invalid number of nodes \"" << value << '\"' << std::endl;
+                return 1;
+            }
+            opts.saturation.max_nodes = nodes;
+        } else if (name == "saturate-time") {
+            if (!ReadCount(value, opts.saturation.time_ms, 0, 3600000)) {
+                std::cout << "Acram: invalid time \"" << value << '\"' << std::endl;
+                return 1;
+            }
+        } else if (name == "taylor") {
+            if (!ReadTaylor(value, opts.taylor_order, opts.taylor_point)) {
+                std::cout << "Acram: invalid Taylor expansion \"" << value << '\"' << std::endl;
+                return 1;
+            }
+        } else if (name == "bind") {
+            if (!ReadBindings(value, opts.bindings)) {
+                std::cout << "Acram: invalid parameter values \"" << value << '\"' << std::endl;
+                return 1;
+            }
+        } else {
+            std::cout << "Acram: unknown option \"" << arg << '\"' << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+std::string OptionsKey(const acram_options& opts)
+{
+    std::string key("v1");
+    if (opts.fast_layout)
+        key += " fast-layout";
+    if (opts.abbreviation_size > 0)
+        key += " abbreviate=" + std::to_string(opts.abbreviation_size);
+    if (opts.saturate)
+        key += " saturate=" + std::to_string(opts.saturation.max_nodes) + "," + std::to_string(opts.saturation.time_ms);
+    if (opts.taylor_order > 0) {
+        char point[32];
+        std::snprintf(point, sizeof(point), "%.17g", opts.taylor_point);
+        key += " taylor=" + std::to_string(opts.taylor_order) + "," + point;
+    }
+    for (const auto& binding: opts.bindings) {
+        char value[32];
+        std::snprintf(value, sizeof(value), "%.17g", binding.second);
+        key += " " + binding.first + "=" + value;
+    }
+    return key;
+}
+
+fs::path DefaultCacheDir()
+{
+    const char* xdg_cache = std::getenv("XDG_CACHE_HOME");
+    if (xdg_cache != nullptr && xdg_cache[0] != '\0')
+        return fs::path(xdg_cache) / "acram";
+    const char* home = std::getenv("HOME");
+    if (home != nullptr && home[0] != '\0')
+        return fs::path(home) / ".cache" / "acram";
+    return fs::temp_directory_path() / "acram";
+}
@@ -0,0 +1,73 @@
+#ifndef ACRAM_OPTIONS_HPP
+#define ACRAM_OPTIONS_HPP
+
+#include "common.hpp"
+#include "stats.hpp"
+#include "egraph.hpp"
+#include <map>
+/**
+ * @file options.hpp
+ * @brief command line options of the program
+ */
+
+/// Settings that are read from "--option" command line arguments
+struct acram_options
+{
+    /// Directory of the derivative cache, empty if caching is disabled
+    fs::path cache_dir;
+    /// Maximal total size of the derivative cache in bytes
+    std::uintmax_t cache_limit;
+    /// Number of parts that are compiled by pdflatex in parallel
+    unsigned chunks;
+    /// Time in seconds given to pdflatex to compile a document, zero means no limit
+    unsigned tex_timeout;
+    /// Break lines in advance and avoid sized parentheses, so that pdflatex works faster
+    bool fast_layout;
+    /// Minimal size of repeated subexpressions that are abbreviated in output, zero if disabled
+    unsigned abbreviation_size;
+    /// Format of statistics printed at exit, see @p stats_formats
+    int stats;
+    /// File where a trace of processing phases is written, empty if tracing is disabled
+    fs::path trace_path;
+    /// File where C source evaluating functions and derivatives is written, empty if disabled
+    fs::path c_path;
+    /// Numbers substituted for parameters before differentiation, by parameter names
+    std::map<std::string, double> bindings;
+    /// Simplify derivatives further by equality saturation, see @p expr_egraph
+    bool saturate;
+    /// Limits of equality saturation
+    saturation_limits saturation;
+    /// Order of Taylor polynomials appended to output, zero if disabled
+    unsigned taylor_order;
+    /// Point around which Taylor polynomials are expanded
+    double taylor_point;
+
+public:
+    /// Initialize options with default values
+    acram_options();
+};
+
+/**
+ * @brief Read "--option" arguments and leave positional ones
+ * @param argc argument count as passed to main
+ * @param argv argument vector as passed to main
+ * @param opts where to store the options
+ * @param args where to store positional arguments (program name excluded)
+ * @return Zero on success or non-zero if an option is malformed
+ * @details Options are accepted in the form "--name" or "--name=value"
+ * and may appear anywhere in the command line. Everything after "--"
+ * is treated as positional.
+ */
+int ParseOptions(int argc, char* argv[], acram_options& opts, tld::vector<char*>& args);
+
+/**
+ * @brief Get a string that identifies options affecting generated output
+ * @details Used as a part of cache keys, so that outputs produced
+ * with different settings are never mixed up
+ */
+std::string OptionsKey(const acram_options& opts);
+
+/// Get default directory for Acram caches ($XDG_CACHE_HOME/acram or ~/.cache/acram)
+fs::path DefaultCacheDir();
+
+#endif // ACRAM_OPTIONS_HPP
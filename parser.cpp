@@ -5,9 +5,10 @@
 expr_parser::expr_parser(const std::string& _str) :
     str_(_str),
     variable_(std::string()),
+    variable_id_(0),
+    variables_(),
     name_(std::string()),
     parameters_(),
-    parameters_count_(0),
     pos_(0),
     errno_(OK)
 {}
@@ -32,6 +33,8 @@ std::string expr_parser::strerror() const
         return "error: could not found an expression";
     case ERR_GARBAGE:
         return "error: garbage symbols found since position " + std::to_string(pos_);
+    case ERR_BAD_VARIABLE:
+        return "error: empty or repeated variable name before position " + std::to_string(pos_);
     case ERR_NO_EQUAL_SIGN:
         return "ёлы-палы, мальчики и девочки, равна нету (pos = " + std::to_string(pos_) + ')';
     default:
@@ -57,7 +60,7 @@ expr_tree expr_parser::read()
         delete root;
         return expr_tree();
     }
-    return expr_tree(root, parameters_, variable_, name_);
+    return expr_tree(root, parameters_, variable_id_, name_, variables_);
 }
 
 expr_node* expr_parser::getExpr()
@@ -251,12 +254,12 @@ expr_node* expr_parser::getSymbol(const std::string& symbol)
 {
     expr_node* root = nullptr;
     if (symbol == variable_) {
-        root = new expr_node(VAR, (long)VAR);
+        root = new expr_node(VAR, (long)variable_id_);
     } else {
-        std::size_t par_num = VecFind(parameters_, symbol);
-        if (par_num == std::string::npos) // If it's first occurence of this parameter
-            parameters_.push_back(symbol);
-        root = new expr_node(PAR, (long)VecFind(parameters_, symbol));
+        std::uint32_t id = InternSymbol(symbol);
+        if (VecFind(parameters_, id) == std::string::npos) // If it's first occurence of this parameter
+            parameters_.push_back(id);
+        root = new expr_node(PAR, (long)id);
     }
     return root;
 }
@@ -281,12 +284,28 @@ void expr_parser::getName()
         return;
     }
     pos_ = SkipSpaces(str_, pos_ + 1);
-    pos_ = Extract(str_, variable_, pos_, ") \t\n");
-    if (pos_ == std::string::npos) {
-        errno_ = ERR_NO_EXPR;
-        return;
+    while (1) {
+        std::string variable;
+        pos_ = Extract(str_, variable, pos_, ",) \t\n");
+        if (pos_ == std::string::npos) {
+            errno_ = ERR_NO_EXPR;
+            return;
+        }
+        if (variable.empty() || VecFind(variables_, InternSymbol(variable)) != std::string::npos) {
+            raise(ERR_BAD_VARIABLE);
+            return;
+        }
+        variables_.push_back(InternSymbol(variable));
+        pos_ = SkipSpaces(str_, pos_);
+        if (str_[pos_] != ',')
+            break;
+        pos_ = SkipSpaces(str_, pos_ + 1);
     }
-    pos_ = SkipSpaces(str_, pos_);
+    variable_id_ = variables_[0];
+    variable_ = SymbolName(variable_id_);
+    // Other variables are parameters of the main one, listed first
+    for (std::size_t i = 1; i < variables_.size(); i++)
+        parameters_.push_back(variables_[i]);
     if (str_[pos_] != ')') {
         raise(ERR_CLOSING_PAR);
         return;
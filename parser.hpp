@@ -18,13 +18,15 @@ class expr_parser
 
     // Name of the main variable of the function
     std::string variable_;
+    std::uint32_t variable_id_;
+    // Symbol ids of all variables, the main one first
+    tld::vector<std::uint32_t> variables_;
 
     // Name of the function
     std::string name_;
 
-    // List of symbolic constant parameters that were met in the function
-    tld::vector<std::string> parameters_;
-    std::size_t parameters_count_;
+    // Symbol ids of parameters in order of their first appearance in the function
+    tld::vector<std::uint32_t> parameters_;
 
     // Used as a caret while parsing
     std::size_t pos_;
@@ -60,7 +62,7 @@ private:
     expr_node* getExpr();
     expr_node* getSymbol(const std::string& symbol);
 
-    // Read function name and variable
+    // Read function name and variables
     void getName();
 
     // Searches for function and returns its numerical code. If not found, NONE returned
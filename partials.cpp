@@ -0,0 +1,86 @@
+#include "partials.hpp"
+#include <algorithm>
+
+// Mark variables met in a subtree, marks are indexed as variables are
+static void MarkSymbols(const expr_node* node, const tld::vector<std::uint32_t>& variables, tld::vector<unsigned char, 0>& marks)
+{
+    if (node == nullptr)
+        return;
+    if (node->type == VAR || node->type == PAR) {
+        std::size_t index = VecFind(variables, (std::uint32_t)node->value.integer);
+        if (index != std::string::npos)
+            marks[index] = 1;
+    }
+    MarkSymbols(node->left, variables, marks);
+    MarkSymbols(node->right, variables, marks);
+}
+
+expr_partials::expr_partials(expr_tree& function) :
+    variables_(function.variables()),
+    jacobian_(),
+    hessian_(),
+    zeros_(0)
+{
+    std::size_t count = variables_.size();
+    tld::vector<unsigned char, 0> contained;
+    contained.resize(count);
+    MarkSymbols(function.root(), variables_, contained);
+    for (std::size_t i = 0; i < count; i++)
+        jacobian_.push_back(partial(function, contained, i));
+    for (std::size_t i = 0; i < count; i++) {
+        std::fill(contained.data(), contained.data() + contained.size(), 0);
+        MarkSymbols(jacobian_[i].root(), variables_, contained);
+        for (std::size_t j = i; j < count; j++)
+            hessian_.push_back(partial(jacobian_[i], contained, j));
+    }
+}
+
+std::size_t expr_partials::size() const
+{
+    return variables_.size();
+}
+
+const tld::vector<std::uint32_t>& expr_partials::variables() const
+{
+    return variables_;
+}
+
+expr_tree& expr_partials::jacobian(std::size_t i)
+{
+    return jacobian_[i];
+}
+
+expr_tree& expr_partials::hessian(std::size_t i, std::size_t j)
+{
+    if (i > j)
+        std::swap(i, j);
+    // Rows before the i-th one hold count, count - 1, ..., count - i + 1 entries
+    return hessian_[i * variables_.size() - i * (i - 1) / 2 + (j - i)];
+}
+
+std::size_t expr_partials::zeros() const
+{
+    return zeros_;
+}
+
+std::size_t expr_partials::nodes() const
+{
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < jacobian_.size(); i++)
+        total += jacobian_[i].size();
+    for (std::size_t i = 0; i < hessian_.size(); i++)
+        total += hessian_[i].size();
+    return total;
+}
+
+expr_tree expr_partials::partial(expr_tree& expr, const tld::vector<unsigned char, 0>& contained, std::size_t i)
+{
+    std::uint32_t variable = variables_[i];
+    if (!contained[i]) {
+        zeros_++;
+        return expr_tree(MakeInt(0), expr.parameters(), expr.variable(), PartialName(expr.getName(), variable), expr.variables());
+    }
+    expr_tree derivative = expr.derivative(variable);
+    derivative.simplify();
+    return derivative;
+}
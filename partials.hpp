@@ -0,0 +1,68 @@
+#ifndef ACRAM_PARTIALS_HPP
+#define ACRAM_PARTIALS_HPP
+
+#include "expr_tree.hpp"
+/**
+ * @file partials.hpp
+ * @brief Jacobian and Hessian of functions of several variables
+ */
+
+/**
+ * @brief Simplified partial derivatives of the first and the second order
+ * @details Entry i of the Jacobian is the derivative by the i-th variable,
+ * entry (i, j) of the Hessian is the derivative of the i-th entry of the Jacobian
+ * by the j-th variable. Structural sparsity is used: derivatives by variables
+ * that an expression does not contain are zero and are not calculated at all,
+ * and only the upper triangle of the symmetric Hessian is calculated.
+ * Entries have the variables and parameters of the function,
+ * so they are evaluated with the same arguments.
+ */
+class expr_partials
+{
+    // Symbol ids of the variables
+    tld::vector<std::uint32_t> variables_;
+    // Derivatives of the first order
+    tld::vector<expr_tree> jacobian_;
+    // Derivatives of the second order, upper triangle by rows
+    tld::vector<expr_tree> hessian_;
+    // Number of entries of both that are zero by structure
+    std::size_t zeros_ = 0;
+
+public:
+    /// Construct empty set of derivatives
+    expr_partials() = default;
+
+    /**
+     * @brief Calculate derivatives of a function
+     * @param function function of one or several variables, see @p expr_tree::variables
+     */
+    explicit expr_partials(expr_tree& function);
+
+    expr_partials(const expr_partials& that) = delete;
+    expr_partials& operator =(const expr_partials& that) = delete;
+
+    /// Get number of variables
+    std::size_t size() const;
+
+    /// Get symbol ids of the variables
+    const tld::vector<std::uint32_t>& variables() const;
+
+    /// Get derivative by the i-th variable
+    expr_tree& jacobian(std::size_t i);
+
+    /// Get derivative by the i-th and the j-th variables, in any order
+    expr_tree& hessian(std::size_t i, std::size_t j);
+
+    /// Get number of entries of the Jacobian and the upper triangle of the Hessian that are zero by structure
+    std::size_t zeros() const;
+
+    /// Get total number of nodes of the Jacobian and the upper triangle of the Hessian
+    std::size_t nodes() const;
+
+private:
+    // Get derivative of an expression by the i-th variable, simplified,
+    // or zero if the expression does not contain the variable
+    expr_tree partial(expr_tree& expr, const tld::vector<unsigned char, 0>& contained, std::size_t i);
+};
+
+#endif // ACRAM_PARTIALS_HPP
@@ -0,0 +1,354 @@
+#include "stats.hpp"
+#include "common.hpp"
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+
+// Names of phases and counters as they appear in reports,
+// work done outside of any phase is attributed to "other"
+static const char* const PHASE_NAMES[PHASES_COUNT + 1] = {
+    "function", "cache", "parse", "semantics", "derive", "simplify", "saturate", "taylor", "emit", "write-tex", "pdflatex", "other"
+};
+static const char* const COUNTER_NAMES[COUNTERS_COUNT] = {
+    "functions", "failed", "cached", "parsed-nodes", "derived-nodes", "simplified-nodes", "saturated-nodes", "tex-bytes"
+};
+static const char* const RULE_NAMES[RULES_COUNT] = {
+    "calc", "add", "sub", "mul", "div", "pwr"
+};
+
+/// Accumulated measurements of a phase
+struct phase_stats
+{
+    std::atomic<std::uint64_t> calls;
+    std::atomic<std::uint64_t> total_ns;
+    std::atomic<std::uint64_t> max_ns;
+    // Expression nodes created and destroyed during the phase
+    std::atomic<std::uint64_t> nodes_created;
+    std::atomic<std::uint64_t> nodes_deleted;
+};
+
+static std::atomic<bool> stats_enabled(false);
+static phase_stats phases[PHASES_COUNT + 1];
+static std::atomic<std::uint64_t> counters[COUNTERS_COUNT];
+
+/// Accumulated effect of a simplifier rule
+struct rule_stats
+{
+    std::atomic<std::uint64_t> calls;
+    std::atomic<std::uint64_t> fires;
+    std::atomic<std::int64_t> nodes_removed;
+    std::atomic<std::uint64_t> total_ns;
+};
+
+static rule_stats rules[RULES_COUNT];
+
+// Number of nodes alive in all threads and its maximum
+static std::atomic<std::int64_t> live_nodes(0);
+static std::atomic<std::int64_t> peak_live_nodes(0);
+// Peaks of nodes alive at once during processing of single functions
+static std::atomic<std::uint64_t> functions_measured(0);
+static std::atomic<std::uint64_t> function_peaks_sum(0);
+static std::atomic<std::uint64_t> function_peaks_max(0);
+
+// Innermost running phase of the thread
+thread_local int current_phase = PHASES_COUNT;
+// Nodes created and deleted by the thread
+thread_local std::int64_t thread_created_nodes = 0;
+thread_local std::int64_t thread_deleted_nodes = 0;
+// Nodes alive in the thread, and their number at the beginning of the function being processed
+thread_local std::int64_t thread_live_nodes = 0;
+thread_local std::int64_t function_base_nodes = 0;
+thread_local std::int64_t function_peak_nodes = 0;
+
+// Raise an atomic maximum to a value
+template <typename T>
+static void UpdateMax(std::atomic<T>& max, T value)
+{
+    T current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        ;
+}
+
+/// Span of a phase recorded for the trace
+struct trace_event
+{
+    int phase;
+    unsigned thread;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+    std::string detail;
+    // Peak number of live nodes, for functions only
+    std::uint64_t peak_nodes;
+};
+
+static std::atomic<bool> trace_enabled(false);
+static std::chrono::steady_clock::time_point trace_start;
+static std::mutex trace_mutex;
+static tld::vector<trace_event, 0> trace_events;
+
+// Get small number identifying the calling thread, the first thread to ask gets 1
+static unsigned ThreadNumber()
+{
+    static std::atomic<unsigned> threads_count(0);
+    thread_local unsigned number = ++threads_count;
+    return number;
+}
+
+// Append string to JSON output as a quoted string literal
+static void AppendJsonString(std::string& out, const std::string& str)
+{
+    out += '"';
+    for (unsigned char chr : str) {
+        if (chr == '"' || chr == '\\') {
+            out += '\\';
+            out += (char)chr;
+        } else if (chr < 0x20) {
+            char buf[8] = {};
+            std::snprintf(buf, sizeof(buf), "\\u%04x", chr);
+            out += buf;
+        } else {
+            out += (char)chr;
+        }
+    }
+    out += '"';
+}
+
+void StatsEnable(bool enable)
+{
+    stats_enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool StatsEnabled()
+{
+    return stats_enabled.load(std::memory_order_relaxed);
+}
+
+void StatsAddTime(int phase, std::chrono::nanoseconds duration)
+{
+    std::uint64_t nsec = (std::uint64_t)duration.count();
+    phase_stats& stats = phases[phase];
+    stats.calls.fetch_add(1, std::memory_order_relaxed);
+    stats.total_ns.fetch_add(nsec, std::memory_order_relaxed);
+    UpdateMax(stats.max_ns, nsec);
+}
+
+void StatsCount(int counter, std::uint64_t value)
+{
+    counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void StatsNodeCreated()
+{
+    phases[current_phase].nodes_created.fetch_add(1, std::memory_order_relaxed);
+    UpdateMax(peak_live_nodes, live_nodes.fetch_add(1, std::memory_order_relaxed) + 1);
+    thread_created_nodes++;
+    if (++thread_live_nodes - function_base_nodes > function_peak_nodes)
+        function_peak_nodes = thread_live_nodes - function_base_nodes;
+}
+
+void StatsNodeDeleted()
+{
+    phases[current_phase].nodes_deleted.fetch_add(1, std::memory_order_relaxed);
+    live_nodes.fetch_sub(1, std::memory_order_relaxed);
+    thread_deleted_nodes++;
+    thread_live_nodes--;
+}
+
+std::string StatsReport(int format)
+{
+    char buf[160] = {};
+    std::string report;
+    if (format == STATS_JSON) {
+        report = "{\"phases\": {";
+        for (int i = 0; i <= PHASES_COUNT; i++) {
+            std::snprintf(buf, sizeof(buf), "%s\"%s\": {\"calls\": %llu, \"total_ns\": %llu, \"max_ns\": %llu, ",
+                i ? ", " : "", PHASE_NAMES[i],
+                (unsigned long long)phases[i].calls.load(),
+                (unsigned long long)phases[i].total_ns.load(),
+                (unsigned long long)phases[i].max_ns.load());
+            report += buf;
+            std::snprintf(buf, sizeof(buf), "\"nodes_created\": %llu, \"nodes_deleted\": %llu, \"node_bytes\": %llu}",
+                (unsigned long long)phases[i].nodes_created.load(),
+                (unsigned long long)phases[i].nodes_deleted.load(),
+                (unsigned long long)(phases[i].nodes_created.load() * sizeof(expr_node)));
+            report += buf;
+        }
+        report += "}, \"counters\": {";
+        for (int i = 0; i < COUNTERS_COUNT; i++) {
+            std::snprintf(buf, sizeof(buf), "%s\"%s\": %llu",
+                i ? ", " : "", COUNTER_NAMES[i], (unsigned long long)counters[i].load());
+            report += buf;
+        }
+        report += "}, \"rules\": {";
+        for (int i = 0; i < RULES_COUNT; i++) {
+            std::snprintf(buf, sizeof(buf),
+                "%s\"%s\": {\"calls\": %llu, \"fires\": %llu, \"nodes_removed\": %lld, \"total_ns\": %llu}",
+                i ? ", " : "", RULE_NAMES[i],
+                (unsigned long long)rules[i].calls.load(), (unsigned long long)rules[i].fires.load(),
+                (long long)rules[i].nodes_removed.load(), (unsigned long long)rules[i].total_ns.load());
+            report += buf;
+        }
+        std::uint64_t measured = functions_measured.load();
+        std::snprintf(buf, sizeof(buf),
+            "}, \"memory\": {\"peak_live_nodes\": %lld, \"function_peak_nodes_max\": %llu, \"function_peak_nodes_mean\": %.1f}}\n",
+            (long long)peak_live_nodes.load(), (unsigned long long)function_peaks_max.load(),
+            measured ? (double)function_peaks_sum.load() / measured : 0.0);
+        return report + buf;
+    }
+
+    std::snprintf(buf, sizeof(buf), "%-12s %10s %12s %12s %12s %12s %12s %10s\n",
+        "phase", "calls", "total ms", "mean us", "max us", "nodes new", "nodes freed", "node KiB");
+    report += buf;
+    for (int i = 0; i <= PHASES_COUNT; i++) {
+        std::uint64_t calls = phases[i].calls.load();
+        double total = (double)phases[i].total_ns.load();
+        std::uint64_t created = phases[i].nodes_created.load();
+        std::snprintf(buf, sizeof(buf), "%-12s %10llu %12.3f %12.1f %12.1f %12llu %12llu %10.1f\n",
+            PHASE_NAMES[i], (unsigned long long)calls, total * 1e-6,
+            calls ? total * 1e-3 / calls : 0.0, phases[i].max_ns.load() * 1e-3,
+            (unsigned long long)created, (unsigned long long)phases[i].nodes_deleted.load(),
+            created * sizeof(expr_node) / 1024.0);
+        report += buf;
+    }
+    std::snprintf(buf, sizeof(buf), "%-17s %12s\n", "counter", "value");
+    report += buf;
+    for (int i = 0; i < COUNTERS_COUNT; i++) {
+        std::snprintf(buf, sizeof(buf), "%-17s %12llu\n", COUNTER_NAMES[i], (unsigned long long)counters[i].load());
+        report += buf;
+    }
+    std::snprintf(buf, sizeof(buf), "%-12s %10s %12s %14s %12s\n", "rule", "calls", "fires", "nodes removed", "total ms");
+    report += buf;
+    for (int i = 0; i < RULES_COUNT; i++) {
+        std::snprintf(buf, sizeof(buf), "%-12s %10llu %12llu %14lld %12.3f\n",
+            RULE_NAMES[i], (unsigned long long)rules[i].calls.load(), (unsigned long long)rules[i].fires.load(),
+            (long long)rules[i].nodes_removed.load(), rules[i].total_ns.load() * 1e-6);
+        report += buf;
+    }
+    std::uint64_t measured = functions_measured.load();
+    std::snprintf(buf, sizeof(buf), "peak live nodes %lld, per function: max %llu, mean %.1f\n",
+        (long long)peak_live_nodes.load(), (unsigned long long)function_peaks_max.load(),
+        measured ? (double)function_peaks_sum.load() / measured : 0.0);
+    return report + buf;
+}
+
+void TraceEnable()
+{
+    trace_start = std::chrono::steady_clock::now();
+    ThreadNumber();
+    trace_enabled.store(true, std::memory_order_relaxed);
+}
+
+bool TraceEnabled()
+{
+    return trace_enabled.load(std::memory_order_relaxed);
+}
+
+bool TraceWrite(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    std::ofstream trace_fs(path);
+    if (!trace_fs.is_open())
+        return false;
+    trace_fs << "{\"traceEvents\": [\n";
+    std::string line;
+    char buf[160] = {};
+    for (std::size_t i = 0; i < trace_events.size(); i++) {
+        const trace_event& event = trace_events[i];
+        std::snprintf(buf, sizeof(buf),
+            "{\"name\": \"%s\", \"cat\": \"acram\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u",
+            PHASE_NAMES[event.phase],
+            std::chrono::duration<double, std::micro>(event.start - trace_start).count(),
+            std::chrono::duration<double, std::micro>(event.end - event.start).count(),
+            event.thread);
+        line = buf;
+        if (!event.detail.empty()) {
+            line += ", \"args\": {\"input\": ";
+            AppendJsonString(line, event.detail);
+            if (event.phase == PHASE_FUNCTION)
+                line += ", \"peak_nodes\": " + std::to_string(event.peak_nodes);
+            line += '}';
+        }
+        line += (i + 1 < trace_events.size()) ? "},\n" : "}\n";
+        trace_fs << line;
+    }
+    trace_fs << "], \"displayTimeUnit\": \"ms\"}\n";
+    return trace_fs.good();
+}
+
+phase_timer::phase_timer(int phase) :
+    phase_(phase),
+    active_(StatsEnabled() || TraceEnabled()),
+    outer_phase_(PHASES_COUNT),
+    start_(),
+    detail_()
+{
+    if (!active_)
+        return;
+    outer_phase_ = current_phase;
+    current_phase = phase_;
+    if (phase_ == PHASE_FUNCTION) {
+        function_base_nodes = thread_live_nodes;
+        function_peak_nodes = 0;
+    }
+    start_ = std::chrono::steady_clock::now();
+}
+
+phase_timer::~phase_timer()
+{
+    stop();
+}
+
+void phase_timer::describe(const std::string& detail)
+{
+    detail_ = detail;
+}
+
+void phase_timer::stop()
+{
+    if (!active_)
+        return;
+    active_ = false;
+    auto end = std::chrono::steady_clock::now();
+    current_phase = outer_phase_;
+    std::uint64_t peak = 0;
+    if (phase_ == PHASE_FUNCTION) {
+        peak = (std::uint64_t)function_peak_nodes;
+        functions_measured.fetch_add(1, std::memory_order_relaxed);
+        function_peaks_sum.fetch_add(peak, std::memory_order_relaxed);
+        UpdateMax(function_peaks_max, peak);
+    }
+    if (StatsEnabled())
+        StatsAddTime(phase_, end - start_);
+    if (TraceEnabled()) {
+        unsigned thread = ThreadNumber();
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        trace_events.push_back({phase_, thread, start_, end, std::move(detail_), peak});
+    }
+}
+
+rule_probe::rule_probe(int rule) :
+    rule_(rule),
+    active_(StatsEnabled()),
+    created_(thread_created_nodes),
+    deleted_(thread_deleted_nodes),
+    start_()
+{
+    if (active_)
+        start_ = std::chrono::steady_clock::now();
+}
+
+rule_probe::~rule_probe()
+{
+    if (!active_)
+        return;
+    auto duration = std::chrono::steady_clock::now() - start_;
+    rule_stats& stats = rules[rule_];
+    std::int64_t removed = (thread_deleted_nodes - deleted_) - (thread_created_nodes - created_);
+    bool fired = thread_deleted_nodes != deleted_ || thread_created_nodes != created_;
+    stats.calls.fetch_add(1, std::memory_order_relaxed);
+    if (fired)
+        stats.fires.fetch_add(1, std::memory_order_relaxed);
+    stats.nodes_removed.fetch_add(removed, std::memory_order_relaxed);
+    stats.total_ns.fetch_add((std::uint64_t)std::chrono::nanoseconds(duration).count(), std::memory_order_relaxed);
+}
@@ -0,0 +1,198 @@
+#ifndef ACRAM_STATS_HPP
+#define ACRAM_STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * @file stats.hpp
+ * @brief timers and counters of processing phases
+ * @details Instrumentation is compiled in when ACRAM_STATS is defined
+ * and is switched on at run time by @p StatsEnable or @p TraceEnable.
+ * Otherwise the STATS_* macros expand to nothing, and a disabled build
+ * pays nothing for them.
+ */
+
+/// Phases of processing that are timed
+enum stats_phases {
+    PHASE_FUNCTION = 0,
+    PHASE_CACHE,
+    PHASE_PARSE,
+    PHASE_SEMANTICS,
+    PHASE_DERIVE,
+    PHASE_SIMPLIFY,
+    PHASE_SATURATE,
+    PHASE_TAYLOR,
+    PHASE_EMIT,
+    PHASE_WRITE_TEX,
+    PHASE_PDFLATEX,
+    PHASES_COUNT
+};
+
+/// Quantities that are counted
+enum stats_counters {
+    COUNTER_FUNCTIONS = 0,
+    COUNTER_FAILED,
+    COUNTER_CACHED,
+    COUNTER_PARSED_NODES,
+    COUNTER_DERIVED_NODES,
+    COUNTER_SIMPLIFIED_NODES,
+    COUNTER_SATURATED_NODES,
+    COUNTER_TEX_BYTES,
+    COUNTERS_COUNT
+};
+
+/// Rules of the simplifier, see @p expr_tree::simplify
+enum stats_rules {
+    RULE_CALC = 0,
+    RULE_ADD,
+    RULE_SUB,
+    RULE_MUL,
+    RULE_DIV,
+    RULE_PWR,
+    RULES_COUNT
+};
+
+/// Formats of the summary
+enum stats_formats {
+    STATS_OFF = 0, STATS_TABLE, STATS_JSON
+};
+
+/// Switch collection of statistics on or off
+void StatsEnable(bool enable);
+
+/// Tell whether statistics are collected
+bool StatsEnabled();
+
+/// Add a measured interval to a phase
+void StatsAddTime(int phase, std::chrono::nanoseconds duration);
+
+/// Add a value to a counter
+void StatsCount(int counter, std::uint64_t value);
+
+/**
+ * @brief Get summary of collected statistics
+ * @param format @p STATS_TABLE for a human-readable table, @p STATS_JSON for a JSON object
+ */
+std::string StatsReport(int format);
+
+/**
+ * @brief Account creation of an expression node
+ * @details The node is attributed to the innermost running phase of the calling thread
+ */
+void StatsNodeCreated();
+
+/// Account destruction of an expression node
+void StatsNodeDeleted();
+
+/// Start recording spans of phases for a trace
+void TraceEnable();
+
+/// Tell whether spans are recorded
+bool TraceEnabled();
+
+/**
+ * @brief Write recorded spans as Chrome trace-event JSON
+ * @param path file to create, it can be opened by chrome://tracing or Perfetto
+ * @return false if the file can't be written
+ */
+bool TraceWrite(const std::string& path);
+
+/**
+ * @brief Scoped timer of a phase
+ * @details Time from construction to @p stop or destruction, whichever is first,
+ * is added to the phase and recorded as a span of the trace. Does not read
+ * the clock if neither statistics nor tracing are enabled.
+ * Nodes created and destroyed while the timer runs are attributed to its phase.
+ * A timer of @p PHASE_FUNCTION also measures the peak number of nodes
+ * that were alive at once while the function was processed.
+ * Timers may be used from several threads at once.
+ */
+class phase_timer
+{
+    int phase_;
+    bool active_;
+    // Phase that was running on this thread before the timer started
+    int outer_phase_;
+    std::chrono::steady_clock::time_point start_;
+    // Text attached to the span in the trace
+    std::string detail_;
+
+public:
+    phase_timer() = delete;
+    explicit phase_timer(int phase);
+
+    phase_timer(const phase_timer& that) = delete;
+    phase_timer(phase_timer&& that) = delete;
+    phase_timer& operator =(const phase_timer& that) = delete;
+    phase_timer& operator =(phase_timer&& that) = delete;
+
+    ~phase_timer();
+
+    /// Attach text to the span, such as the function being processed
+    void describe(const std::string& detail);
+
+    /// Finish measurement before the end of the scope
+    void stop();
+};
+
+/**
+ * @brief Scoped probe of a simplifier rule applied to a node
+ * @details Counts calls of the rule, calls that changed the node ("fires"),
+ * nodes removed from the tree and time spent in the rule.
+ * Every rule that changes a node deletes at least one node, possibly the node itself,
+ * so fires are told by the node counters and the node is not read after the rule.
+ * Does nothing if statistics are disabled.
+ */
+class rule_probe
+{
+    int rule_;
+    bool active_;
+    // Nodes created and deleted by the thread before the rule was applied
+    std::int64_t created_;
+    std::int64_t deleted_;
+    std::chrono::steady_clock::time_point start_;
+
+public:
+    rule_probe() = delete;
+    explicit rule_probe(int rule);
+
+    rule_probe(const rule_probe& that) = delete;
+    rule_probe(rule_probe&& that) = delete;
+    rule_probe& operator =(const rule_probe& that) = delete;
+    rule_probe& operator =(rule_probe&& that) = delete;
+
+    ~rule_probe();
+};
+
+#ifdef ACRAM_STATS
+/// Start timer @p name of a phase, it stops at the end of the scope or at STATS_STOP
+#define STATS_TIMER(name, phase) phase_timer name(phase)
+/// Stop timer started by STATS_TIMER
+#define STATS_STOP(name) name.stop()
+/// Attach text to the span of timer started by STATS_TIMER
+#define STATS_DESCRIBE(name, detail) \
+    do { if (TraceEnabled()) name.describe(detail); } while (0)
+/// Add a value to a counter, the value is not evaluated if statistics are disabled
+#define STATS_COUNT(counter, value) \
+    do { if (StatsEnabled()) StatsCount(counter, value); } while (0)
+/// Probe the simplifier rule applied to a node until the end of the scope
+#define STATS_RULE(name, rule) rule_probe name(rule)
+/// Account creation of an expression node
+#define STATS_NODE_CREATED() \
+    do { if (StatsEnabled() || TraceEnabled()) StatsNodeCreated(); } while (0)
+/// Account destruction of an expression node
+#define STATS_NODE_DELETED() \
+    do { if (StatsEnabled() || TraceEnabled()) StatsNodeDeleted(); } while (0)
+#else
+#define STATS_TIMER(name, phase) do {} while (0)
+#define STATS_STOP(name) do {} while (0)
+#define STATS_DESCRIBE(name, detail) do {} while (0)
+#define STATS_COUNT(counter, value) do {} while (0)
+#define STATS_RULE(name, rule) do {} while (0)
+#define STATS_NODE_CREATED() do {} while (0)
+#define STATS_NODE_DELETED() do {} while (0)
+#endif
+
+#endif // ACRAM_STATS_HPP
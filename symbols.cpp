@@ -0,0 +1,63 @@
+#include "symbols.hpp"
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+/// Names and ids of all symbols met by the program
+struct symbol_table
+{
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, std::uint32_t> ids;
+    // Elements of a deque are not moved when it grows, so names can be referred to without the lock
+    std::deque<std::string> names;
+};
+
+// The table is created on first use, so symbols can be interned during static initialization
+static symbol_table& Table()
+{
+    static symbol_table table;
+    return table;
+}
+
+std::uint32_t InternSymbol(const std::string& name)
+{
+    symbol_table& table = Table();
+    {
+        std::shared_lock<std::shared_mutex> lock(table.mutex);
+        auto found = table.ids.find(name);
+        if (found != table.ids.end())
+            return found->second;
+    }
+    std::unique_lock<std::shared_mutex> lock(table.mutex);
+    // Another thread may have added the symbol while the lock was released
+    auto inserted = table.ids.emplace(name, (std::uint32_t)table.names.size());
+    if (inserted.second)
+        table.names.push_back(name);
+    return inserted.first->second;
+}
+
+std::uint32_t FindSymbol(const std::string& name)
+{
+    symbol_table& table = Table();
+    std::shared_lock<std::shared_mutex> lock(table.mutex);
+    auto found = table.ids.find(name);
+    return (found != table.ids.end()) ? found->second : NO_SYMBOL;
+}
+
+const std::string& SymbolName(std::uint32_t id)
+{
+    symbol_table& table = Table();
+    static const std::string unknown;
+    std::shared_lock<std::shared_mutex> lock(table.mutex);
+    if (id >= table.names.size())
+        return unknown;
+    return table.names[id];
+}
+
+std::size_t SymbolCount()
+{
+    symbol_table& table = Table();
+    std::shared_lock<std::shared_mutex> lock(table.mutex);
+    return table.names.size();
+}
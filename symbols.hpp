@@ -0,0 +1,40 @@
+#ifndef ACRAM_SYMBOLS_HPP
+#define ACRAM_SYMBOLS_HPP
+
+#include <cstdint>
+#include <string>
+/**
+ * @file symbols.hpp
+ * @brief process-wide table of interned symbol names
+ * @details Names of variables and parameters are stored once
+ * and referred to by dense ids, so trees keep ids in their nodes and never
+ * copy the names. The table only grows and may be used from several threads at once.
+ */
+
+/// Id that no symbol has
+const std::uint32_t NO_SYMBOL = 0xffffffffU;
+
+/**
+ * @brief Get id of a symbol
+ * @details The symbol is added to the table when it is met for the first time.
+ * Ids are given in order of addition starting from zero.
+ */
+std::uint32_t InternSymbol(const std::string& name);
+
+/**
+ * @brief Get id of a symbol without adding it to the table
+ * @return The id, or @p NO_SYMBOL if the symbol was never met
+ */
+std::uint32_t FindSymbol(const std::string& name);
+
+/**
+ * @brief Get name of a symbol
+ * @details The reference stays valid until the end of the program.
+ * Unknown ids give an empty string.
+ */
+const std::string& SymbolName(std::uint32_t id);
+
+/// Get number of symbols in the table, every id is less than it
+std::size_t SymbolCount();
+
+#endif // ACRAM_SYMBOLS_HPP
@@ -0,0 +1,340 @@
+#include "taylor.hpp"
+#include "expr_tree.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Get number of levels of a tree, a single node has one
+static std::size_t Height(const expr_node* node)
+{
+    if (node == nullptr)
+        return 0;
+    return 1 + std::max(Height(node->left), Height(node->right));
+}
+
+// Tell whether a number is zero, the sign is ignored
+static bool IsNull(double number)
+{
+    return std::fpclassify(number) == FP_ZERO;
+}
+
+// Tell whether a series has no terms of positive order
+static bool IsConstant(const double* w, std::size_t n)
+{
+    for (std::size_t k = 1; k < n; k++)
+        if (!IsNull(w[k]))
+            return false;
+    return true;
+}
+
+// The following functions calculate n coefficients of series w from series of operands //
+
+static void Constant(double value, std::size_t n, double* w)
+{
+    w[0] = value;
+    std::fill(w + 1, w + n, 0.0);
+}
+
+static void Multiply(const double* a, const double* b, std::size_t n, double* w)
+{
+    for (std::size_t k = 0; k < n; k++) {
+        double sum = 0.0;
+        for (std::size_t j = 0; j <= k; j++)
+            sum += a[j] * b[k - j];
+        w[k] = sum;
+    }
+}
+
+// w = a / b, so a = w * b
+static void Divide(const double* a, const double* b, std::size_t n, double* w)
+{
+    for (std::size_t k = 0; k < n; k++) {
+        double sum = a[k];
+        for (std::size_t j = 1; j <= k; j++)
+            sum -= b[j] * w[k - j];
+        w[k] = sum / b[0];
+    }
+}
+
+// w = exp(u), so w' = w * u'
+static void Exponent(const double* u, std::size_t n, double* w)
+{
+    w[0] = std::exp(u[0]);
+    for (std::size_t k = 1; k < n; k++) {
+        double sum = 0.0;
+        for (std::size_t j = 1; j <= k; j++)
+            sum += (double)j * u[j] * w[k - j];
+        w[k] = sum / (double)k;
+    }
+}
+
+// w = log(u), so w' * u = u'
+static void Logarithm(const double* u, std::size_t n, double* w)
+{
+    w[0] = std::log(u[0]);
+    for (std::size_t k = 1; k < n; k++) {
+        double sum = (double)k * u[k];
+        for (std::size_t j = 1; j < k; j++)
+            sum -= (double)j * w[j] * u[k - j];
+        w[k] = sum / ((double)k * u[0]);
+    }
+}
+
+// w = sqrt(u), so w * w = u
+static void Root(const double* u, std::size_t n, double* w)
+{
+    w[0] = std::sqrt(u[0]);
+    for (std::size_t k = 1; k < n; k++) {
+        double sum = u[k];
+        for (std::size_t j = 1; j < k; j++)
+            sum -= w[j] * w[k - j];
+        w[k] = sum / (2.0 * w[0]);
+    }
+}
+
+// s = sin(u) and c = cos(u), so s' = c * u' and c' = -s * u'
+static void SineCosine(const double* u, std::size_t n, double* s, double* c)
+{
+    s[0] = std::sin(u[0]);
+    c[0] = std::cos(u[0]);
+    for (std::size_t k = 1; k < n; k++) {
+        double s_sum = 0.0, c_sum = 0.0;
+        for (std::size_t j = 1; j <= k; j++) {
+            s_sum += (double)j * u[j] * c[k - j];
+            c_sum += (double)j * u[j] * s[k - j];
+        }
+        s[k] = s_sum / (double)k;
+        c[k] = -c_sum / (double)k;
+    }
+}
+
+// w' = sign * (1 + w^2) * u' with v = 1 + w^2 and w[0] given, as for tangent and cotangent
+static void Tangent(const double* u, std::size_t n, double sign, double* w, double* v)
+{
+    v[0] = 1.0 + w[0] * w[0];
+    for (std::size_t k = 1; k < n; k++) {
+        double sum = 0.0;
+        for (std::size_t j = 1; j <= k; j++)
+            sum += (double)j * u[j] * v[k - j];
+        w[k] = sign * sum / (double)k;
+        sum = 0.0;
+        for (std::size_t j = 0; j <= k; j++)
+            sum += w[j] * w[k - j];
+        v[k] = sum;
+    }
+}
+
+// w' * q = sign * u' with w[0] given, as for inverse trigonometric functions
+static void Arc(const double* u, const double* q, std::size_t n, double sign, double* w)
+{
+    for (std::size_t k = 1; k < n; k++) {
+        double sum = sign * (double)k * u[k];
+        for (std::size_t j = 1; j < k; j++)
+            sum -= (double)j * w[j] * q[k - j];
+        w[k] = sum / ((double)k * q[0]);
+    }
+}
+
+// w = a^p, so w' * a = p * a' * w, a[0] must not be zero
+static void Power(const double* a, double p, std::size_t n, double* w)
+{
+    w[0] = std::pow(a[0], p);
+    for (std::size_t k = 1; k < n; k++) {
+        double sum = 0.0;
+        for (std::size_t j = 1; j <= k; j++)
+            sum += (p * (double)j - (double)(k - j)) * a[j] * w[k - j];
+        w[k] = sum / ((double)k * a[0]);
+    }
+}
+
+// w = a^p by repeated squaring, square and temp are scratch series
+static void WholePower(const double* a, std::size_t p, std::size_t n, double* w, double* square, double* temp)
+{
+    Constant(1.0, n, w);
+    std::copy(a, a + n, square);
+    while (p > 0) {
+        if (p & 1) {
+            Multiply(w, square, n, temp);
+            std::copy(temp, temp + n, w);
+        }
+        p >>= 1;
+        if (p > 0) {
+            Multiply(square, square, n, temp);
+            std::copy(temp, temp + n, square);
+        }
+    }
+}
+
+void taylor_series::expand(const expr_node* root, double x, const double* params, std::size_t order, double* coefficients)
+{
+    count_ = order + 1;
+    x_ = x;
+    params_ = params;
+    std::size_t size = Height(root) * SLOTS * count_;
+    if (work_.size() < size)
+        work_.resize(size);
+    expand(root, 0, coefficients);
+}
+
+double* taylor_series::slot(std::size_t level, std::size_t index)
+{
+    return work_.data() + (level * SLOTS + index) * count_;
+}
+
+void taylor_series::expand(const expr_node* node, std::size_t level, double* result)
+{
+    std::size_t n = count_;
+    if (node == nullptr) {
+        Constant(0.0, n, result);
+        return;
+    }
+    switch (node->type) {
+    case INT:
+        Constant((double)node->value.integer, n, result);
+        return;
+    case FRAC:
+        Constant(node->value.frac, n, result);
+        return;
+    case VAR:
+        Constant(x_, n, result);
+        if (n > 1)
+            result[1] = 1.0;
+        return;
+    case PAR:
+        Constant(params_[node->value.integer], n, result);
+        return;
+    case OP:
+        break;
+    default:
+        Constant(0.0, n, result);
+        return;
+    }
+    double* lhs = slot(level, 0);
+    double* rhs = slot(level, 1);
+    double* aux = slot(level, 2);
+    double* extra = slot(level, 3);
+    if (node->left != nullptr)
+        expand(node->left, level + 1, lhs);
+    expand(node->right, level + 1, rhs);
+    int op = (int)node->value.integer;
+    // Operations on constants are constant, even where recurrences would divide by zero
+    if (IsConstant(rhs, n) && (node->left == nullptr || IsConstant(lhs, n))) {
+        Constant(Calculate(op, (node->left != nullptr) ? lhs[0] : 0.0, rhs[0]), n, result);
+        return;
+    }
+    switch (op) {
+    case ADD:
+        for (std::size_t k = 0; k < n; k++)
+            result[k] = lhs[k] + rhs[k];
+        break;
+    case SUB:
+        if (node->left == nullptr)
+            Constant(0.0, n, lhs);
+        for (std::size_t k = 0; k < n; k++)
+            result[k] = lhs[k] - rhs[k];
+        break;
+    case MUL:
+        Multiply(lhs, rhs, n, result);
+        break;
+    case DIV:
+        Divide(lhs, rhs, n, result);
+        break;
+    case PWR:
+        // An exponent without terms of positive order is constant as far as the series go
+        if (!IsConstant(rhs, n)) {
+            // a^b = exp(b * log(a))
+            Logarithm(lhs, n, aux);
+            Multiply(rhs, aux, n, extra);
+            Exponent(extra, n, result);
+        } else if (IsNull(lhs[0]) && rhs[0] >= 0.0 && std::floor(rhs[0]) >= rhs[0]) {
+            // All terms of a whole power of a series without a free term are of order p or higher
+            if (rhs[0] >= (double)n)
+                Constant(0.0, n, result);
+            else
+                WholePower(lhs, (std::size_t)rhs[0], n, result, aux, extra);
+        } else {
+            Power(lhs, rhs[0], n, result);
+        }
+        break;
+    case EXP:
+        Exponent(rhs, n, result);
+        break;
+    case LOG:
+        Logarithm(rhs, n, result);
+        break;
+    case SQRT:
+        Root(rhs, n, result);
+        break;
+    case SIN:
+        SineCosine(rhs, n, result, aux);
+        break;
+    case COS:
+        SineCosine(rhs, n, aux, result);
+        break;
+    case TAN:
+    case COT:
+        result[0] = Calculate(op, 0.0, rhs[0]);
+        Tangent(rhs, n, (op == TAN) ? 1.0 : -1.0, result, aux);
+        break;
+    case ASIN:
+    case ACOS:
+        // q = sqrt(1 - u^2)
+        Multiply(rhs, rhs, n, aux);
+        for (std::size_t k = 0; k < n; k++)
+            aux[k] = -aux[k];
+        aux[0] += 1.0;
+        Root(aux, n, extra);
+        result[0] = Calculate(op, 0.0, rhs[0]);
+        Arc(rhs, extra, n, (op == ASIN) ? 1.0 : -1.0, result);
+        break;
+    case ATAN:
+    case ACOT:
+        // q = 1 + u^2
+        Multiply(rhs, rhs, n, aux);
+        aux[0] += 1.0;
+        result[0] = Calculate(op, 0.0, rhs[0]);
+        Arc(rhs, aux, n, (op == ATAN) ? 1.0 : -1.0, result);
+        break;
+    default:
+        Constant(0.0, n, result);
+        break;
+    }
+}
+
+// Make node of a non-negative number, whole numbers become integers
+static expr_node* Magnitude(double number)
+{
+    expr_value value;
+    // Whole numbers are exact in double up to 2^53
+    if (number < 9007199254740992.0 && std::floor(number) >= number) {
+        value.integer = (long)number;
+        return new expr_node(INT, value);
+    }
+    value.frac = number;
+    return new expr_node(FRAC, value);
+}
+
+expr_node* TaylorPolynomial(const double* coefficients, std::size_t order, double point, std::uint32_t variable)
+{
+    expr_value value;
+    value.integer = variable;
+    expr_node* base = new expr_node(VAR, value);
+    if (point > 0.0)
+        base = MakeSub(base, Magnitude(point));
+    else if (point < 0.0)
+        base = MakeAdd(base, Magnitude(-point));
+    expr_node* sum = nullptr;
+    for (std::size_t k = 0; k <= order; k++) {
+        double coefficient = coefficients[k];
+        if (IsNull(coefficient))
+            continue;
+        expr_node* term = Magnitude(std::fabs(coefficient));
+        if (k > 0)
+            term = MakeMul(term, MakePwr(Copy(base), MakeInt((long)k)));
+        if (sum == nullptr)
+            sum = (coefficient < 0.0) ? MakeNeg(term) : term;
+        else
+            sum = (coefficient < 0.0) ? MakeSub(sum, term) : MakeAdd(sum, term);
+    }
+    delete base;
+    return (sum != nullptr) ? sum : MakeInt(0);
+}
@@ -0,0 +1,74 @@
+#ifndef ACRAM_TAYLOR_HPP
+#define ACRAM_TAYLOR_HPP
+
+#include "common.hpp"
+#include <cstdint>
+/**
+ * @file taylor.hpp
+ * @brief high-order derivatives at a point by truncated Taylor series
+ */
+
+/**
+ * @brief Calculator of Taylor coefficients of expressions
+ * @details Every node of a tree is represented by the truncated power series
+ * of its value around the point, and series of operations are calculated from
+ * series of operands by the usual recurrences: Cauchy product for multiplication,
+ * f' = f * u' for the exponent, the joint recurrence of sine and cosine, etc.
+ * Coefficients up to order n of a tree of size s take O(n^2 * s) operations,
+ * while repeated symbolic differentiation may grow exponentially.
+ *
+ * Where a function or its derivatives are undefined, coefficients are not finite.
+ * Powers with exponents that do not depend on the variable use the recurrence
+ * of @p PWR, which needs a non-zero base unless the exponent is a whole number.
+ * Buffers are kept between calls, so repeated calls allocate nothing.
+ */
+class taylor_series
+{
+    // Number of coefficients of every series
+    std::size_t count_ = 0;
+    // Value of the variable at the point
+    double x_ = 0.0;
+    // Values of parameters by symbol ids
+    const double* params_ = nullptr;
+    // Series of operands and intermediate ones, SLOTS of them for every level of the tree
+    tld::vector<double, 0> work_;
+
+public:
+    /// Construct calculator without buffers
+    taylor_series() = default;
+
+    /**
+     * @brief Calculate Taylor coefficients of a subtree
+     * @param root root of the subtree
+     * @param x point of expansion
+     * @param params values of parameters indexed by symbol ids, see @p InternSymbol
+     * @param order highest order of coefficients
+     * @param coefficients storage for @p order + 1 numbers: the k-th one is
+     * the k-th derivative at @p x divided by k!
+     */
+    void expand(const expr_node* root, double x, const double* params, std::size_t order, double* coefficients);
+
+private:
+    // Number of series of every level in work_
+    static const std::size_t SLOTS = 4;
+
+    // Get series of a slot of a level
+    double* slot(std::size_t level, std::size_t index);
+
+    // Calculate series of a node into result, using slots of its level for operands
+    void expand(const expr_node* node, std::size_t level, double* result);
+};
+
+/**
+ * @brief Build polynomial from Taylor coefficients
+ * @param coefficients coefficients from the lowest order, see @p taylor_series::expand
+ * @param order highest order
+ * @param point point of expansion
+ * @param variable symbol id of the variable
+ * @details Terms are sums of powers of (x - point) in increasing order, terms
+ * with zero coefficients are omitted. Whole coefficients become integers.
+ * The caller owns the tree.
+ */
+expr_node* TaylorPolynomial(const double* coefficients, std::size_t order, double point, std::uint32_t variable);
+
+#endif // ACRAM_TAYLOR_HPP
@@ -1,69 +1,244 @@
 #include "texio.hpp"
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <algorithm>
 
-tex_sentry::tex_sentry(const std::string& out_file_name) : tex_pid(0), tex_fo(nullptr), state(0)
+// Largest amount of data passed to a single write call
+static const std::size_t WRITE_CHUNK = 1UL << 20;
+
+// Wait for a child process as waitpid does, retrying if a signal interrupts the wait
+static pid_t WaitChild(pid_t pid, int* status, int options)
+{
+    pid_t reaped = 0;
+    do {
+        reaped = waitpid(pid, status, options);
+    } while (reaped < 0 && errno == EINTR);
+    return reaped;
+}
+
+tex_sentry::tex_sentry(const std::string& out_file_name, std::chrono::milliseconds timeout) :
+    tex_pid(0),
+    tex_fd(-1),
+    out_fd(-1),
+    log_fd(-1),
+    deadline(std::chrono::steady_clock::now() + timeout),
+    has_deadline(timeout.count() > 0),
+    state(0)
 {
-    int pipefd[2] = {};
-    if (pipe(pipefd) < 0) {
+    int in_pipe[2] = {-1, -1}, out_pipe[2] = {-1, -1};
+    // Close-on-exec keeps other pdflatex processes started in parallel from holding the pipes open
+    if (pipe2(in_pipe, O_CLOEXEC) < 0 || pipe2(out_pipe, O_CLOEXEC) < 0) {
         state = errno;
+        closeFd(in_pipe[0]);
+        closeFd(in_pipe[1]);
         return;
     }
     tex_pid = fork();
     if (tex_pid < 0) { // Fork was not sucessful
         state = errno;
+        tex_pid = 0;
+        closeFd(in_pipe[0]);
+        closeFd(in_pipe[1]);
+        closeFd(out_pipe[0]);
+        closeFd(out_pipe[1]);
         return;
     } else if (tex_pid == 0) { // Child section
-        close(pipefd[1]);
-        int trash_fd = open("/dev/null", O_WRONLY);
-        int tex_outputfd = dup2(trash_fd, STDOUT_FILENO);
-        if (tex_outputfd < 0) {
-            close(trash_fd);
-            exit(1);
-        }
-        close(trash_fd);
-        int tex_inputfd = dup2(pipefd[0], STDIN_FILENO);
-        if (tex_inputfd < 0) {
-            close(pipefd[0]);
-            exit(1);
-        }
-        close(pipefd[0]);
+        if (dup2(out_pipe[1], STDOUT_FILENO) < 0)
+            _exit(1);
+        if (dup2(in_pipe[0], STDIN_FILENO) < 0)
+            _exit(1);
         execlp("pdflatex", "pdflatex", "-jobname", out_file_name.c_str(), nullptr);
-        exit(1);
+        _exit(1);
     } // End of child section
-    close(pipefd[0]);
-    tex_fo = fdopen(pipefd[1], "w");
-    if (tex_fo == nullptr)
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+    tex_fd = in_pipe[1];
+    out_fd = out_pipe[0];
+    if (fcntl(tex_fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(out_fd, F_SETFL, O_NONBLOCK) < 0)
         state = errno;
+    // Without the log pdflatex output is drained anyway, just not saved
+    log_fd = open((out_file_name + ".stdout.log").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
 }
 
 tex_sentry::~tex_sentry()
 {
-    if (tex_fo != nullptr)
-        fclose(tex_fo);
+    closeFd(tex_fd);
+    closeFd(out_fd);
+    closeFd(log_fd);
+    if (tex_pid > 0) {
+        kill(tex_pid, SIGKILL);
+        WaitChild(tex_pid, nullptr, 0);
+    }
+}
+
+void tex_sentry::closeFd(int& fd)
+{
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+}
+
+void tex_sentry::drain()
+{
+    char buf[4096];
+    while (out_fd >= 0) {
+        ssize_t count = read(out_fd, buf, sizeof(buf));
+        if (count > 0) {
+            if (log_fd >= 0 && write(log_fd, buf, count) != count)
+                closeFd(log_fd);
+        } else if (count == 0) { // pdflatex has closed its output
+            closeFd(out_fd);
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+}
+
+bool tex_sentry::wait(bool for_input)
+{
+    while (true) {
+        int timeout_ms = -1;
+        if (has_deadline) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0) {
+                state = ETIMEDOUT;
+                return false;
+            }
+            timeout_ms = (int)std::min<long long>(left.count(), 1000000);
+        }
+        pollfd fds[2] = {
+            {for_input ? tex_fd : -1, POLLOUT, 0},
+            {out_fd, POLLIN, 0}
+        };
+        if (fds[0].fd < 0 && fds[1].fd < 0)
+            return false;
+        int ready = poll(fds, 2, timeout_ms);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            state = errno;
+            return false;
+        }
+        if (fds[1].revents)
+            drain();
+        if (fds[0].revents & (POLLERR | POLLHUP)) {
+            state = EPIPE;
+            return false;
+        }
+        if (fds[0].revents & POLLOUT)
+            return true;
+    }
 }
 
 void tex_sentry::transmit(const std::string& text)
 {
     if (state != 0)
         return;
-    std::size_t written = fwrite(text.data(), sizeof(char), text.size(), tex_fo);
-    if (written < text.size())
-        state = ferror(tex_fo);
+    // If pdflatex has died, writing raises SIGPIPE, which is blocked
+    // for this thread and then discarded, EPIPE is reported instead
+    sigset_t pipe_set, old_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+
+    const char* data = text.data();
+    std::size_t left = text.size();
+    while (left > 0 && state == 0) {
+        ssize_t written = write(tex_fd, data, std::min(left, WRITE_CHUNK));
+        if (written > 0) {
+            data += written;
+            left -= written;
+        } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            wait(true);
+        } else if (written < 0 && errno != EINTR) {
+            state = errno;
+        }
+    }
+
+    if (state == EPIPE) {
+        timespec no_wait = {0, 0};
+        sigtimedwait(&pipe_set, nullptr, &no_wait);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
 }
 
 void tex_sentry::end()
 {
-    int success = fclose(tex_fo);
-    // If execlp was not sucessful and pdflatex is not runnung, fclose results in broken pipe signal
-    if (success < 0)
-        state = errno;
-    tex_fo = nullptr;
+    // Closing the pipe tells pdflatex that the input is over
+    closeFd(tex_fd);
+    while (out_fd >= 0 && wait(false))
+        ;
+    closeFd(log_fd);
+    if (tex_pid <= 0)
+        return;
     int tex_status = 0;
-    waitpid(tex_pid, &tex_status, 0);
+    // Without a deadline there is nothing to check meanwhile, so the wait blocks
+    pid_t reaped = 0;
+    while ((reaped = WaitChild(tex_pid, &tex_status, has_deadline ? WNOHANG : 0)) == 0) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            state = ETIMEDOUT;
+            kill(tex_pid, SIGKILL);
+            WaitChild(tex_pid, &tex_status, 0);
+            tex_pid = 0;
+            return;
+        }
+        usleep(1000);
+    }
+    tex_pid = 0;
+    if (reaped < 0) {
+        state = errno;
+        return;
+    }
     if (!WIFEXITED(tex_status) || WEXITSTATUS(tex_status))
-        state = WEXITSTATUS(tex_status);
+        state = WIFEXITED(tex_status) ? WEXITSTATUS(tex_status) : ECHILD;
 }
 
 int tex_sentry::getState()
 {
     return state;
 }
+
+int RunProcess(const tld::vector<std::string>& argv)
+{
+    tld::vector<char*> c_argv;
+    for (std::size_t i = 0; i < argv.size(); i++)
+        c_argv.push_back(const_cast<char*>(argv[i].c_str()));
+    c_argv.push_back(nullptr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    } else if (pid == 0) { // Child section
+        int trash_fd = open("/dev/null", O_WRONLY);
+        if (trash_fd >= 0) {
+            dup2(trash_fd, STDOUT_FILENO);
+            close(trash_fd);
+        }
+        execvp(c_argv[0], c_argv.data());
+        _exit(127);
+    } // End of child section
+    int status = 0;
+    if (WaitChild(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status) == 127 ? -1 : WEXITSTATUS(status);
+}
+
+bool ExecutableExists(const std::string& name)
+{
+    const char* path_env = getenv("PATH");
+    if (path_env == nullptr)
+        return false;
+    std::string path_str(path_env), dir;
+    std::size_t pos = 0;
+    while (pos != std::string::npos) {
+        std::size_t end = path_str.find(':', pos);
+        dir = path_str.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        pos = (end == std::string::npos) ? end : end + 1;
+        if (dir.empty())
+            dir = ".";
+        if (access((dir + '/' + name).c_str(), X_OK) == 0)
+            return true;
+    }
+    return false;
+}
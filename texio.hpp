@@ -7,18 +7,33 @@
 #include <cstdio>
 #include <string>
 #include <iostream>
+#include <chrono>
+#include "lib/vector.h"
 /** 
  * @file texio.hpp
  * @brief pipe i/o handling class
  */
 
-/// Sentry object for redirecting LaTeX commands directly to pdflatex
+/**
+ * @brief Sentry object for redirecting LaTeX commands directly to pdflatex
+ * @details Data is written straight to the pipe file descriptor in non-blocking mode,
+ * waiting for pdflatex with poll() when the pipe is full. Meanwhile
+ * pdflatex standard output is drained into "out_file_name.stdout.log".
+ * All waiting is limited by a deadline, after which pdflatex is killed.
+ */
 class tex_sentry
 {
-    // pdflatex process id
+    // pdflatex process id, zero once the process is reaped
     pid_t tex_pid;
-    // file stream associated with pdflatex standard input
-    FILE* tex_fo;
+    // write end of the pipe associated with pdflatex standard input
+    int tex_fd;
+    // read end of the pipe associated with pdflatex standard output
+    int out_fd;
+    // file where pdflatex standard output is saved
+    int log_fd;
+    // time when pdflatex is considered stalled
+    std::chrono::steady_clock::time_point deadline;
+    bool has_deadline;
     // state of object
     int state;
 
@@ -28,21 +43,23 @@ public:
     /**
      * @brief Runs pdflatex with specified output file name
      * @param out_file_name file name without an extension
+     * @param timeout time given to pdflatex to finish, zero means no limit
      */
-    tex_sentry(const std::string& out_file_name);
+    tex_sentry(const std::string& out_file_name, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
 
     tex_sentry(const tex_sentry& that) = delete;
     tex_sentry(tex_sentry&& that) = delete;
     tex_sentry& operator =(const tex_sentry& that) = delete;
     tex_sentry& operator =(tex_sentry&& that) = delete;
 
-    /// Closes stream associated with pipe if hasn't been closed yet
+    /// Closes pipes, kills pdflatex if the session was not ended
     ~tex_sentry();
 
     /**
      * @brief Write commands to pdflatex standard input
      * @param text string that contains LaTeX commands
-     * @details If state is not OK, transmitting does nothing
+     * @details If state is not OK, transmitting does nothing.
+     * If the deadline passes, state becomes ETIMEDOUT
      */
     void transmit(const std::string& text);
     
@@ -51,6 +68,28 @@ public:
 
     /// Obtain sentry object state
     int getState();
+
+private:
+    // Wait for pipes to become ready, draining pdflatex output meanwhile.
+    // Returns true if standard input pipe is writable, false on error or timeout
+    bool wait(bool for_input);
+
+    // Move everything pdflatex has printed so far to the log
+    void drain();
+
+    // Close a descriptor if it is open
+    static void closeFd(int& fd);
 };
 
+/**
+ * @brief Run a program and wait for it to finish
+ * @param argv program name (searched in PATH) followed by its arguments
+ * @return Exit status of the program or -1 if it could not be started
+ * @details Standard output of the program is discarded
+ */
+int RunProcess(const tld::vector<std::string>& argv);
+
+/// Tell whether an executable with the name can be found in PATH
+bool ExecutableExists(const std::string& name);
+
 #endif // ACRAM_TEXIO_HPP